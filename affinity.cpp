@@ -0,0 +1,67 @@
+#include <sched.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <dirent.h>
+#include "affinity.h"
+
+bool parse_cpu_list( const char* str, std::vector< int >& cpus ) {
+    cpus.clear();
+    const char* p = str;
+    while( true ) {
+        char* end;
+        long first = strtol( p, &end, 10 );
+        if( end == p || first < 0 ) {
+            return false;
+        }
+        long last = first;
+        if( *end == '-' ) {
+            p = end + 1;
+            last = strtol( p, &end, 10 );
+            if( end == p || last < first ) {
+                return false;
+            }
+        }
+        if( last >= CPU_SETSIZE ) {
+            return false;
+        }
+        for( long cpu = first; cpu <= last; ++cpu ) {
+            cpus.push_back( ( int )cpu );
+        }
+        if( *end == '\0' ) {
+            return true;
+        }
+        if( *end != ',' ) {
+            return false;
+        }
+        p = end + 1;
+    }
+}
+
+bool bind_thread( int cpu ) {
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    CPU_SET( cpu, &set );
+    return pthread_setaffinity_np( pthread_self(), sizeof( set ), &set ) == 0;
+}
+
+// /sys/devices/system/cpu/cpuN/下有一个指向所在节点的nodeM链接（内核没有开启NUMA时没有）
+int cpu_node( int cpu ) {
+    char path[ 64 ];
+    snprintf( path, sizeof( path ), "/sys/devices/system/cpu/cpu%d", cpu );
+    DIR* dir = opendir( path );
+    if( !dir ) {
+        return -1;
+    }
+    int node = -1;
+    struct dirent* entry;
+    while( ( entry = readdir( dir ) ) != NULL ) {
+        if( strncmp( entry->d_name, "node", 4 ) == 0 && entry->d_name[4] >= '0' && entry->d_name[4] <= '9' ) {
+            node = atoi( entry->d_name + 4 );
+            break;
+        }
+    }
+    closedir( dir );
+    return node;
+}
@@ -0,0 +1,16 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <vector>
+
+// 解析CPU列表，格式同taskset -c：逗号分隔的编号或区间，如"0-3,8,10-11"
+bool parse_cpu_list( const char* str, std::vector< int >& cpus );
+
+// 把调用线程绑定到一个CPU上。绑定后线程第一次写入的内存由内核从这个CPU所在的NUMA节点分配（first touch），
+// 所以线程私有的结构应在绑定之后由线程自己分配
+bool bind_thread( int cpu );
+
+// CPU所在的NUMA节点，不知道时返回-1
+int cpu_node( int cpu );
+
+#endif
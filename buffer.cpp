@@ -0,0 +1,187 @@
+#include <stdlib.h>
+#include <string.h>
+#include "buffer.h"
+
+// 每个线程每级缓存的空闲块数、和全局链表一次交换的块数、全局链表每级最多保留的字节数
+static const int POOL_LOCAL_MAX = 32;
+static const int POOL_BATCH = 16;
+static const size_t POOL_GLOBAL_BYTES = 4 * 1024 * 1024;
+
+// 当前线程的空闲块缓存，线程退出时释放（每块的第一个字是下一块的地址）
+struct pool_cache {
+    void* head[ buffer_pool::CLASS_NUMBER ];
+    int count[ buffer_pool::CLASS_NUMBER ];
+
+    ~pool_cache() {
+        for( int i = 0; i < buffer_pool::CLASS_NUMBER; ++i ) {
+            while( head[i] ) {
+                void* next = *( void** )head[i];
+                free( head[i] );
+                head[i] = next;
+            }
+            count[i] = 0;
+        }
+    }
+};
+static thread_local pool_cache t_cache;
+
+buffer_pool::buffer_pool() {
+    for( int i = 0; i < CLASS_NUMBER; ++i ) {
+        m_classes[i].head = NULL;
+        m_classes[i].count = 0;
+        m_classes[i].max = POOL_GLOBAL_BYTES / ( MIN_CLASS_SIZE << i );
+    }
+}
+
+buffer_pool::~buffer_pool() {
+    for( int i = 0; i < CLASS_NUMBER; ++i ) {
+        while( m_classes[i].head ) {
+            free_block* b = m_classes[i].head;
+            m_classes[i].head = b->next;
+            free( b );
+        }
+    }
+}
+
+// 能放下size字节的最小一级，超过最大一级时返回-1
+int buffer_pool::class_of( size_t size ) {
+    int c = 0;
+    while( c < CLASS_NUMBER && ( MIN_CLASS_SIZE << c ) < size ) {
+        ++c;
+    }
+    return c < CLASS_NUMBER ? c : -1;
+}
+
+void* buffer_pool::get( size_t size ) {
+    int c = class_of( size );
+    if( c < 0 ) {
+        return malloc( size );
+    }
+
+    if( t_cache.count[c] == 0 ) {
+        // 从全局链表成批取一些到线程缓存
+        size_class& sc = m_classes[c];
+        sc.lock.lock();
+        for( int i = 0; i < POOL_BATCH && sc.head; ++i ) {
+            free_block* b = sc.head;
+            sc.head = b->next;
+            --sc.count;
+            b->next = ( free_block* )t_cache.head[c];
+            t_cache.head[c] = b;
+            ++t_cache.count[c];
+        }
+        sc.lock.unlock();
+        if( t_cache.count[c] == 0 ) {
+            return malloc( MIN_CLASS_SIZE << c );
+        }
+    }
+
+    free_block* b = ( free_block* )t_cache.head[c];
+    t_cache.head[c] = b->next;
+    --t_cache.count[c];
+    return b;
+}
+
+void buffer_pool::put( void* p, size_t size ) {
+    int c = class_of( size );
+    if( c < 0 || !p ) {
+        free( p );
+        return;
+    }
+
+    free_block* b = ( free_block* )p;
+    b->next = ( free_block* )t_cache.head[c];
+    t_cache.head[c] = b;
+    if( ++t_cache.count[c] < POOL_LOCAL_MAX ) {
+        return;
+    }
+
+    // 线程缓存满了：成批还给全局链表，全局链表也满了的直接free
+    size_class& sc = m_classes[c];
+    free_block* batch[ POOL_BATCH ];
+    for( int i = 0; i < POOL_BATCH; ++i ) {
+        batch[i] = ( free_block* )t_cache.head[c];
+        t_cache.head[c] = batch[i]->next;
+    }
+    t_cache.count[c] -= POOL_BATCH;
+    int kept = 0;
+    sc.lock.lock();
+    for( ; kept < POOL_BATCH && sc.count < sc.max; ++kept ) {
+        batch[ kept ]->next = sc.head;
+        sc.head = batch[ kept ];
+        ++sc.count;
+    }
+    sc.lock.unlock();
+    for( int i = kept; i < POOL_BATCH; ++i ) {
+        free( batch[i] );
+    }
+}
+
+size_t buffer_pool::idle_bytes() {
+    size_t ret = 0;
+    for( int i = 0; i < CLASS_NUMBER; ++i ) {
+        m_classes[i].lock.lock();
+        ret += m_classes[i].count * ( MIN_CLASS_SIZE << i );
+        m_classes[i].lock.unlock();
+    }
+    return ret;
+}
+
+buffer::~buffer() {
+    release();
+}
+
+bool buffer::grow( size_t limit ) {
+    if( m_end < m_capacity ) {
+        return true;
+    }
+    if( m_start > 0 ) {
+        compact();
+        return true;
+    }
+    size_t capacity = m_capacity ? m_capacity * 2 : BUFFER_INIT_SIZE;
+    if( capacity > limit ) {
+        capacity = limit;
+    }
+    if( capacity <= m_capacity ) {
+        return false;
+    }
+    char* data = ( char* )buffer_pool::get_instance()->get( capacity );
+    if( !data ) {
+        return false;
+    }
+    if( m_data ) {
+        memcpy( data, m_data, m_end );
+        buffer_pool::get_instance()->put( m_data, m_capacity );
+    }
+    m_data = data;
+    m_capacity = capacity;
+    return true;
+}
+
+void buffer::consume( size_t n ) {
+    if( n >= size() ) {
+        release();
+        return;
+    }
+    m_start += n;
+    if( m_start >= size() ) {
+        compact();
+    }
+}
+
+void buffer::compact() {
+    memmove( m_data, m_data + m_start, size() );
+    m_end -= m_start;
+    m_start = 0;
+}
+
+void buffer::release() {
+    if( m_data ) {
+        buffer_pool::get_instance()->put( m_data, m_capacity );
+    }
+    m_data = NULL;
+    m_capacity = 0;
+    m_start = 0;
+    m_end = 0;
+}
@@ -0,0 +1,89 @@
+#ifndef BUFFER_H
+#define BUFFER_H
+
+#include <stddef.h>
+#include "locker.h"
+
+// 初始容量：大多数请求（请求行+几个头部）放得下
+#define BUFFER_INIT_SIZE 1024
+
+// 按2的幂分级（1KB到1MB）的内存块池，连接只在有数据要处理时才借用缓冲区，空闲时归还。
+// 每个线程缓存每级最多POOL_LOCAL_MAX个空闲块，不加锁；满了或空了时和全局链表成批交换（一次加锁），
+// 全局链表每级最多保留POOL_GLOBAL_BYTES字节，多出的还给系统。超过最大一级的直接malloc/free
+class buffer_pool {
+public:
+    static const int CLASS_NUMBER = 11;
+    static const size_t MIN_CLASS_SIZE = 1024;
+
+public:
+    static buffer_pool* get_instance() {
+        static buffer_pool instance;
+        return &instance;
+    }
+
+    // 借用至少size字节的内存块，内存不足时返回NULL；归还时的size必须和借用时相同
+    void* get( size_t size );
+    void put( void* p, size_t size );
+
+    // 全局链表中空闲的字节数（不含各线程缓存的）
+    size_t idle_bytes();
+
+private:
+    buffer_pool();
+    ~buffer_pool();
+
+    struct free_block {
+        free_block* next;
+    };
+
+    struct size_class {
+        locker lock;
+        free_block* head;
+        int count;
+        int max;
+    };
+
+    static int class_of( size_t size );
+
+private:
+    size_class m_classes[ CLASS_NUMBER ];
+};
+
+// 连接的读缓冲区：一块连续内存（解析器按连续的字节扫描），第一次读数据时才从buffer_pool借用，放不下时倍增直到上限；
+// 扩容和整理都会移动数据，所以解析器只能保存相对data()的偏移量，不能保存指针。
+// 已经处理完的数据用consume()从头部丢弃：只是移动起点，不复制后面的数据
+class buffer {
+public:
+    buffer() : m_data( NULL ), m_capacity( 0 ), m_start( 0 ), m_end( 0 ) {}
+    ~buffer();
+
+    char* data() { return m_data + m_start; }
+    size_t size() const { return m_end - m_start; }
+    size_t capacity() const { return m_capacity; }
+
+    // 可写入的位置和长度，写入后用commit()提交
+    char* write_ptr() { return m_data + m_end; }
+    size_t writable() const { return m_capacity - m_end; }
+    void commit( size_t n ) { m_end += n; }
+
+    // 没有可写空间时先把数据移到开头，仍然没有时扩容（不超过limit），已经达到上限或内存不足时返回false
+    bool grow( size_t limit );
+
+    // 丢弃头部n个字节；缓冲区变空时内存还给buffer_pool，空闲的长连接不占用读缓冲区。
+    // 剩下的数据不比丢弃的多时才移到开头（复制的字节数不超过丢弃的，流水线中的大量小请求不会反复复制后面的数据）
+    void consume( size_t n );
+
+    void clear() { m_start = m_end = 0; }
+    void release();
+
+private:
+    void compact();
+
+private:
+    char* m_data;
+    size_t m_capacity;
+    size_t m_start;     // 还没丢弃的数据从这里开始
+    size_t m_end;       // 已写入数据的末尾
+};
+
+#endif
@@ -0,0 +1,293 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libgen.h>
+#include "config.h"
+#include "http_conn.h"
+#include "log.h"
+#include "buffer.h"
+#include "affinity.h"
+
+config::config() {
+    port = 0;
+    loops = 1;
+    backlog = 1024;
+    io_backend = IO_EPOLL;
+    fixed_files = false;
+    actor_model = http_conn::PROACTOR;
+    thread_number = 8;
+    work_stealing = false;
+    incoming_cpu = false;
+    listen_trig_mode = http_conn::LT;
+    conn_trig_mode = http_conn::ET;
+    header_timeout = 10;
+    idle_timeout = 30;
+    keepalive_timeout = 15;
+    transport = TRANSPORT_WRITEV;
+    sendfile_min = 64 * 1024;
+    max_request_size = 64 * 1024;
+    gzip_level = 6;
+    status_url = "/status";
+    trace_every = 0;
+    trace_slow_ms = 0;
+    trace_prefix = "trace";
+    handoff_path = NULL;
+    drain_timeout = 30;
+    log_file = NULL;
+    access_log = NULL;
+    log_level = LOG_LEVEL_INFO;
+    log_max_size = 64 * 1024 * 1024;
+}
+
+// 解析"lt"或"et"
+static bool parse_trig_mode( const char* str, int len, int* mode ) {
+    if( len == 2 && strncasecmp( str, "lt", 2 ) == 0 ) {
+        *mode = http_conn::LT;
+    } else if( len == 2 && strncasecmp( str, "et", 2 ) == 0 ) {
+        *mode = http_conn::ET;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+void config::usage( const char* prog ) {
+    printf( "usage: %s [options] port_number\n", prog );
+    printf( "  -A prefix                 write a key=value access log line per request to prefix-YYYY-MM-DD.log\n" );
+    printf( "  -a proactor|reactor       proactor: event loop reads/writes, workers parse;\n"
+            "                            reactor: workers do recv, parse and writev (default proactor)\n" );
+    printf( "  -b backlog                listen queue length, capped by net.core.somaxconn (default 1024)\n" );
+    printf( "  -c cpus                   pin event loop i to the i-th cpu of a list like \"0-3,8\"; per-loop\n"
+            "                            structures are allocated after pinning, on the local NUMA node\n" );
+    printf( "  -D seconds                after a hot restart, wait this long for open connections (default 30)\n" );
+    printf( "  -e lt|et|LISTEN,CONN      epoll trigger mode for the listening and connection sockets,\n"
+            "                            e.g. \"et\" or \"lt,et\" (default lt,et)\n" );
+    printf( "  -g level                  gzip level for compressible files without a .gz sidecar, 0 disables (default 6)\n" );
+    printf( "  -H path                   hot restart: take over the listening sockets of a server running with the\n"
+            "                            same -H, which then stops accepting and drains; wait for the next restart\n" );
+    printf( "  -I epoll|uring[,fixed]    event loop I/O: epoll readiness, or io_uring with multishot accept and\n"
+            "                            provided-buffer recv, parsing in the loop thread (falls back to epoll\n"
+            "                            when unsupported); \"fixed\" registers connection sockets (default epoll)\n" );
+    printf( "  -i seconds                close a connection with no progress while a response is pending (default 30)\n" );
+    printf( "  -j threads                number of worker threads (default 8)\n" );
+    printf( "  -k seconds                close an idle keep-alive connection (default 15)\n" );
+    printf( "  -L prefix                 write the server log to prefix-YYYY-MM-DD.log instead of stdout\n" );
+    printf( "  -m bytes                  largest request accepted; read buffers grow up to this (default 65536)\n" );
+    printf( "  -n loops                  number of epoll event loops, one thread each (default 1)\n" );
+    printf( "  -R                        with -c, set SO_INCOMING_CPU so the kernel hands each loop the connections\n"
+            "                            received on its cpu (align with the NIC RX queue IRQ affinity)\n" );
+    printf( "  -r seconds                a request must be fully received within this time (default 10)\n" );
+    printf( "  -S url|off                serve live metrics at url, add ?format=prometheus for the Prometheus\n"
+            "                            text format; \"off\" disables it (default /status)\n" );
+    printf( "  -s                        work-stealing scheduler: one queue per worker, tasks routed by fd\n" );
+    printf( "  -T every[,slow_ms]        time each request's stages; every 10s write one request in \"every\" per\n"
+            "                            thread, and all taking at least slow_ms, to trace-*.json (Chrome trace format)\n" );
+    printf( "  -t writev|sendfile|auto   response body transport (default writev)\n" );
+    printf( "  -v debug|info|warn|error  lowest log level written (default info)\n" );
+    printf( "  -w cpus                   pin worker thread i to the i-th cpu of the list; each worker allocates its\n"
+            "                            own queue after pinning\n" );
+    printf( "  -z bytes                  smallest file sent with sendfile in auto mode (default 65536)\n" );
+}
+
+bool config::parse_arg( int argc, char* argv[] ) {
+    int opt;
+    const char* str = "A:a:b:c:D:e:g:H:I:i:j:k:L:m:n:Rr:S:sT:t:v:w:z:";
+    while( ( opt = getopt( argc, argv, str ) ) != -1 ) {
+        switch( opt ) {
+            case 'A': {
+                access_log = optarg;
+                break;
+            }
+            case 'a': {
+                if( strcmp( optarg, "proactor" ) == 0 ) {
+                    actor_model = http_conn::PROACTOR;
+                } else if( strcmp( optarg, "reactor" ) == 0 ) {
+                    actor_model = http_conn::REACTOR;
+                } else {
+                    return false;
+                }
+                break;
+            }
+            case 'b': {
+                backlog = atoi( optarg );
+                if( backlog <= 0 ) {
+                    return false;
+                }
+                break;
+            }
+            case 'c': {
+                if( !parse_cpu_list( optarg, loop_cpus ) ) {
+                    return false;
+                }
+                break;
+            }
+            case 'D': {
+                drain_timeout = atoi( optarg );
+                if( drain_timeout <= 0 ) {
+                    return false;
+                }
+                break;
+            }
+            case 'e': {
+                const char* conn = strchr( optarg, ',' );
+                int listen_len = conn ? conn - optarg : strlen( optarg );
+                conn = conn ? conn + 1 : optarg;
+                if( !parse_trig_mode( optarg, listen_len, &listen_trig_mode )
+                    || !parse_trig_mode( conn, strlen( conn ), &conn_trig_mode ) ) {
+                    return false;
+                }
+                break;
+            }
+            case 'g': {
+                gzip_level = atoi( optarg );
+                if( gzip_level < 0 || gzip_level > 9 ) {
+                    return false;
+                }
+                break;
+            }
+            case 'H': {
+                handoff_path = optarg;
+                break;
+            }
+            case 'I': {
+                if( strcmp( optarg, "epoll" ) == 0 ) {
+                    io_backend = IO_EPOLL;
+                } else if( strcmp( optarg, "uring" ) == 0 ) {
+                    io_backend = IO_URING;
+                } else if( strcmp( optarg, "uring,fixed" ) == 0 ) {
+                    io_backend = IO_URING;
+                    fixed_files = true;
+                } else {
+                    return false;
+                }
+                break;
+            }
+            case 'i': {
+                idle_timeout = atoi( optarg );
+                if( idle_timeout <= 0 ) {
+                    return false;
+                }
+                break;
+            }
+            case 'j': {
+                thread_number = atoi( optarg );
+                if( thread_number <= 0 ) {
+                    return false;
+                }
+                break;
+            }
+            case 'k': {
+                keepalive_timeout = atoi( optarg );
+                if( keepalive_timeout <= 0 ) {
+                    return false;
+                }
+                break;
+            }
+            case 'L': {
+                log_file = optarg;
+                break;
+            }
+            case 'm': {
+                max_request_size = atoi( optarg );
+                if( max_request_size < BUFFER_INIT_SIZE ) {
+                    return false;
+                }
+                break;
+            }
+            case 'n': {
+                loops = atoi( optarg );
+                if( loops <= 0 ) {
+                    return false;
+                }
+                break;
+            }
+            case 'R': {
+                incoming_cpu = true;
+                break;
+            }
+            case 'r': {
+                header_timeout = atoi( optarg );
+                if( header_timeout <= 0 ) {
+                    return false;
+                }
+                break;
+            }
+            case 'S': {
+                if( strcmp( optarg, "off" ) == 0 ) {
+                    status_url = NULL;
+                } else if( optarg[0] == '/' ) {
+                    status_url = optarg;
+                } else {
+                    return false;
+                }
+                break;
+            }
+            case 's': {
+                work_stealing = true;
+                break;
+            }
+            case 'T': {
+                const char* slow = strchr( optarg, ',' );
+                trace_every = atoi( optarg );
+                trace_slow_ms = slow ? atoi( slow + 1 ) : 0;
+                if( trace_every < 0 || trace_slow_ms < 0 || ( trace_every == 0 && trace_slow_ms == 0 ) ) {
+                    return false;
+                }
+                break;
+            }
+            case 't': {
+                if( strcmp( optarg, "writev" ) == 0 ) {
+                    transport = TRANSPORT_WRITEV;
+                } else if( strcmp( optarg, "sendfile" ) == 0 ) {
+                    transport = TRANSPORT_SENDFILE;
+                } else if( strcmp( optarg, "auto" ) == 0 ) {
+                    transport = TRANSPORT_AUTO;
+                } else {
+                    return false;
+                }
+                break;
+            }
+            case 'v': {
+                const char* levels[] = { "debug", "info", "warn", "error" };
+                log_level = -1;
+                for( int i = LOG_LEVEL_DEBUG; i <= LOG_LEVEL_ERROR; ++i ) {
+                    if( strcmp( optarg, levels[i] ) == 0 ) {
+                        log_level = i;
+                    }
+                }
+                if( log_level < 0 ) {
+                    return false;
+                }
+                break;
+            }
+            case 'w': {
+                if( !parse_cpu_list( optarg, worker_cpus ) ) {
+                    return false;
+                }
+                break;
+            }
+            case 'z': {
+                sendfile_min = atol( optarg );
+                if( sendfile_min < 0 ) {
+                    return false;
+                }
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+
+    // SO_INCOMING_CPU的值是循环绑定的CPU
+    if( incoming_cpu && loop_cpus.empty() ) {
+        return false;
+    }
+
+    // 端口号仍然作为最后一个参数传入
+    if( optind != argc - 1 ) {
+        return false;
+    }
+    port = atoi( argv[ optind ] );
+    return port > 0;
+}
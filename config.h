@@ -0,0 +1,90 @@
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stddef.h>
+#include <vector>
+
+// 服务器的启动配置，由命令行参数解析得到
+class config {
+public:
+    // 响应正文（文件内容）的发送方式
+    enum TRANSPORT { TRANSPORT_WRITEV = 0, TRANSPORT_SENDFILE, TRANSPORT_AUTO };
+
+    // 事件循环的I/O方式
+    enum IO_BACKEND { IO_EPOLL = 0, IO_URING };
+
+public:
+    config();
+    ~config(){}
+
+    // 解析命令行参数，参数错误时返回false
+    bool parse_arg( int argc, char* argv[] );
+    void usage( const char* prog );
+
+public:
+    int port;
+
+    // 监听队列长度
+    int backlog;
+
+    // 事件循环（epoll线程）的数量，大于1时每个循环用SO_REUSEPORT各自监听端口
+    int loops;
+
+    // epoll（默认）或io_uring（内核不支持时退回epoll）；io_uring时连接socket是否注册为固定文件
+    int io_backend;
+    bool fixed_files;
+
+    // 并发模式：http_conn::PROACTOR（默认）或http_conn::REACTOR
+    int actor_model;
+
+    // 工作线程数；是否使用工作窃取调度（每个线程一个队列，按fd选择线程）
+    int thread_number;
+    bool work_stealing;
+
+    // 事件循环和工作线程绑定的CPU，第i个线程绑定到第i个（不够时循环使用），为空时不绑定；
+    // 事件循环的监听socket是否设置SO_INCOMING_CPU
+    std::vector< int > loop_cpus;
+    std::vector< int > worker_cpus;
+    bool incoming_cpu;
+
+    // 监听socket和连接socket的epoll触发模式：http_conn::LT或http_conn::ET
+    int listen_trig_mode;
+    int conn_trig_mode;
+
+    // 超时时长（秒）：读完整请求、发送响应时无活动、长连接等待下一个请求
+    int header_timeout;
+    int idle_timeout;
+    int keepalive_timeout;
+
+    // writev：mmap文件后和响应头一起writev；sendfile：响应头MSG_MORE，正文sendfile零拷贝；
+    // auto：小于sendfile_min的文件用writev，大文件用sendfile（不映射到进程中）
+    int transport;
+    long sendfile_min;
+
+    // 可压缩类型的文件没有预压缩文件时运行时gzip压缩的级别（1-9），0表示不压缩
+    int gzip_level;
+
+    // 一个请求（请求行+头部+请求体）的最大字节数，即连接读缓冲区增长的上限
+    int max_request_size;
+
+    // 监控指标的URL，NULL表示不提供
+    const char* status_url;
+
+    // 请求阶段耗时采样：每个线程每trace_every个请求记录一个、耗时不少于trace_slow_ms毫秒的都记录，都为0时不开启；
+    // 写到trace_prefix-YYYY-MM-DD-HHMMSS-N.json
+    int trace_every;
+    int trace_slow_ms;
+    const char* trace_prefix;
+
+    // 热重启用的Unix socket路径（NULL表示不支持热重启）；交接后排空已有连接的最长时间（秒）
+    const char* handoff_path;
+    int drain_timeout;
+
+    // 服务器日志和访问日志的文件路径前缀（NULL：服务器日志写标准输出，不记录访问日志）、日志级别、单个文件的最大字节数
+    const char* log_file;
+    const char* access_log;
+    int log_level;
+    size_t log_max_size;
+};
+
+#endif
@@ -0,0 +1,762 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include "eventloop.h"
+#include "log.h"
+#include "affinity.h"
+
+extern void addfd( int epollfd, int fd, bool one_shot, bool et );
+extern void removefd( int epollfd, int fd );
+
+// io_uring完成项的user_data：高32位是操作种类，低32位是fd
+enum URING_OP { URING_ACCEPT = 1, URING_LISTEN_POLL, URING_RECV, URING_SEND, URING_FILES, URING_WAKE, URING_CANCEL };
+
+// m_uring_state中每个连接的状态位：recv/sendmsg已提交还没完成、等它们完成后关闭、socket在固定文件表中
+static const unsigned char URING_RECV_PENDING = 1;
+static const unsigned char URING_SEND_PENDING = 2;
+static const unsigned char URING_CLOSING = 4;
+static const unsigned char URING_FIXED = 8;
+
+// 从固定文件表中去掉一个socket时IORING_OP_FILES_UPDATE的参数
+static const int no_fd = -1;
+
+event_loop::event_loop( int id, http_conn* users, threadpool< http_conn >* pool ) :
+        m_id( id ), m_cpu( -1 ), m_incoming_cpu( false ), m_epollfd( -1 ), m_listenfd( -1 ), m_listen_et( false ), m_spare_fd( -1 ), m_accept_more( false ),
+        m_wakefd( -1 ), m_drain_deadline( 0 ), m_draining( false ), m_last_sweep( 0 ),
+        m_shed( 0 ), m_user_count( 0 ),
+        m_users( users ), m_pool( pool ), m_timers( TIMER_SLOTS, TIMER_TICK_MS ), m_events( NULL ),
+        m_want_uring( false ), m_fixed_files( false ), m_ring( NULL ) {
+
+    m_max_timer_wait = http_conn::m_timeout[0];
+    for( int i = 0; i < http_conn::TIMEOUT_KIND_NUMBER; ++i ) {
+        m_expired[i] = 0;
+        if( http_conn::m_timeout[i] < m_max_timer_wait ) {
+            m_max_timer_wait = http_conn::m_timeout[i];
+        }
+    }
+}
+
+event_loop::~event_loop() {
+    if( m_epollfd >= 0 ) {
+        close( m_epollfd );
+    }
+    if( m_listenfd >= 0 ) {
+        close( m_listenfd );
+    }
+    if( m_spare_fd >= 0 ) {
+        close( m_spare_fd );
+    }
+    if( m_wakefd >= 0 ) {
+        close( m_wakefd );
+    }
+    delete [] m_events;
+    delete m_ring;
+}
+
+bool event_loop::init( int port, bool reuseport, bool listen_et, int backlog, int listenfd ) {
+
+    m_listen_et = listen_et;
+
+    if( listenfd >= 0 ) {
+        // 从旧进程接过来的socket：地址、SO_REUSEPORT和非阻塞标志都保留着，只按这次的参数更新监听队列长度
+        m_listenfd = listenfd;
+    } else if( !create_listener( port, reuseport ) ) {
+        return false;
+    }
+    if( m_incoming_cpu && m_cpu >= 0
+        && setsockopt( m_listenfd, SOL_SOCKET, SO_INCOMING_CPU, &m_cpu, sizeof( m_cpu ) ) < 0 ) {
+        return false;
+    }
+
+    if( listen( m_listenfd, backlog ) < 0 ) {
+        return false;
+    }
+
+    m_spare_fd = open( "/dev/null", O_RDONLY | O_CLOEXEC );
+    if( m_spare_fd < 0 ) {
+        return false;
+    }
+
+    m_epollfd = epoll_create( 5 );
+    if( m_epollfd < 0 ) {
+        return false;
+    }
+    addfd( m_epollfd, m_listenfd, false, m_listen_et );
+
+    m_wakefd = eventfd( 0, EFD_NONBLOCK | EFD_CLOEXEC );
+    if( m_wakefd < 0 ) {
+        return false;
+    }
+    addfd( m_epollfd, m_wakefd, false, false );
+    return true;
+}
+
+bool event_loop::create_listener( int port, bool reuseport ) {
+
+    m_listenfd = socket( PF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    if( m_listenfd < 0 ) {
+        return false;
+    }
+
+    int reuse = 1;
+    setsockopt( m_listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
+    if( reuseport && setsockopt( m_listenfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof( reuse ) ) < 0 ) {
+        return false;
+    }
+
+    struct sockaddr_in address;
+    memset( &address, 0, sizeof( address ) );
+    address.sin_addr.s_addr = INADDR_ANY;
+    address.sin_family = AF_INET;
+    address.sin_port = htons( port );
+    return bind( m_listenfd, ( struct sockaddr* )&address, sizeof( address ) ) == 0;
+}
+
+bool event_loop::start() {
+    return pthread_create( &m_thread, NULL, worker, this ) == 0;
+}
+
+void event_loop::join() {
+    pthread_join( m_thread, NULL );
+}
+
+void* event_loop::worker( void* arg ) {
+    event_loop* loop = ( event_loop* )arg;
+    loop->loop();
+    return loop;
+}
+
+// 每次最多accept ACCEPT_BUDGET个连接（accept4直接得到非阻塞、close-on-exec的fd），连接风暴时事件循环
+// 不会一直停在accept上，已有连接的事件也能得到处理。用完预算时监听队列中可能还有连接：LT模式下内核会继续通知，
+// ET模式下不会，所以置m_accept_more，由loop()下一轮不等待、直接继续accept
+void event_loop::handle_accept() {
+
+    m_accept_more = false;
+    for( int i = 0; i < ACCEPT_BUDGET; ++i ) {
+
+        struct sockaddr_in client_address;
+        socklen_t client_addrlength = sizeof( client_address );
+        int connfd = accept4( m_listenfd, ( struct sockaddr* )&client_address, &client_addrlength, SOCK_NONBLOCK | SOCK_CLOEXEC );
+
+        if ( connfd < 0 ) {
+            if( errno == EAGAIN || errno == EWOULDBLOCK ) {
+                return;
+            }
+            if( errno == EINTR || errno == ECONNABORTED || errno == EPROTO ) {
+                continue;  // 对方在accept之前就断开了，接着处理下一个
+            }
+            if( errno == EMFILE || errno == ENFILE ) {
+                if( shed_connection() ) {
+                    continue;
+                }
+                return;  // 监听队列已经空了，或者没有预留的fd
+            }
+            LOG_ERROR( "accept failed, errno is: %d", errno );
+            return;
+        }
+
+        // users数组以fd为下标，超出范围的连接无法处理
+        if( connfd >= MAX_FD ) {
+
+            close(connfd);
+        } else {
+
+            m_users[connfd].init( connfd, client_address, this );
+            schedule( m_users + connfd, timer_now_ms() );
+        }
+    }
+    m_accept_more = true;
+}
+
+// fd用完（EMFILE/ENFILE）时，连接会一直留在监听队列中：LT模式下epoll_wait立即返回，事件循环空转；
+// ET模式下不再通知，新连接都卡住。关掉预留的空闲fd，腾出一个fd接受队头的连接并立即关闭（对方马上知道被拒绝），
+// 再重新预留。返回false表示监听队列已经空了，或者没有预留的fd（被其他线程占用了），这一轮不再accept
+bool event_loop::shed_connection() {
+
+    if( m_spare_fd < 0 ) {
+        m_spare_fd = open( "/dev/null", O_RDONLY | O_CLOEXEC );
+        if( m_spare_fd < 0 ) {
+            LOG_ERROR( "event loop %d: out of file descriptors and no spare fd", m_id );
+            return false;
+        }
+    }
+    close( m_spare_fd );
+    int fd = accept4( m_listenfd, NULL, NULL, SOCK_CLOEXEC );
+    if( fd >= 0 ) {
+        close( fd );
+    }
+    m_spare_fd = open( "/dev/null", O_RDONLY | O_CLOEXEC );
+    if( fd < 0 ) {
+        return false;
+    }
+
+    unsigned long shed = m_shed.fetch_add( 1, std::memory_order_relaxed ) + 1;
+    if( ( shed & ( shed - 1 ) ) == 0 ) {
+        LOG_WARN( "event loop %d: out of file descriptors, %lu connections closed on accept", m_id, shed );
+    }
+    return true;
+}
+
+// 把连接放入时间轮：在它的到期时间检查，但最多等m_max_timer_wait，
+// 因为连接的到期时间可能被其他线程改得更早（如从无活动超时变为长连接超时）
+void event_loop::schedule( http_conn* conn, long now ) {
+    long expire = conn->get_deadline();
+    if( expire > now + m_max_timer_wait ) {
+        expire = now + m_max_timer_wait;
+    }
+    m_timers.add( conn, conn->get_timer_gen(), expire );
+}
+
+// 处理时间轮中到期的项：连接已关闭或fd已被新连接复用的直接丢弃，
+// 被续期的按新的到期时间放回，正在被工作线程处理的稍后再检查，其余的超时关闭
+void event_loop::handle_timers() {
+
+    long now = timer_now_ms();
+    m_timeouts.clear();
+    m_timers.advance( now, m_timeouts );
+
+    for( size_t i = 0; i < m_timeouts.size(); ++i ) {
+
+        http_conn* conn = ( http_conn* )m_timeouts[i].data;
+        if( !conn->is_open() || conn->get_timer_gen() != m_timeouts[i].gen ) {
+            continue;
+        }
+
+        if( conn->get_deadline() > now ) {
+            schedule( conn, now );
+        } else if( conn->is_busy() ) {
+            m_timers.add( conn, m_timeouts[i].gen, now + TIMER_TICK_MS );
+        } else {
+            m_expired[ conn->get_timeout_kind() ].fetch_add( 1, std::memory_order_relaxed );
+            if( m_ring ) {
+                uring_close( conn - m_users );
+            } else {
+                conn->close_conn();
+            }
+        }
+    }
+}
+
+// 把连接交给工作线程；请求队列已满时EPOLLONESHOT不会再触发这个连接的事件，只能关闭
+void event_loop::dispatch( int sockfd, http_conn::IO_STATE state ) {
+
+    m_users[sockfd].set_io_state( state );
+    m_users[sockfd].enter_worker();
+    if( !m_pool->append( m_users + sockfd, sockfd ) ) {
+
+        m_users[sockfd].leave_worker();
+        m_users[sockfd].close_conn();
+    }
+}
+
+void event_loop::add_fd( int fd ) {
+    if( !m_ring ) {
+        addfd( m_epollfd, fd, true, http_conn::m_conn_trig_mode == http_conn::ET );
+        return;
+    }
+    m_uring_state[fd] = 0;
+    if( ( unsigned )fd < m_ring->get_file_count() ) {
+        // 放入固定文件表中以fd为下标的位置，之后的recv/sendmsg不用每次查找、引用计数socket；
+        // 链接到随后提交的第一个recv上，保证先完成注册。成功时不产生完成项
+        io_uring_sqe* sqe = uring_sqe();
+        sqe->opcode = IORING_OP_FILES_UPDATE;
+        sqe->fd = -1;
+        sqe->addr = ( __u64 )( unsigned long )&m_fd_slots[fd];
+        sqe->len = 1;
+        sqe->off = fd;
+        sqe->flags = IOSQE_IO_LINK | IOSQE_CQE_SKIP_SUCCESS;
+        sqe->user_data = ( ( __u64 )URING_FILES << 32 ) | ( unsigned )fd;
+        m_uring_state[fd] = URING_FIXED;
+    }
+}
+
+void event_loop::remove_fd( int fd ) {
+    if( !m_ring ) {
+        removefd( m_epollfd, fd );
+        return;
+    }
+    if( m_uring_state[fd] & URING_FIXED ) {
+        // 固定文件表也持有socket的引用，不去掉的话close()之后连接并不会真正关闭
+        io_uring_sqe* sqe = uring_sqe();
+        sqe->opcode = IORING_OP_FILES_UPDATE;
+        sqe->fd = -1;
+        sqe->addr = ( __u64 )( unsigned long )&no_fd;
+        sqe->len = 1;
+        sqe->off = fd;
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+        sqe->user_data = ( ( __u64 )URING_FILES << 32 ) | ( unsigned )fd;
+    }
+    m_uring_state[fd] = 0;
+    close( fd );
+}
+
+void event_loop::bind_cpu() {
+    if( m_cpu < 0 ) {
+        return;
+    }
+    if( bind_thread( m_cpu ) ) {
+        LOG_INFO( "event loop %d bound to cpu %d (node %d)", m_id, m_cpu, cpu_node( m_cpu ) );
+    } else {
+        LOG_WARN( "event loop %d: bind to cpu %d failed", m_id, m_cpu );
+    }
+}
+
+bool event_loop::loop() {
+
+    bind_cpu();
+    if( m_want_uring && init_uring() ) {
+        return loop_uring();
+    }
+
+    m_events = new epoll_event[ MAX_EVENT_NUMBER ];
+
+    while(true) {
+
+        // 监听队列中还有没accept的连接时不等待；排空时至少每个tick醒来一次检查连接
+        int timeout = m_accept_more ? 0 : m_timers.wait_time( timer_now_ms() );
+        if( m_draining && ( timeout < 0 || timeout > TIMER_TICK_MS ) ) {
+            timeout = TIMER_TICK_MS;
+        }
+        int number = epoll_wait( m_epollfd, m_events, MAX_EVENT_NUMBER, timeout );
+        if ( ( number < 0 ) && ( errno != EINTR ) ) {
+
+            LOG_ERROR( "event loop %d: epoll failure, errno is: %d", m_id, errno );
+            return false;
+        }
+
+        bool accepted = false;
+        for ( int i = 0; i < number; i++ ) {
+
+            int sockfd = m_events[i].data.fd;
+
+            if( sockfd == m_listenfd ) {
+
+                handle_accept();
+                accepted = true;
+
+            } else if( sockfd == m_wakefd ) {
+
+                eventfd_t value;
+                eventfd_read( m_wakefd, &value );
+
+            } else if( m_events[i].events & ( EPOLLRDHUP | EPOLLHUP | EPOLLERR ) ) {
+
+                m_users[sockfd].close_conn();
+
+            } else if(m_events[i].events & EPOLLIN) {
+
+                if( http_conn::m_actor_model == http_conn::REACTOR ) {
+
+                    // Reactor：读取、解析、生成响应和发送都交给工作线程
+                    dispatch( sockfd, http_conn::IO_READ );
+                } else if(m_users[sockfd].read()) {
+
+                    dispatch( sockfd, http_conn::IO_READ );
+                } else {
+
+                    m_users[sockfd].close_conn();
+                }
+
+            }  else if( m_events[i].events & EPOLLOUT ) {
+
+                if( http_conn::m_actor_model == http_conn::REACTOR ) {
+
+                    dispatch( sockfd, http_conn::IO_WRITE );
+                } else if( !m_users[sockfd].write() ) {
+
+                    m_users[sockfd].close_conn();
+                } else if( m_users[sockfd].has_pending_input() ) {
+
+                    // 流水线中后面的请求已经在读缓冲区里了，不会再有读事件，直接交给工作线程解析
+                    dispatch( sockfd, http_conn::IO_READ );
+                }
+
+            }
+        }
+
+        if( m_accept_more && !accepted ) {
+            handle_accept();
+        }
+
+        handle_timers();
+        if( m_drain_deadline.load( std::memory_order_relaxed ) != 0 && !drain_step( timer_now_ms() ) ) {
+            return true;
+        }
+    }
+}
+
+void event_loop::drain( long deadline ) {
+    http_conn::m_draining.store( true, std::memory_order_relaxed );
+    m_drain_deadline.store( deadline, std::memory_order_relaxed );
+    eventfd_write( m_wakefd, 1 );
+}
+
+// 关闭监听socket。epoll方式下直接从epoll中删除；io_uring方式下取消监听socket上的accept（或等待可读的poll），
+// 取消之前完成的连接照常处理，之后不再重新提交
+void event_loop::begin_drain() {
+
+    m_draining = true;
+    m_accept_more = false;
+    if( m_ring ) {
+        io_uring_sqe* sqe = uring_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = ( __u64 )URING_ACCEPT << 32;
+        sqe->user_data = ( __u64 )URING_CANCEL << 32;
+        sqe = uring_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = ( __u64 )URING_LISTEN_POLL << 32;
+        sqe->user_data = ( __u64 )URING_CANCEL << 32;
+        close( m_listenfd );
+    } else {
+        removefd( m_epollfd, m_listenfd );
+    }
+    m_listenfd = -1;
+    LOG_INFO( "event loop %d: stopped accepting, draining %d connections", m_id, get_user_count() );
+}
+
+// 排空时每个tick检查一次本循环的连接（都在时间轮中）；返回false表示连接都已关闭，循环可以退出
+bool event_loop::drain_step( long now ) {
+
+    if( !m_draining ) {
+        begin_drain();
+    }
+    if( now - m_last_sweep >= TIMER_TICK_MS ) {
+        m_last_sweep = now;
+        bool force = now >= m_drain_deadline.load( std::memory_order_relaxed );
+        if( force && get_user_count() > 0 ) {
+            LOG_WARN( "event loop %d: drain deadline passed, closing %d connections", m_id, get_user_count() );
+        }
+        close_idle( force );
+    }
+    return get_user_count() > 0;
+}
+
+// 关闭等待下一个请求的长连接：socket中还有数据时不关闭（close会发送RST，请求丢失），等它处理完，
+// 响应带Connection: close后由连接自己关闭。force为true时关闭所有不在工作线程中的连接
+void event_loop::close_idle( bool force ) {
+
+    std::vector< timer_entry > entries;
+    m_timers.entries( entries );
+    for( size_t i = 0; i < entries.size(); ++i ) {
+
+        http_conn* conn = ( http_conn* )entries[i].data;
+        if( !conn->is_open() || conn->get_timer_gen() != entries[i].gen || conn->is_busy() ) {
+            continue;
+        }
+
+        int fd = conn - m_users;
+        if( !force ) {
+            char c;
+            if( conn->get_timeout_kind() != http_conn::TIMEOUT_KEEPALIVE
+                || recv( fd, &c, 1, MSG_PEEK | MSG_DONTWAIT ) > 0 ) {
+                continue;
+            }
+        }
+        if( m_ring ) {
+            uring_close( fd );
+        } else {
+            conn->close_conn();
+        }
+    }
+}
+
+// io_uring后端：事件循环不再等待就绪事件再自己读写，而是把accept、recv、sendmsg提交给内核，
+// 内核完成后在完成项中给出结果，一次io_uring_enter既提交这一轮所有的操作又等待完成：
+// - 监听socket上一直有一个多次触发的accept（IORING_ACCEPT_MULTISHOT），每个新连接一个完成项
+// - recv使用提供的缓冲区（provided buffers）：内核在数据到达时才选出缓冲区，空闲连接不占用内存；
+//   数据复制到连接的读缓冲区后立即还回
+// - 解析和生成响应直接在事件循环中进行（与epoll方式共用http_conn的状态机），不经过线程池；
+//   多核时用多个事件循环（-n）
+// - 队列中的响应用一个sendmsg发送，发送完后只需等待下一个请求时把recv链接（IOSQE_IO_LINK）在它后面一起提交
+// 文件正文必须在内存中（sendmsg不能代替sendfile），所以这种方式下总是映射文件
+bool event_loop::init_uring() {
+
+    m_ring = new uring;
+    if( !m_ring->init( URING_ENTRIES ) || !m_ring->setup_buffers( 0, URING_BUFFERS, URING_BUFFER_SIZE ) ) {
+
+        // 内核太旧（提供的缓冲区环需要5.19）、没有io_uring或被禁用（seccomp、kernel.io_uring_disabled）
+        LOG_WARN( "event loop %d: io_uring unavailable, errno is: %d, using epoll", m_id, errno );
+        delete m_ring;
+        m_ring = NULL;
+        return false;
+    }
+
+    if( m_fixed_files && !m_ring->register_files( MAX_FD ) ) {
+
+        // 固定文件表的大小不能超过RLIMIT_NOFILE，fd超出表的连接不使用固定文件
+        struct rlimit rl;
+        if( getrlimit( RLIMIT_NOFILE, &rl ) != 0 || rl.rlim_cur >= MAX_FD || !m_ring->register_files( rl.rlim_cur ) ) {
+            LOG_WARN( "event loop %d: cannot register files, errno is: %d", m_id, errno );
+        }
+    }
+    m_fd_slots.resize( m_ring->get_file_count() );
+    for( size_t i = 0; i < m_fd_slots.size(); ++i ) {
+        m_fd_slots[i] = i;
+    }
+    m_uring_state.assign( MAX_FD, 0 );
+
+    LOG_INFO( "event loop %d: using io_uring, %u registered files", m_id, m_ring->get_file_count() );
+    return true;
+}
+
+// 取一个提交项，提交队列满时先把已有的提交给内核
+io_uring_sqe* event_loop::uring_sqe() {
+    io_uring_sqe* sqe;
+    while( ( sqe = m_ring->get_sqe() ) == NULL ) {
+        m_ring->submit( 0, -1 );
+    }
+    return sqe;
+}
+
+void event_loop::uring_accept() {
+    io_uring_sqe* sqe = uring_sqe();
+    sqe->opcode = IORING_OP_ACCEPT;
+    sqe->fd = m_listenfd;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK | SOCK_CLOEXEC;
+    sqe->user_data = ( __u64 )URING_ACCEPT << 32;
+}
+
+void event_loop::uring_connect( int fd ) {
+
+    if( fd >= MAX_FD ) {
+        close( fd );
+        return;
+    }
+
+    // 多次accept不返回对方的地址，只有访问日志需要它
+    struct sockaddr_in client_address;
+    memset( &client_address, 0, sizeof( client_address ) );
+    if( logger::m_access_enabled ) {
+        socklen_t client_addrlength = sizeof( client_address );
+        getpeername( fd, ( struct sockaddr* )&client_address, &client_addrlength );
+    }
+    m_users[fd].init( fd, client_address, this );
+    schedule( m_users + fd, timer_now_ms() );
+    uring_recv( fd );
+}
+
+void event_loop::uring_recv( int fd ) {
+    io_uring_sqe* sqe = uring_sqe();
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = fd;
+    sqe->len = URING_BUFFER_SIZE;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    if( m_uring_state[fd] & URING_FIXED ) {
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    sqe->user_data = ( ( __u64 )URING_RECV << 32 ) | ( unsigned )fd;
+    m_uring_state[fd] |= URING_RECV_PENDING;
+}
+
+void event_loop::uring_send( int fd ) {
+
+    bool then_read = false;
+    struct msghdr* msg = m_users[fd].prepare_send( &then_read );
+    if( msg->msg_iovlen == 0 ) {
+        LOG_ERROR( "event loop %d: io_uring cannot send an unmapped file", m_id );
+        uring_close( fd );
+        return;
+    }
+
+    // 发送完后接着等待下一个请求：recv链接在sendmsg后面，sendmsg完成后内核直接开始recv，不用再提交一次
+    bool link = then_read && !( m_uring_state[fd] & URING_RECV_PENDING );
+    io_uring_sqe* sqe = uring_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = ( __u64 )( unsigned long )msg;
+    sqe->len = 1;
+    if( m_uring_state[fd] & URING_FIXED ) {
+        sqe->flags |= IOSQE_FIXED_FILE;
+    }
+    if( link ) {
+        sqe->flags |= IOSQE_IO_LINK;
+    }
+    sqe->user_data = ( ( __u64 )URING_SEND << 32 ) | ( unsigned )fd;
+    m_uring_state[fd] |= URING_SEND_PENDING;
+    if( link ) {
+        uring_recv( fd );
+    }
+}
+
+// 一个操作完成后决定连接的下一步：有待发送的响应就sendmsg（同时最多一个），
+// 响应都发送完、读缓冲区中还有没解析的请求就解析，否则等待数据
+void event_loop::uring_drive( int fd ) {
+
+    http_conn* conn = m_users + fd;
+    unsigned char state = m_uring_state[fd];
+    if( state & URING_SEND_PENDING ) {
+        return;
+    }
+    if( conn->has_pending_input() && !conn->parse_requests() ) {
+        uring_close( fd );
+        return;
+    }
+    if( conn->has_pending_output() ) {
+        uring_send( fd );
+    } else if( !( state & URING_RECV_PENDING ) ) {
+        uring_recv( fd );
+    }
+}
+
+// 内核中还有这个连接的recv/sendmsg时不能释放连接的缓冲区（sendmsg可能还在读取），
+// 先shutdown()让它们尽快完成，最后一个完成项到达时再关闭
+void event_loop::uring_close( int fd ) {
+    unsigned char& state = m_uring_state[fd];
+    if( state & ( URING_RECV_PENDING | URING_SEND_PENDING ) ) {
+        if( !( state & URING_CLOSING ) ) {
+            state |= URING_CLOSING;
+            shutdown( fd, SHUT_RDWR );
+        }
+        return;
+    }
+    m_users[fd].close_conn();
+}
+
+void event_loop::handle_cqe( unsigned op, int fd, int res, unsigned flags ) {
+
+    if( op == URING_ACCEPT ) {
+        bool exhausted = res == -EMFILE || res == -ENFILE;
+        if( res >= 0 ) {
+            uring_connect( res );
+        } else if( exhausted ) {
+            while( m_listenfd >= 0 && shed_connection() ) {
+            }
+        } else if( res != -ECONNABORTED && res != -EPROTO && res != -EINTR && res != -ECANCELED ) {
+            LOG_ERROR( "event loop %d: accept failed, errno is: %d", m_id, -res );
+        }
+        if( ( flags & IORING_CQE_F_MORE ) || m_listenfd < 0 ) {
+            return;  // 还会继续accept，或者已经在排空（被取消了）
+        }
+        // 出错时多次accept就结束了，要重新提交。io_uring的accept先分配fd再看监听队列，fd用完时马上重新提交
+        // 会立即再失败：先等监听socket可读（poll不占用fd），有新连接时再accept
+        if( exhausted ) {
+            io_uring_sqe* sqe = uring_sqe();
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = m_listenfd;
+            sqe->poll32_events = POLLIN;
+            sqe->user_data = ( __u64 )URING_LISTEN_POLL << 32;
+        } else {
+            uring_accept();
+        }
+        return;
+    }
+    if( op == URING_LISTEN_POLL ) {
+        if( m_listenfd >= 0 ) {
+            uring_accept();
+        }
+        return;
+    }
+    if( op == URING_WAKE ) {
+        eventfd_t value;
+        eventfd_read( m_wakefd, &value );
+        return;
+    }
+    if( op == URING_CANCEL ) {
+        return;
+    }
+
+    if( op == URING_FILES ) {
+        // 只有注册失败时才有完成项，链接在后面的recv被取消，改用普通fd
+        LOG_WARN( "event loop %d: register file %d failed, errno is: %d", m_id, fd, -res );
+        m_uring_state[fd] &= ~URING_FIXED;
+        return;
+    }
+
+    http_conn* conn = m_users + fd;
+    unsigned char& state = m_uring_state[fd];
+    bool ok = res > 0;
+    if( op == URING_RECV ) {
+        state &= ~URING_RECV_PENDING;
+        if( flags & IORING_CQE_F_BUFFER ) {
+            unsigned bid = flags >> IORING_CQE_BUFFER_SHIFT;
+            if( ok && !( state & URING_CLOSING ) ) {
+                ok = conn->feed( m_ring->buffer( bid ), res );  // 超过请求的最大字节数时关闭
+            }
+            m_ring->recycle( bid );
+        }
+    } else {
+        state &= ~URING_SEND_PENDING;
+        if( ok && !( state & URING_CLOSING ) ) {
+            ok = conn->complete_send( res );
+        }
+    }
+
+    if( state & URING_CLOSING ) {
+        uring_close( fd );
+        return;
+    }
+    if( op == URING_RECV && res == -ENOBUFS ) {
+        // 这一轮的数据还没处理完，缓冲区都在用：下一轮再提交
+        timer_entry retry = { conn, conn->get_timer_gen(), 0 };
+        m_recv_retry.push_back( retry );
+        return;
+    }
+    if( !ok && res != -ECANCELED ) {
+        // 对方关闭、出错或者（不保持连接的）响应已发送完；链接的recv因为sendmsg没有全部发送完被取消时照常继续
+        uring_close( fd );
+        return;
+    }
+    uring_drive( fd );
+}
+
+bool event_loop::loop_uring() {
+
+    uring_accept();
+
+    // drain()的唤醒：只需要一次
+    io_uring_sqe* sqe = uring_sqe();
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = m_wakefd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = ( __u64 )URING_WAKE << 32;
+
+    while( true ) {
+
+        // 提交这一轮的操作，等待至少一个完成项或者时间轮的下一个槽到期
+        int timeout = m_timers.wait_time( timer_now_ms() );
+        if( m_draining && ( timeout < 0 || timeout > TIMER_TICK_MS ) ) {
+            timeout = TIMER_TICK_MS;
+        }
+        int ret = m_ring->submit( 1, timeout );
+        if( ret < 0 && ret != -EINTR && ret != -ETIME && ret != -EBUSY ) {
+
+            LOG_ERROR( "event loop %d: io_uring failure, errno is: %d", m_id, -ret );
+            return false;
+        }
+
+        io_uring_cqe* cqe;
+        while( ( cqe = m_ring->peek() ) != NULL ) {
+            __u64 data = cqe->user_data;
+            int res = cqe->res;
+            unsigned flags = cqe->flags;
+            m_ring->seen();
+            handle_cqe( data >> 32, ( int )( data & 0xffffffff ), res, flags );
+        }
+
+        std::vector< timer_entry > retry;
+        retry.swap( m_recv_retry );
+        for( size_t i = 0; i < retry.size(); ++i ) {
+            http_conn* conn = ( http_conn* )retry[i].data;
+            int fd = conn - m_users;
+            if( conn->is_open() && conn->get_timer_gen() == retry[i].gen
+                && !( m_uring_state[fd] & ( URING_RECV_PENDING | URING_CLOSING ) ) ) {
+                uring_drive( fd );
+            }
+        }
+
+        handle_timers();
+        if( m_drain_deadline.load( std::memory_order_relaxed ) != 0 && !drain_step( timer_now_ms() ) ) {
+            return true;
+        }
+    }
+}
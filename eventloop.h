@@ -0,0 +1,138 @@
+#ifndef EVENTLOOP_H
+#define EVENTLOOP_H
+
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <atomic>
+#include "threadpool.h"
+#include "http_conn.h"
+#include "timer_wheel.h"
+#include "uring.h"
+
+#define MAX_FD 65536
+#define MAX_EVENT_NUMBER 10000
+
+// 每次监听socket就绪时最多accept的连接数
+#define ACCEPT_BUDGET 64
+
+// io_uring后端：提交队列的项数；每个循环提供给recv的缓冲区个数（2的幂）和大小
+#define URING_ENTRIES 1024
+#define URING_BUFFERS 512
+#define URING_BUFFER_SIZE 4096
+
+// 时间轮：每个槽100ms，1024个槽
+#define TIMER_SLOTS 1024
+#define TIMER_TICK_MS 100
+
+// 一个事件循环（Reactor）：拥有自己的epoll实例、监听socket和连接计数，
+// 多个事件循环时每个循环跑在一个线程上，各自用SO_REUSEPORT监听同一个端口，由内核把新连接分散到各个循环
+// 所有循环共用以fd为下标的users数组：fd在进程内唯一，每个连接只会被接受它的那个循环访问
+class event_loop {
+public:
+    event_loop( int id, http_conn* users, threadpool< http_conn >* pool );
+    ~event_loop();
+
+    // 创建epoll实例和监听socket，reuseport为true时监听socket设置SO_REUSEPORT，listen_et为true时监听socket边沿触发，
+    // backlog为监听队列长度（内核会截断到net.core.somaxconn）；listenfd不为-1时使用这个已经在监听的socket
+    // （热重启时从旧进程接过来的），不再创建和bind
+    bool init( int port, bool reuseport, bool listen_et, int backlog, int listenfd = -1 );
+    // 用io_uring代替epoll：在loop()开始时（循环自己的线程中）创建，内核不支持时仍然使用epoll；
+    // fixed_files为true时连接socket注册到固定文件表中
+    void use_uring( bool fixed_files ) { m_want_uring = true; m_fixed_files = fixed_files; }
+    // 在init()之前调用：loop()开始时把线程绑定到cpu，之后才分配epoll事件数组、io_uring等循环自己的结构（落在本地NUMA节点）；
+    // incoming_cpu为true时监听socket设置SO_INCOMING_CPU，SO_REUSEPORT组中优先把在这个CPU上收到的连接交给本循环，
+    // 配合网卡接收队列的中断亲和性，一个连接从软中断到accept、epoll都在同一个CPU上
+    void set_cpu( int cpu, bool incoming_cpu ) { m_cpu = cpu; m_incoming_cpu = incoming_cpu; }
+    // 在新线程中运行loop()；等待loop()返回
+    bool start();
+    void join();
+    // 处理事件，drain()之后所有连接都关闭时返回true，出错时返回false
+    bool loop();
+
+    // 停止接受新连接并排空已有连接（可以在任何线程中调用）：循环关闭自己的监听socket（新进程持有同一个socket，
+    // 继续接受连接），之后的响应都带Connection: close，空闲的长连接直接关闭，正在处理的请求照常完成；
+    // 到了deadline（timer_now_ms()）还没关闭的连接也关闭（正在工作线程中的等它处理完）
+    void drain( long deadline );
+
+    int get_id() const { return m_id; }
+    int get_epollfd() const { return m_epollfd; }
+    int get_listenfd() const { return m_listenfd; }
+    int get_user_count() const { return m_user_count.load( std::memory_order_relaxed ); }
+
+    // 由http_conn在建立/关闭连接时调用（关闭可能发生在工作线程中）
+    void add_user() { m_user_count.fetch_add( 1, std::memory_order_relaxed ); }
+    void remove_user() { m_user_count.fetch_sub( 1, std::memory_order_relaxed ); }
+    // 开始检测新连接的事件（epoll）；关闭连接的socket
+    void add_fd( int fd );
+    void remove_fd( int fd );
+
+    // 各种原因超时关闭的连接数（http_conn::TIMEOUT_KIND）
+    unsigned long get_expired( int kind ) const { return m_expired[ kind ].load( std::memory_order_relaxed ); }
+
+    // fd用完时接受后立即关闭的连接数
+    unsigned long get_shed() const { return m_shed.load( std::memory_order_relaxed ); }
+
+private:
+    static void* worker( void* arg );
+    bool create_listener( int port, bool reuseport );
+    void bind_cpu();
+    void begin_drain();
+    bool drain_step( long now );
+    void close_idle( bool force );
+    void handle_accept();
+    bool shed_connection();
+    void dispatch( int sockfd, http_conn::IO_STATE state );
+    void schedule( http_conn* conn, long now );
+    void handle_timers();
+
+    // io_uring后端，见eventloop.cpp中的说明
+    bool init_uring();
+    bool loop_uring();
+    io_uring_sqe* uring_sqe();
+    void uring_accept();
+    void uring_connect( int fd );
+    void uring_recv( int fd );
+    void uring_send( int fd );
+    void uring_drive( int fd );
+    void uring_close( int fd );
+    void handle_cqe( unsigned op, int fd, int res, unsigned flags );
+
+private:
+    int m_id;
+    int m_cpu;              // 绑定的CPU，-1表示不绑定
+    bool m_incoming_cpu;
+    int m_epollfd;
+    int m_listenfd;
+    bool m_listen_et;
+    int m_spare_fd;         // 预留的空闲fd（/dev/null），fd用完时关掉它来接受并关闭等待中的连接
+    bool m_accept_more;     // 上一次accept用完了预算，监听队列中可能还有连接
+    int m_wakefd;           // eventfd，drain()用它唤醒等待中的循环
+    std::atomic< long > m_drain_deadline;   // 0表示没有要求排空
+    bool m_draining;        // 已经停止接受连接，只由循环自己的线程访问
+    long m_last_sweep;      // 排空时上一次检查所有连接的时间
+    std::atomic< unsigned long > m_shed;
+    std::atomic< int > m_user_count;  // 本循环上的连接数
+
+    http_conn* m_users;
+    threadpool< http_conn >* m_pool;
+
+    // 连接的超时检查：每个连接在时间轮中最多有一项，到期时再看连接真正的到期时间
+    timer_wheel m_timers;
+    std::vector< timer_entry > m_timeouts;
+    long m_max_timer_wait;  // 一项在时间轮中最多放多久，保证缩短的到期时间也能按时检查
+    std::atomic< unsigned long > m_expired[ http_conn::TIMEOUT_KIND_NUMBER ];
+
+    epoll_event* m_events;
+    pthread_t m_thread;
+
+    // io_uring后端：m_ring为NULL时使用epoll。每个连接同时最多有一个recv和一个sendmsg在内核中，
+    // 状态记在m_uring_state中（以fd为下标）；m_fd_slots[fd]为fd，作为注册固定文件时IORING_OP_FILES_UPDATE的参数
+    bool m_want_uring;
+    bool m_fixed_files;
+    uring* m_ring;
+    std::vector< unsigned char > m_uring_state;
+    std::vector< int > m_fd_slots;
+    std::vector< timer_entry > m_recv_retry;  // 没有空闲的recv缓冲区（ENOBUFS）、等下一轮重新提交recv的连接
+};
+
+#endif
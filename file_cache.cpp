@@ -0,0 +1,322 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <zlib.h>
+#include "file_cache.h"
+
+// 默认容量：64MB、1024个文件、每秒最多校验一次
+static const size_t DEFAULT_MAX_BYTES = 64 * 1024 * 1024;
+static const int DEFAULT_MAX_ENTRIES = 1024;
+static const int DEFAULT_CHECK_INTERVAL = 1;
+static const int DEFAULT_GZIP_LEVEL = 6;
+
+// 粗粒度单调时钟（走vDSO，不陷入内核）
+static long coarse_now() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC_COARSE, &ts );
+    return ts.tv_sec;
+}
+
+// 文件是否在加载之后被修改过
+static bool file_changed( const struct stat& a, const struct stat& b ) {
+    return a.st_ino != b.st_ino || a.st_dev != b.st_dev || a.st_size != b.st_size
+        || a.st_mtim.tv_sec != b.st_mtim.tv_sec || a.st_mtim.tv_nsec != b.st_mtim.tv_nsec
+        || a.st_mode != b.st_mode;
+}
+
+file_cache::file_cache() : m_map_limit( (size_t)-1 ), m_gzip_level( DEFAULT_GZIP_LEVEL ), m_bytes( 0 ),
+        m_hits( 0 ), m_misses( 0 ), m_evictions( 0 ), m_gzips( 0 ) {
+    init( DEFAULT_MAX_BYTES, DEFAULT_MAX_ENTRIES, DEFAULT_CHECK_INTERVAL );
+}
+
+file_cache::~file_cache() {
+    m_lock.lock();
+    while( !m_lru.empty() ) {
+        evict( m_lru.back() );
+    }
+    m_lock.unlock();
+}
+
+void file_cache::init( size_t max_bytes, int max_entries, int check_interval ) {
+    m_lock.lock();
+    m_max_bytes = max_bytes;
+    m_max_file_size = max_bytes / 4;
+    m_max_entries = max_entries;
+    m_check_interval = check_interval;
+    while( !m_lru.empty() && ( m_bytes > m_max_bytes || (int)m_map.size() > m_max_entries ) ) {
+        evict( m_lru.back() );
+    }
+    m_lock.unlock();
+}
+
+void file_cache::set_map_limit( size_t limit ) {
+    m_lock.lock();
+    m_map_limit = limit;
+    m_lock.unlock();
+}
+
+void file_cache::set_gzip_level( int level ) {
+    m_lock.lock();
+    m_gzip_level = level;
+    m_lock.unlock();
+}
+
+file_entry* file_cache::acquire( const char* path ) {
+    long now = coarse_now();
+
+    m_lock.lock();
+    std::unordered_map< std::string, file_entry* >::iterator it = m_map.find( path );
+    if( it != m_map.end() ) {
+        file_entry* entry = it->second;
+        entry->refs.fetch_add( 1, std::memory_order_relaxed );
+        m_lru.splice( m_lru.begin(), m_lru, entry->lru );  // 移到表头
+        m_lock.unlock();
+
+        // 校验间隔内直接命中，不做任何系统调用
+        if( now - entry->checked.load( std::memory_order_relaxed ) < m_check_interval ) {
+            m_hits.fetch_add( 1, std::memory_order_relaxed );
+            return entry;
+        }
+
+        struct stat st;
+        if( stat( path, &st ) == 0 && !file_changed( st, entry->st ) ) {
+            entry->checked.store( now, std::memory_order_relaxed );
+            m_hits.fetch_add( 1, std::memory_order_relaxed );
+            return entry;
+        }
+
+        // 文件已被修改或删除：从缓存中移除旧条目（仍在使用它的连接不受影响），重新加载
+        m_lock.lock();
+        if( entry->cached ) {
+            evict( entry );
+        }
+        m_lock.unlock();
+        release( entry );
+    } else {
+        m_lock.unlock();
+    }
+
+    m_misses.fetch_add( 1, std::memory_order_relaxed );
+    file_entry* entry = load( path );
+    if( !entry ) {
+        return NULL;
+    }
+    entry->checked.store( now, std::memory_order_relaxed );
+    if( charge( entry ) <= m_max_file_size ) {
+        insert( entry );
+    }
+    return entry;
+}
+
+// 预压缩文件path.gz可用：普通文件、可读，并且不比原文件旧（否则说明原文件修改后没有重新压缩）
+static bool gzip_file_usable( const std::string& path, const struct stat& st ) {
+    std::string gz_path = path + ".gz";
+    struct stat gz_st;
+    return stat( gz_path.c_str(), &gz_st ) == 0 && S_ISREG( gz_st.st_mode ) && ( gz_st.st_mode & S_IROTH )
+        && gz_st.st_mtime >= st.st_mtime;
+}
+
+bool file_cache::get_stat( const char* path, struct stat* st, bool* gzip_file ) {
+    long now = coarse_now();
+
+    m_lock.lock();
+    std::unordered_map< std::string, file_entry* >::iterator it = m_map.find( path );
+    if( it != m_map.end() && now - it->second->checked.load( std::memory_order_relaxed ) < m_check_interval ) {
+        *st = it->second->st;
+        *gzip_file = it->second->gzip_file;
+        m_lock.unlock();
+        m_hits.fetch_add( 1, std::memory_order_relaxed );
+        return true;
+    }
+    m_lock.unlock();
+    m_misses.fetch_add( 1, std::memory_order_relaxed );
+    if( stat( path, st ) < 0 ) {
+        return false;
+    }
+    *gzip_file = S_ISREG( st->st_mode ) && ( st->st_mode & S_IROTH ) && gzip_file_usable( path, *st );
+    return true;
+}
+
+void file_cache::release( file_entry* entry ) {
+    if( entry->refs.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) {
+        destroy( entry );
+    }
+}
+
+size_t file_cache::bytes() {
+    m_lock.lock();
+    size_t ret = m_bytes;
+    m_lock.unlock();
+    return ret;
+}
+
+int file_cache::entries() {
+    m_lock.lock();
+    int ret = m_map.size();
+    m_lock.unlock();
+    return ret;
+}
+
+// 加载文件：stat + open + mmap，返回的条目引用计数为1（属于调用者）
+file_entry* file_cache::load( const char* path ) {
+    struct stat st;
+    if( stat( path, &st ) < 0 ) {
+        return NULL;
+    }
+
+    file_entry* entry = new file_entry;
+    entry->path = path;
+    entry->fd = -1;
+    entry->addr = NULL;
+    entry->st = st;
+    entry->refs.store( 1, std::memory_order_relaxed );
+    entry->cached = false;
+    entry->gzip_file = false;
+    entry->gzip_state.store( GZIP_NONE, std::memory_order_relaxed );
+    entry->gzip_addr = NULL;
+    entry->gzip_size = 0;
+    entry->gzip_charged = false;
+
+    // 目录、不可读的文件只缓存状态信息，由调用者判断如何响应
+    if( !S_ISREG( st.st_mode ) || !( st.st_mode & S_IROTH ) ) {
+        return entry;
+    }
+
+    entry->fd = open( path, O_RDONLY | O_CLOEXEC );
+    if( entry->fd < 0 ) {
+        int saved = errno;
+        delete entry;
+        errno = saved;
+        return NULL;
+    }
+    if( st.st_size > 0 && (size_t)st.st_size < m_map_limit ) {
+        void* addr = mmap( 0, st.st_size, PROT_READ, MAP_PRIVATE, entry->fd, 0 );
+        if( addr == MAP_FAILED ) {
+            int saved = errno;
+            close( entry->fd );
+            delete entry;
+            errno = saved;
+            return NULL;
+        }
+        entry->addr = ( char* )addr;
+    }
+
+    entry->gzip_file = gzip_file_usable( entry->path, st );
+    return entry;
+}
+
+bool file_cache::can_gzip( off_t size ) const {
+    return m_gzip_level > 0 && size > 0 && (size_t)size <= m_max_file_size;
+}
+
+bool file_cache::gzip( file_entry* entry ) {
+    int state = entry->gzip_state.load( std::memory_order_acquire );
+    if( state == GZIP_READY ) {
+        return true;
+    }
+    if( state != GZIP_NONE || entry->fd < 0 || !can_gzip( entry->st.st_size ) ) {
+        return false;
+    }
+    // 只有一个线程压缩，其他线程这次先发送原文件，不等待
+    if( !entry->gzip_state.compare_exchange_strong( state, GZIP_BUSY, std::memory_order_acq_rel ) ) {
+        return false;
+    }
+
+    // 用pread读到临时内存中压缩，不直接读映射：文件在这期间被截断时pread读到的字节不够（不压缩），
+    // 而读映射会SIGBUS
+    size_t len = entry->st.st_size;
+    char* in = ( char* )malloc( len );
+    if( !in || pread( entry->fd, in, len, 0 ) != (ssize_t)len ) {
+        free( in );
+        entry->gzip_state.store( GZIP_FAILED, std::memory_order_release );
+        return false;
+    }
+
+    // windowBits加16：输出带gzip头和尾的格式
+    z_stream zs;
+    memset( &zs, 0, sizeof( zs ) );
+    int ret = deflateInit2( &zs, m_gzip_level, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY );
+    char* out = NULL;
+    size_t size = 0;
+    if( ret == Z_OK ) {
+        size_t bound = deflateBound( &zs, len );
+        out = ( char* )malloc( bound );
+        zs.next_in = ( Bytef* )in;
+        zs.avail_in = len;
+        zs.next_out = ( Bytef* )out;
+        zs.avail_out = bound;
+        ret = out ? deflate( &zs, Z_FINISH ) : Z_MEM_ERROR;
+        size = zs.total_out;
+        deflateEnd( &zs );
+    }
+    free( in );
+
+    if( ret != Z_STREAM_END || size >= len ) {
+        free( out );
+        entry->gzip_state.store( GZIP_FAILED, std::memory_order_release );
+        return false;
+    }
+    char* shrunk = ( char* )realloc( out, size );
+    entry->gzip_addr = shrunk ? shrunk : out;
+    entry->gzip_size = size;
+    m_gzips.fetch_add( 1, std::memory_order_relaxed );
+
+    // 还在缓存中的条目把压缩结果计入容量，超出时从表尾淘汰；不在缓存中的条目释放时一起释放
+    m_lock.lock();
+    if( entry->cached ) {
+        entry->gzip_charged = true;
+        m_bytes += size;
+        while( m_lru.back() != entry && m_bytes > m_max_bytes ) {
+            evict( m_lru.back() );
+        }
+    }
+    m_lock.unlock();
+
+    entry->gzip_state.store( GZIP_READY, std::memory_order_release );
+    return true;
+}
+
+// 把新加载的条目放入缓存，缓存持有一个引用；超出容量时从表尾淘汰
+void file_cache::insert( file_entry* entry ) {
+    m_lock.lock();
+    std::unordered_map< std::string, file_entry* >::iterator it = m_map.find( entry->path );
+    if( it != m_map.end() ) {
+        // 其他线程同时加载了同一个文件，用新的替换旧的
+        evict( it->second );
+    }
+    entry->refs.fetch_add( 1, std::memory_order_relaxed );
+    entry->cached = true;
+    m_lru.push_front( entry );
+    entry->lru = m_lru.begin();
+    m_map[ entry->path ] = entry;
+    m_bytes += charge( entry );
+
+    while( m_lru.back() != entry && ( m_bytes > m_max_bytes || (int)m_map.size() > m_max_entries ) ) {
+        evict( m_lru.back() );
+    }
+    m_lock.unlock();
+}
+
+void file_cache::evict( file_entry* entry ) {
+    m_map.erase( entry->path );
+    m_lru.erase( entry->lru );
+    m_bytes -= charge( entry );
+    entry->cached = false;
+    m_evictions.fetch_add( 1, std::memory_order_relaxed );
+    release( entry );  // 释放缓存持有的引用
+}
+
+void file_cache::destroy( file_entry* entry ) {
+    if( entry->addr ) {
+        munmap( entry->addr, entry->st.st_size );
+    }
+    if( entry->fd >= 0 ) {
+        close( entry->fd );
+    }
+    free( entry->gzip_addr );
+    delete entry;
+}
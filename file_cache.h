@@ -0,0 +1,108 @@
+#ifndef FILECACHE_H
+#define FILECACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <stddef.h>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include <atomic>
+#include "locker.h"
+
+// 缓存中的一个文件：打开的文件描述符 + 只读内存映射，创建后内容不再改变，
+// 由所有http_conn共享，引用计数归零时才真正munmap/close
+struct file_entry {
+    std::string path;
+    int fd;                     // 保持打开的文件描述符（非普通文件或不可读时为-1）
+    char* addr;                 // 内存映射首地址（空文件、未映射的大文件、非普通文件或不可读时为NULL）
+    struct stat st;             // 加载时的文件状态，用于校验文件是否被修改
+    std::atomic<int> refs;      // 引用计数：每个使用者一个，在缓存中时缓存本身也持有一个
+    std::atomic<long> checked;  // 上一次校验（stat）的时间，单位秒
+    bool cached;                // 是否仍在缓存中（被淘汰或失效后为false，需持有缓存锁访问）
+    bool gzip_file;             // 存在不比它旧的预压缩文件path.gz（加载时检查）
+    std::atomic<int> gzip_state;    // 内存中gzip压缩结果的状态（GZIP_STATE），只压缩一次
+    char* gzip_addr;            // 压缩结果，gzip_state为GZIP_READY后才可以读取
+    size_t gzip_size;
+    bool gzip_charged;          // 压缩结果是否计入了缓存的总字节数（需持有缓存锁访问）
+    std::list< file_entry* >::iterator lru;
+};
+
+// 条目的gzip压缩结果：还没压缩、某个线程正在压缩、可用、不压缩（失败或压缩后没有变小）
+enum GZIP_STATE { GZIP_NONE = 0, GZIP_BUSY, GZIP_READY, GZIP_FAILED };
+
+// 进程内共享的文件缓存：以文件的完整路径为键，LRU淘汰，限制总字节数和条目数，
+// 每隔check_interval秒才用stat校验一次mtime/size，热点文件命中时不需要任何文件系统调用。
+// 校验间隔内（以及交出映射之后到发送完之间）文件被原地截断时：映射只由内核读取（writev/sendmsg），
+// 越过文件末尾时返回EFAULT，这个响应被截断、连接关闭；服务器自己不读映射（gzip压缩用pread），所以不会SIGBUS
+class file_cache {
+public:
+    static file_cache* get_instance() {
+        static file_cache instance;
+        return &instance;
+    }
+
+    // 设置缓存容量：总字节数、最大条目数（每个条目占用一个fd）、校验间隔（秒）
+    void init( size_t max_bytes, int max_entries, int check_interval );
+
+    // 只有小于limit字节的文件才做内存映射，其余文件只保持打开的fd，由sendfile发送
+    void set_map_limit( size_t limit );
+
+    // 获取文件，成功返回的条目引用计数已+1，用完后必须调用release()；失败返回NULL并设置errno
+    file_entry* acquire( const char* path );
+    void release( file_entry* entry );
+
+    // 只获取文件状态（条件请求用）：缓存中有且在校验间隔内时返回缓存的状态和gzip_file（计为命中），
+    // 否则只stat文件和path.gz（计为未命中），不打开、不映射、不放入缓存
+    bool get_stat( const char* path, struct stat* st, bool* gzip_file );
+
+    // 运行时gzip压缩的级别（1-9），0表示只使用预压缩文件
+    void set_gzip_level( int level );
+
+    // 只按大小和压缩级别判断size字节的文件能不能在运行时压缩（不看压缩结果，结果可能因为没有变小而不用）
+    bool can_gzip( off_t size ) const;
+
+    // 获取条目的gzip压缩结果：第一次调用时压缩整个文件，结果保存在条目上，和文件一起计入缓存容量、
+    // 一起被淘汰；其他线程正在压缩、文件太大（不会进入缓存）或压缩后没有变小时返回false，调用者发送原文件
+    bool gzip( file_entry* entry );
+
+    unsigned long hits() const { return m_hits.load( std::memory_order_relaxed ); }
+    unsigned long misses() const { return m_misses.load( std::memory_order_relaxed ); }
+    unsigned long evictions() const { return m_evictions.load( std::memory_order_relaxed ); }
+    unsigned long gzips() const { return m_gzips.load( std::memory_order_relaxed ); }
+    size_t bytes();
+    int entries();
+
+private:
+    file_cache();
+    ~file_cache();
+
+    file_entry* load( const char* path );
+    void insert( file_entry* entry );
+    void evict( file_entry* entry );    // 调用前需持有m_lock
+    void destroy( file_entry* entry );
+    static size_t charge( const file_entry* entry ) {
+        return ( entry->addr ? entry->st.st_size : 0 ) + ( entry->gzip_charged ? entry->gzip_size : 0 );
+    }
+
+private:
+    size_t m_max_bytes;
+    size_t m_max_file_size;     // 超过这个大小的映射文件不进入缓存，用完即释放
+    size_t m_map_limit;
+    int m_gzip_level;
+    int m_max_entries;
+    int m_check_interval;
+
+    std::unordered_map< std::string, file_entry* > m_map;
+    std::list< file_entry* > m_lru;  // 表头为最近使用
+    size_t m_bytes;             // 缓存中所有内存映射和gzip压缩结果的总字节数
+
+    locker m_lock;
+
+    std::atomic< unsigned long > m_hits;
+    std::atomic< unsigned long > m_misses;
+    std::atomic< unsigned long > m_evictions;
+    std::atomic< unsigned long > m_gzips;
+};
+
+#endif
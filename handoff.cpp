@@ -0,0 +1,242 @@
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include "handoff.h"
+#include "eventloop.h"
+#include "timer_wheel.h"
+#include "log.h"
+
+// 旧进程传出监听socket后等待新进程回复的时间
+static const int HANDOFF_READY_TIMEOUT_MS = 30000;
+
+// 新进程的回复：事件循环都已经在接受连接
+static const char HANDOFF_READY = 'R';
+
+handoff::handoff() : m_peer( -1 ), m_listenfd( -1 ), m_loops( NULL ), m_loop_number( 0 ), m_drain_ms( 0 ) {
+}
+
+static bool make_address( const char* path, struct sockaddr_un* addr ) {
+    memset( addr, 0, sizeof( *addr ) );
+    addr->sun_family = AF_UNIX;
+    if( strlen( path ) >= sizeof( addr->sun_path ) ) {
+        errno = ENAMETOOLONG;
+        return false;
+    }
+    strcpy( addr->sun_path, path );
+    return true;
+}
+
+static void close_fds( int* fds, int n ) {
+    for( int i = 0; i < n; ++i ) {
+        close( fds[i] );
+    }
+}
+
+int handoff::take_over( const char* path, int port, int loop_number, int fds[ HANDOFF_MAX_FDS ] ) {
+
+    struct sockaddr_un addr;
+    if( !make_address( path, &addr ) ) {
+        return -1;
+    }
+    int conn = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+    if( conn < 0 ) {
+        return -1;
+    }
+    if( connect( conn, ( struct sockaddr* )&addr, sizeof( addr ) ) < 0 ) {
+        int err = errno;
+        close( conn );
+        if( err == ENOENT || err == ECONNREFUSED ) {
+            return 0;  // 没有旧进程，或者它已经退出（留下了socket文件）
+        }
+        errno = err;
+        return -1;
+    }
+
+    // 正文是fd的个数，fd在控制消息中
+    int count = 0;
+    char control[ CMSG_SPACE( sizeof( int ) * HANDOFF_MAX_FDS ) ];
+    struct iovec iov = { &count, sizeof( count ) };
+    struct msghdr msg;
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof( control );
+    ssize_t len = recvmsg( conn, &msg, MSG_CMSG_CLOEXEC );
+
+    int received = 0;
+    for( struct cmsghdr* c = CMSG_FIRSTHDR( &msg ); len > 0 && c; c = CMSG_NXTHDR( &msg, c ) ) {
+        if( c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS ) {
+            int n = ( c->cmsg_len - CMSG_LEN( 0 ) ) / sizeof( int );
+            memcpy( fds + received, CMSG_DATA( c ), n * sizeof( int ) );
+            received += n;
+        }
+    }
+    if( len != sizeof( count ) || ( msg.msg_flags & MSG_CTRUNC ) || received != count || count <= 0 ) {
+        close_fds( fds, received );
+        close( conn );
+        errno = EPROTO;
+        return -1;
+    }
+
+    // 端口不同时不能接管（旧进程照常服务）
+    for( int i = 0; i < count; ++i ) {
+        struct sockaddr_in address;
+        socklen_t address_len = sizeof( address );
+        if( getsockname( fds[i], ( struct sockaddr* )&address, &address_len ) < 0
+            || address.sin_family != AF_INET || ntohs( address.sin_port ) != port ) {
+            LOG_ERROR( "the running server does not listen on port %d", port );
+            close_fds( fds, count );
+            close( conn );
+            errno = EINVAL;
+            return -1;
+        }
+    }
+
+    // 本进程的事件循环比传过来的socket多时要新建监听socket，只有旧的socket设置了SO_REUSEPORT才能绑定同一端口
+    int reuseport = 0;
+    socklen_t reuseport_len = sizeof( reuseport );
+    if( loop_number > count && ( getsockopt( fds[0], SOL_SOCKET, SO_REUSEPORT, &reuseport, &reuseport_len ) < 0
+                                 || !reuseport ) ) {
+        LOG_ERROR( "the running server listens without SO_REUSEPORT, start with -n %d", count );
+        close_fds( fds, count );
+        close( conn );
+        errno = EINVAL;
+        return -1;
+    }
+
+    m_peer = conn;
+    return count;
+}
+
+bool handoff::serve( const char* path, event_loop** loops, int loop_number, int drain_ms ) {
+
+    m_loops = loops;
+    m_loop_number = loop_number;
+    m_drain_ms = drain_ms;
+    if( loop_number > HANDOFF_MAX_FDS ) {
+        errno = EINVAL;
+        return false;
+    }
+
+    struct sockaddr_un addr;
+    if( !make_address( path, &addr ) ) {
+        return false;
+    }
+    m_listenfd = socket( AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0 );
+    if( m_listenfd < 0 ) {
+        return false;
+    }
+
+    // 删除旧进程的socket文件后，它已有的连接（就是和本进程的）不受影响，但不会再有新进程连接它；
+    // 只有所属用户能连接（连接上的进程能拿走监听socket并让服务器退出），accept后还会检查对方的uid
+    unlink( path );
+    if( bind( m_listenfd, ( struct sockaddr* )&addr, sizeof( addr ) ) < 0 || chmod( path, 0600 ) < 0
+        || listen( m_listenfd, 1 ) < 0 ) {
+        return false;
+    }
+    if( pthread_create( &m_thread, NULL, worker, this ) != 0 ) {
+        return false;
+    }
+    pthread_detach( m_thread );
+
+    if( m_peer >= 0 ) {
+        // 本进程的事件循环都已经在接受连接了，旧进程可以停止
+        if( write( m_peer, &HANDOFF_READY, 1 ) != 1 ) {
+            LOG_WARN( "notify the old server failed, errno is: %d", errno );
+        }
+        close( m_peer );
+        m_peer = -1;
+        LOG_INFO( "took over from the old server" );
+    }
+    return true;
+}
+
+void* handoff::worker( void* arg ) {
+    handoff* h = ( handoff* )arg;
+    h->run();
+    return h;
+}
+
+// 等待新进程；交接成功后让所有事件循环开始排空，线程结束
+void handoff::run() {
+
+    while( true ) {
+
+        int conn = accept4( m_listenfd, NULL, NULL, SOCK_CLOEXEC );
+        if( conn < 0 ) {
+            if( errno == EINTR || errno == ECONNABORTED ) {
+                continue;
+            }
+            LOG_ERROR( "handoff: accept failed, errno is: %d", errno );
+            return;
+        }
+
+        struct ucred cred;
+        socklen_t cred_len = sizeof( cred );
+        if( getsockopt( conn, SOL_SOCKET, SO_PEERCRED, &cred, &cred_len ) < 0
+            || ( cred.uid != geteuid() && cred.uid != 0 ) ) {
+            LOG_WARN( "handoff: refused a process of another user" );
+            close( conn );
+            continue;
+        }
+
+        LOG_INFO( "handoff: passing listening sockets to process %d", cred.pid );
+        bool ready = send_fds( conn ) && wait_ready( conn );
+        close( conn );
+        if( ready ) {
+            break;
+        }
+        LOG_WARN( "handoff: process %d did not take over, still serving", cred.pid );
+    }
+
+    close( m_listenfd );
+    m_listenfd = -1;
+    LOG_INFO( "handoff: the new server is accepting, draining connections for up to %d ms", m_drain_ms );
+    long deadline = timer_now_ms() + m_drain_ms;
+    for( int i = 0; i < m_loop_number; ++i ) {
+        m_loops[i]->drain( deadline );
+    }
+}
+
+bool handoff::send_fds( int conn ) {
+
+    int fds[ HANDOFF_MAX_FDS ];
+    int count = 0;
+    for( int i = 0; i < m_loop_number; ++i ) {
+        int fd = m_loops[i]->get_listenfd();
+        if( fd >= 0 ) {
+            fds[ count++ ] = fd;
+        }
+    }
+
+    char control[ CMSG_SPACE( sizeof( int ) * HANDOFF_MAX_FDS ) ];
+    memset( control, 0, sizeof( control ) );
+    struct iovec iov = { &count, sizeof( count ) };
+    struct msghdr msg;
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = CMSG_SPACE( sizeof( int ) * count );
+    struct cmsghdr* c = CMSG_FIRSTHDR( &msg );
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN( sizeof( int ) * count );
+    memcpy( CMSG_DATA( c ), fds, sizeof( int ) * count );
+    return sendmsg( conn, &msg, MSG_NOSIGNAL ) == sizeof( count );
+}
+
+// 新进程启动失败时连接被关闭（读到0），卡住时等到超时
+bool handoff::wait_ready( int conn ) {
+    struct pollfd pfd = { conn, POLLIN, 0 };
+    char reply = 0;
+    return poll( &pfd, 1, HANDOFF_READY_TIMEOUT_MS ) == 1 && read( conn, &reply, 1 ) == 1 && reply == HANDOFF_READY;
+}
@@ -0,0 +1,49 @@
+#ifndef HANDOFF_H
+#define HANDOFF_H
+
+#include <pthread.h>
+
+class event_loop;
+
+// 一次最多传递的fd个数（内核的SCM_MAX_FD）
+#define HANDOFF_MAX_FDS 253
+
+// 热重启：运行中的服务器在一个Unix socket上等待新进程。新进程启动时连接这个socket，旧进程用SCM_RIGHTS
+// 把所有监听socket传过去，新进程直接在这些socket上accept（不用重新bind，监听队列中的连接也不会丢）；
+// 新进程的事件循环启动后回复一个字节，旧进程收到后才停止accept并排空已有连接，然后退出。
+// 新进程在回复之前失败（连接断开或超时）时旧进程照常服务，等待下一次重启
+class handoff {
+public:
+    static handoff* get_instance() {
+        static handoff instance;
+        return &instance;
+    }
+
+    // 新进程：从path上的旧进程取得监听socket放入fds，返回个数；没有旧进程在运行时返回0，
+    // 出错、旧进程监听的不是port、或者本进程要loop_number个监听socket而旧的没有设置SO_REUSEPORT时返回-1
+    // （关闭连接，旧进程照常服务）
+    int take_over( const char* path, int port, int loop_number, int fds[ HANDOFF_MAX_FDS ] );
+
+    // 在path上等待下一次重启（先删除旧进程的socket文件），然后通知旧进程（如果有）开始排空。
+    // 交接后loops都排空，drain_ms毫秒后还没关闭的连接也关闭
+    bool serve( const char* path, event_loop** loops, int loop_number, int drain_ms );
+
+private:
+    handoff();
+    ~handoff() {}
+
+    static void* worker( void* arg );
+    void run();
+    bool send_fds( int conn );
+    bool wait_ready( int conn );
+
+private:
+    int m_peer;             // 新进程：与旧进程的连接，回复后关闭
+    int m_listenfd;         // 等待新进程的Unix socket
+    event_loop** m_loops;
+    int m_loop_number;
+    int m_drain_ms;
+    pthread_t m_thread;
+};
+
+#endif
@@ -1,30 +1,27 @@
 #include "http_conn.h"
+#include "eventloop.h"
+#include "timer_wheel.h"
+#include "log.h"
+#include "metrics.h"
+#include "scanner.h"
+#include <string>
+#include <time.h>
+#include <random>
+#include <type_traits>
 
-// 定义HTTP响应的一些状态信息（状态码）
-const char* ok_200_title = "OK";
-const char* error_400_title = "Bad Request";
+// 定义HTTP响应的一些状态信息（错误响应的正文，状态行见status_line()）
 const char* error_400_form = "Your request has bad syntax or is inherently impossible to satisfy.\n";
-const char* error_403_title = "Forbidden";
 const char* error_403_form = "You do not have permission to get file from this server.\n";
-const char* error_404_title = "Not Found";
 const char* error_404_form = "The requested file was not found on this server.\n";
-const char* error_500_title = "Internal Error";
+const char* error_416_form = "The requested range is not satisfiable.\n";
 const char* error_500_form = "There was an unusual problem serving the requested file.\n";
 
 // 网站的根目录（在这里是我们服务器资源的路径）
 const char* doc_root = "/home/cmy/Linux/webserver/resources";
 
-// 设置文件描述符非阻塞
-// 对于读而言:阻塞和非阻塞的区别在于没有数据到达的时候是否立刻返回．
-int setnonblocking( int fd ) {
-    int old_option = fcntl( fd, F_GETFL );
-    int new_option = old_option | O_NONBLOCK;
-    fcntl( fd, F_SETFL, new_option );
-    return old_option;
-}
-
-// 往epoll实例中添加需要监听/检测的文件描述符（epoll实例，要添加的文件描述符，是否要检测EPOLLONESHOT事件）
-void addfd( int epollfd, int fd, bool one_shot ) {
+// 往epoll实例中添加需要监听/检测的文件描述符（epoll实例，要添加的文件描述符，是否要检测EPOLLONESHOT事件，是否边沿触发）
+// fd在创建时就已经是非阻塞的（socket()/accept4()的SOCK_NONBLOCK），这里不再fcntl
+void addfd( int epollfd, int fd, bool one_shot, bool et ) {
     // 要检测的文件描述符事件
     epoll_event event;
     event.data.fd = fd;
@@ -34,7 +31,11 @@ void addfd( int epollfd, int fd, bool one_shot ) {
     // (上层尝试在对端已经 close() 的连接上读取请求，只能读到 EOF，会认为发生异常，报告一个错误
     // 之前我们是这样判断断开连接的:int len = read(...)中len==0)
     // 好的服务器既可以支持水平触发也可以支持边沿触发模式
-    // 这里为了简单直接用水平触发，后续可以通过再配置一个bool型函数参数，如：默认为false，水平触发，如果True，水平触发
+    // et为true时边沿触发：有新数据到达才通知一次，调用者必须一直读/写/accept到EAGAIN
+    if(et)
+    {
+        event.events |= EPOLLET;
+    }
     if(one_shot)
     {
         // 防止同一个通信被不同的线程处理
@@ -42,8 +43,6 @@ void addfd( int epollfd, int fd, bool one_shot ) {
     }
     // 将要监听的文件描述符及其相关检测信息添加到epoll实例中
     epoll_ctl(epollfd, EPOLL_CTL_ADD, fd, &event);
-    // 设置文件描述符非阻塞
-    setnonblocking(fd);
 }
 
 // 从epoll中移除监听的文件描述符并关闭连接：删除不再需要检测（对方断开连接）的文件描述符信息并在服务器端关闭对该客户的连接
@@ -53,74 +52,152 @@ void removefd( int epollfd, int fd ) {
 }
 
 // 修改epoll实例中的文件描述符检测信息，重置socket上的EPOLLONESHOT事件，以确保下一次可读时，EPOLLIN事件能被触发
-void modfd(int epollfd, int fd, int ev) {
+// 触发模式必须和addfd()注册时一致
+void modfd(int epollfd, int fd, int ev, bool et) {
     epoll_event event;
     event.data.fd = fd;
-    event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
+    event.events = ev | EPOLLONESHOT | EPOLLRDHUP;
+    if(et) {
+        event.events |= EPOLLET;
+    }
     epoll_ctl( epollfd, EPOLL_CTL_MOD, fd, &event );
 }
 
-// 所有的客户数
-int http_conn::m_user_count = 0;
-// 所有socket上的事件都被注册到同一个epoll内核事件中，所以设置成静态的
-int http_conn::m_epollfd = -1;
-
+// 并发模式，所有连接相同，启动时由配置决定
+int http_conn::m_actor_model = http_conn::PROACTOR;
+// 连接socket的触发模式
+int http_conn::m_conn_trig_mode = http_conn::ET;
+// 读请求、无活动、长连接空闲的超时时长（毫秒）
+int http_conn::m_timeout[ TIMEOUT_KIND_NUMBER ] = { 10000, 30000, 15000 };
+// 一个请求的最大字节数
+int http_conn::m_max_request_size = 64 * 1024;
+// 监控指标的URL
+const char* http_conn::m_status_url = "/status";
+std::atomic< bool > http_conn::m_draining( false );
 
 // 关闭连接
 void http_conn::close_conn() {
     if(m_sockfd != -1) {
-        removefd(m_epollfd, m_sockfd);  // 关闭连接
-        m_sockfd = -1;  // 这个http_conn对象就没有用了
-        m_user_count--; // 关闭一个连接，将客户总数量-1
+        unmap();  // 响应可能还没发送完，释放文件引用
+        for ( ; m_response_head < m_response_count; ++m_response_head ) {
+            release_response( m_io->responses[ m_response_head ] );
+        }
+        m_response_head = m_response_count = 0;
+        detach_io();
+        m_read_buf.release();  // 关闭的连接不占用读缓冲区
+        int sockfd = m_sockfd;
+        m_sockfd = -1;  // 这个http_conn对象就没有用了（先置-1再关闭，关闭后fd可能马上被新连接复用）
+        m_loop->remove_fd( sockfd );  // 关闭连接
+        m_loop->remove_user(); // 关闭一个连接，将所属事件循环的客户数量-1
     }
 }
 
 // 初始化新接受的连接,外部调用初始化套接字地址
-void http_conn::init(int sockfd, const sockaddr_in& addr){
+// 连接之后的所有事件都注册在接受它的事件循环的epoll实例上
+void http_conn::init(int sockfd, const sockaddr_in& addr, event_loop* loop){
     m_sockfd = sockfd;
     m_address = addr;
+    m_loop = loop;
+    m_epollfd = loop->get_epollfd();
 
-    // 端口复用:？？？？？为什么通信套接字也要设置端口复用
-    int reuse = 1;
-    setsockopt( m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
     // 添加到epoll实例中
-    addfd( m_epollfd, sockfd, true );
-    m_user_count++;  // 总客户数+1（当前服务器要招待的客户总数）
+    m_timer_gen.fetch_add( 1, std::memory_order_release );
+    set_timeout( TIMEOUT_HEADER );  // 必须在规定时间内收到完整的请求
+    m_loop->add_fd( sockfd );
+    m_loop->add_user();  // 客户数+1（当前事件循环要招待的客户数）
+    metrics::get_instance()->add_accepted();
     init();
 }
 
 void http_conn::init()
+{
+    m_start_line = 0;
+    m_checked_idx = 0;
+    m_read_buf.clear();
+    m_write_idx = 0;
+    m_response_head = 0;
+    m_response_count = 0;
+    init_request();
+}
+
+// 借用处理请求、发送响应用的io_block，已经有了直接返回；内存不足时返回false
+bool http_conn::attach_io() {
+    static_assert( std::is_trivially_default_constructible< io_block >::value, "io_block comes from buffer_pool without construction" );
+    if ( !m_io ) {
+        m_io = ( io_block* )buffer_pool::get_instance()->get( sizeof( io_block ) );
+    }
+    if ( tracer::m_enabled && !m_traces ) {
+        // 借不到时这次不记录阶段时间
+        m_traces = ( request_trace* )buffer_pool::get_instance()->get( sizeof( request_trace ) * MAX_PIPELINE );
+    }
+    return m_io != NULL;
+}
+
+void http_conn::detach_io() {
+    if ( m_io ) {
+        buffer_pool::get_instance()->put( m_io, sizeof( io_block ) );
+        m_io = NULL;
+    }
+    if ( m_traces ) {
+        buffer_pool::get_instance()->put( m_traces, sizeof( request_trace ) * MAX_PIPELINE );
+        m_traces = NULL;
+    }
+}
+
+// 开始解析下一个请求：只重置解析状态，读缓冲区中已经收到的后续请求（流水线）保留
+void http_conn::init_request()
 {
     m_check_state = CHECK_STATE_REQUESTLINE;    // 初始状态为检查请求行
-    m_linger = false;       // 默认不保持链接  Connection : keep-alive保持连接
+    m_linger = false;       // HTTP/1.1默认保持连接，HTTP/1.0需要Connection: keep-alive
 
     m_method = GET;         // 默认请求方式为GET
-    m_url = 0;
-    m_version = 0;
+    m_url = -1;
+    m_version = -1;
     m_content_length = 0;
-    m_host = 0;
-    m_start_line = 0;
-    m_checked_idx = 0;
-    m_read_idx = 0;
-    m_write_idx = 0;
-    bzero(m_read_buf, READ_BUFFER_SIZE);  // 清空读缓冲区
-    bzero(m_write_buf, READ_BUFFER_SIZE);  // 清空读缓冲区
-    bzero(m_real_file, FILENAME_LEN);  //
+    m_range_count = 0;
+    m_header_count = 0;
+    memset( m_known_headers, -1, sizeof( m_known_headers ) );
+    m_status = 0;
+    m_request_start = m_start_line;
+    m_start_time = timer_now_ns();
 }
 
-// 循环读取客户数据，直到无数据可读或者对方关闭连接
+// 读取客户数据：LT模式下每次就绪只recv一次，剩下的数据内核会继续通知；
+// ET模式下循环读取，直到无数据可读（EAGAIN）或者对方关闭连接
 bool http_conn::read() {
     // Q:那读缓冲区什么时候清空，为什么每次读不从头开始读，一次读中如果请求报文只读了一半怎么办
-    // A:当发送完响应数据后write()函数中会调用init()函数重新初始化
-    if( m_read_idx >= READ_BUFFER_SIZE ) {
-        // 当前读索引已经大于数组长度：缓冲区已满（等待下一次再读吧）
+    // A:队列中的响应都发送完后，write()丢弃已经处理完的请求，没处理完的数据移到缓冲区开头
+    if( !m_read_buf.grow( m_max_request_size ) ) {
+        // 缓冲区已经达到上限，一个请求还没有接收完整：请求过大
         return false;
     }
     int bytes_read = 0;
+    if( m_read_buf.size() == 0 ) {
+        m_start_time = timer_now_ns();  // 一个新请求的第一批数据
+    }
+
+    if( m_conn_trig_mode == LT ) {
+        bytes_read = recv( m_sockfd, m_read_buf.write_ptr(), m_read_buf.writable(), 0 );
+        if (bytes_read <= 0) {
+            // 出错或者对方关闭连接（LT模式下是可读事件触发的，不会是EAGAIN）
+            return bytes_read < 0 && ( errno == EAGAIN || errno == EWOULDBLOCK );
+        }
+        m_read_buf.commit( bytes_read );
+        metrics::get_instance()->add_received( bytes_read );
+        if( m_timeout_kind.load( std::memory_order_relaxed ) == TIMEOUT_KEEPALIVE ) {
+            set_timeout( TIMEOUT_HEADER );  // 长连接上开始了一个新请求
+        }
+        return true;
+    }
+
     while(true) {
-        // 从m_read_buf + m_read_idx索引出开始保存数据，大小是READ_BUFFER_SIZE - m_read_idx
-        bytes_read = recv(m_sockfd, m_read_buf + m_read_idx,
-                          READ_BUFFER_SIZE - m_read_idx, 0 );  // bytes_read为这次读到的字节数
+        if( !m_read_buf.grow( m_max_request_size ) ) {
+            // ET模式下缓冲区达到上限还没读到EAGAIN：先解析已经收到的请求，之后modfd重新注册时
+            // 内核会重新检查socket，剩下的数据还会通知；缓冲区被一个请求占满时下一次read()失败
+            break;
+        }
+        // 从缓冲区中已有数据的末尾开始保存，最多填满当前容量，满了再扩容
+        bytes_read = recv( m_sockfd, m_read_buf.write_ptr(), m_read_buf.writable(), 0 );  // bytes_read为这次读到的字节数
 
         if (bytes_read == -1) {
             if( errno == EAGAIN || errno == EWOULDBLOCK ) {
@@ -131,52 +208,105 @@ bool http_conn::read() {
         } else if (bytes_read == 0) {   // 对方关闭连接
             return false;
         }
-        m_read_idx += bytes_read;
+        m_read_buf.commit( bytes_read );
+        metrics::get_instance()->add_received( bytes_read );
+    }
+    if( m_timeout_kind.load( std::memory_order_relaxed ) == TIMEOUT_KEEPALIVE ) {
+        set_timeout( TIMEOUT_HEADER );  // 长连接上开始了一个新请求
     }
     return true;
 }
 
+// io_uring：recv已经由内核完成，数据在提供给它的缓冲区中，复制到读缓冲区
+bool http_conn::feed( const char* data, size_t len ) {
+    if( m_read_buf.size() == 0 ) {
+        m_start_time = timer_now_ns();
+    }
+    metrics::get_instance()->add_received( len );
+    while( len > 0 ) {
+        if( !m_read_buf.grow( m_max_request_size ) ) {
+            return false;
+        }
+        size_t n = len < m_read_buf.writable() ? len : m_read_buf.writable();
+        memcpy( m_read_buf.write_ptr(), data, n );
+        m_read_buf.commit( n );
+        data += n;
+        len -= n;
+    }
+    if( m_timeout_kind.load( std::memory_order_relaxed ) == TIMEOUT_KEEPALIVE ) {
+        set_timeout( TIMEOUT_HEADER );  // 长连接上开始了一个新请求
+    }
+    return true;
+}
+
+// 设置连接的超时种类和到期时间；续期只是写两个原子变量，由事件循环的时间轮在到期时检查
+void http_conn::set_timeout( TIMEOUT_KIND kind ) {
+    m_timeout_kind.store( kind, std::memory_order_relaxed );
+    m_deadline.store( timer_now_ms() + m_timeout[ kind ], std::memory_order_relaxed );
+}
+
 // 通过\r\n解析出一行，判断依据即为\r\n，同时将'\r''\n'改变为字符串结束符'\0''\0'
 http_conn::LINE_STATUS http_conn::parse_line() {
-    char temp;
-    // 从当前字符位置开始找\r\n，找到了就返回，而不是直到末尾
-    for ( ; m_checked_idx < m_read_idx; ++m_checked_idx ) {
-        temp = m_read_buf[ m_checked_idx ];  // 当前字符
-        if ( temp == '\r' ) {
-            // 判断后面是不是'\n'
-            if ( ( m_checked_idx + 1 ) == m_read_idx ) {
-                return LINE_OPEN;  // 行数据不完整，读到的数据末尾了都没有\n
-            } else if ( m_read_buf[ m_checked_idx + 1 ] == '\n' ) {
-                m_read_buf[ m_checked_idx++ ] = '\0';  // 将'\r' 换成字符串结束符
-                m_read_buf[ m_checked_idx++ ] = '\0';  // 将'\n' 换成字符串结束符
-                return LINE_OK;  // 得到完整的一行
-            }
-            return LINE_BAD;
-        } else if( temp == '\n' )  {
-            // 判断前面是不是'\r'
-            if( ( m_checked_idx > 1) && ( m_read_buf[ m_checked_idx - 1 ] == '\r' ) ) {
-                m_read_buf[ m_checked_idx-1 ] = '\0';
-                m_read_buf[ m_checked_idx++ ] = '\0';
-                return LINE_OK;  // 得到完整的一行
-            }
-            return LINE_BAD;
+    char* buf = m_read_buf.data();
+    int read_idx = m_read_buf.size();
+    if ( m_checked_idx == m_start_line ) {
+        // 开始新的一行
+        m_line.colon = -1;
+        m_line.spaces = 0;
+    }
+    if ( m_checked_idx >= read_idx ) {
+        return LINE_OPEN;
+    }
+
+    // 从当前字符位置开始，一次扫描（SIMD）找到\r或\n，同时记下这一段中冒号和空白的位置（相对行首）；
+    // 行数据不完整时下次从m_checked_idx继续，已经记下的位置保留
+    line_scan scan;
+    scan_line( buf + m_checked_idx, read_idx - m_checked_idx, &scan );
+    int base = m_checked_idx - m_start_line;
+    if ( m_line.colon < 0 && scan.colon >= 0 ) {
+        m_line.colon = base + scan.colon;
+    }
+    for ( int i = 0; i < scan.spaces && m_line.spaces < 2; ++i ) {
+        m_line.space[ m_line.spaces++ ] = base + scan.space[i];
+    }
+    if ( scan.eol < 0 ) {
+        m_checked_idx = read_idx;
+        return LINE_OPEN;
+    }
+    m_checked_idx += scan.eol;
+
+    if ( buf[ m_checked_idx ] == '\r' ) {
+        // 判断后面是不是'\n'
+        if ( ( m_checked_idx + 1 ) == read_idx ) {
+            return LINE_OPEN;  // 行数据不完整，读到的数据末尾了都没有\n
+        } else if ( buf[ m_checked_idx + 1 ] == '\n' ) {
+            buf[ m_checked_idx++ ] = '\0';  // 将'\r' 换成字符串结束符
+            buf[ m_checked_idx++ ] = '\0';  // 将'\n' 换成字符串结束符
+            return LINE_OK;  // 得到完整的一行
         }
+        return LINE_BAD;
+    }
+    // '\n'：判断前面是不是'\r'
+    if( ( m_checked_idx > 1) && ( buf[ m_checked_idx - 1 ] == '\r' ) ) {
+        buf[ m_checked_idx-1 ] = '\0';
+        buf[ m_checked_idx++ ] = '\0';
+        return LINE_OK;  // 得到完整的一行
     }
-    return LINE_OPEN;
+    return LINE_BAD;
 }
 
 // 解析HTTP请求行，获得请求方法，目标URL,以及HTTP版本号
 http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
     // GET /index.html HTTP/1.1
-    // 利用正则表达式的话更简单，但这里用传统方式
-    m_url = strpbrk(text, " \t"); // 判断第二个参数中的字符哪个在text中最先出现
-    // m_url指向GET后面的空格
-    if (! m_url) {
+    // 两个空白的位置在parse_line()扫描行尾时已经找到了，不需要再扫描
+    if ( m_line.spaces < 2 ) {
         return BAD_REQUEST;
     }
+    char* url = text + m_line.space[0];
+    // url指向GET后面的空格
 
     // GET\0/index.html HTTP/1.1
-    *m_url++ = '\0';    // 置位空字符，字符串结束符
+    *url++ = '\0';    // 置位空字符，字符串结束符
     // 注意：text的内容表面变成了GET\0/index.html HTTP/1.1，实际上text的内容变成了GET，因为字符串结束符
     char* method = text;
     if ( strcasecmp(method, "GET") == 0 ) { // 忽略大小写比较
@@ -186,31 +316,34 @@ http_conn::HTTP_CODE http_conn::parse_request_line(char* text) {
     }
 
     // /index.html HTTP/1.1
-    // 检索字符串 str1 中第一个不在字符串 str2 中出现的字符下标。
-    m_version = strpbrk( m_url, " \t" );
-    // m_version指向html后面的空格
-    if (!m_version) {
-        return BAD_REQUEST;
-    }
+    char* version = text + m_line.space[1];
+    // version指向html后面的空格
     // /index.html\0HTTP/1.1
-    *m_version++ = '\0';
-    if (strcasecmp( m_version, "HTTP/1.1") != 0 ) {
+    *version++ = '\0';
+    // HTTP/1.1默认保持连接；HTTP/1.0（如webbench默认发送的请求）默认短连接
+    if ( strcasecmp( version, "HTTP/1.1" ) == 0 ) {
+        m_linger = true;
+    } else if ( strcasecmp( version, "HTTP/1.0" ) != 0 ) {
         return BAD_REQUEST;
     }
 
     /**
      *有的请求行中间不是类似/index.html，而是 http://192.168.110.129:10000/index.html
     */
-    if (strncasecmp(m_url, "http://", 7) == 0 ) {
-        m_url += 7;
+    if (strncasecmp(url, "http://", 7) == 0 ) {
+        url += 7;
         // 在参数 str 所指向的字符串中搜索第一次出现字符 c（一个无符号字符）的位置。
         // 找/第一次出现的位置：
-        m_url = strchr( m_url, '/' );  // /index.html
+        url = strchr( url, '/' );  // /index.html
     }
-    if ( !m_url || m_url[0] != '/' ) {
+    if ( !url || url[0] != '/' ) {
         return BAD_REQUEST;
     }
 
+    // 缓冲区扩容后地址会变，只保存偏移
+    m_url = url - m_read_buf.data();
+    m_version = version - m_read_buf.data();
+
     // 请求行处理完了，改变主状态机状态
     m_check_state = CHECK_STATE_HEADER; // 主状态机检查状态变成检查头
     return NO_REQUEST;  // 只是解析了请求行，还需要继续往下解析（如果读取的数据只有请求行，说明请求不完整，需要继续读取数据）
@@ -229,25 +362,64 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
         // 否则说明我们已经得到了一个完整的HTTP请求
         return GET_REQUEST;
 
-    } else if ( strncasecmp( text, "Connection:", 11 ) == 0 ) {
-        // 处理Connection 头部字段  Connection: keep-alive
-        text += 11;
-        text += strspn( text, " \t" );
-        if ( strcasecmp( text, "keep-alive" ) == 0 ) {
-            m_linger = true;
-        }
-    } else if ( strncasecmp( text, "Content-Length:", 15 ) == 0 ) {
-        // 处理Content-Length头部字段
-        text += 15;
-        text += strspn( text, " \t" );
-        m_content_length = atol(text);
-    } else if ( strncasecmp( text, "Host:", 5 ) == 0 ) {
-        // 处理Host头部字段
-        text += 5;
-        text += strspn( text, " \t" );
-        m_host = text;
-    } else {
-        printf( "oop! unknow header %s\n", text );
+    }
+
+    // 字段名到冒号为止（冒号的位置在parse_line()中已经找到），值去掉前后的空白
+    int name_len = m_line.colon;
+    if ( name_len <= 0 ) {
+        LOG_DEBUG( "oop! unknow header %s", text );
+        return NO_REQUEST;
+    }
+    char* value = text + name_len + 1;
+    value += strspn( value, " \t" );
+    int value_len = strlen( value );
+    while ( value_len > 0 && ( value[ value_len - 1 ] == ' ' || value[ value_len - 1 ] == '\t' ) ) {
+        value[ --value_len ] = '\0';
+    }
+
+    // 完美哈希判断是哪个已知头部，然后存入头部表（只保存偏移，不复制）
+    int id = header_lookup( text, name_len );
+    if ( m_header_count < MAX_HEADERS ) {
+        header_view& h = m_io->headers[ m_header_count ];
+        h.name = text - m_read_buf.data();
+        h.name_len = name_len;
+        h.value = value - m_read_buf.data();
+        h.value_len = value_len;
+        if ( id >= 0 && m_known_headers[ id ] < 0 ) {
+            m_known_headers[ id ] = m_header_count;
+        }
+        m_header_count++;
+    }
+
+    switch ( id ) {
+        case HEADER_CONNECTION: {
+            // 处理Connection 头部字段  Connection: keep-alive / Connection: close，可能是逗号分隔的多个选项
+            if ( strcasestr( value, "close" ) ) {
+                m_linger = false;
+            } else if ( strcasestr( value, "keep-alive" ) ) {
+                m_linger = true;
+            }
+            break;
+        }
+        case HEADER_CONTENT_LENGTH: {
+            // 处理Content-Length头部字段：只能是数字（strtoull自己会接受空白和正负号），溢出或超过请求上限的
+            // 先拒绝再保存，否则长度被截断后请求体的边界和客户端不一致
+            char* end;
+            errno = 0;
+            unsigned long long len = strtoull( value, &end, 10 );
+            if ( *value < '0' || *value > '9' || *end != '\0' || errno == ERANGE
+                    || len > ( unsigned long long )m_max_request_size ) {
+                return BAD_REQUEST;
+            }
+            m_content_length = len;
+            break;
+        }
+        case -1: {
+            LOG_DEBUG( "oop! unknow header %s", text );
+            break;
+        }
+        default:
+            break;  // Host等其他已知头部在需要时用get_header()查找
     }
     // 实际上，我们应该处理所有可能的头部字段
 
@@ -255,10 +427,12 @@ http_conn::HTTP_CODE http_conn::parse_headers(char* text) {
 }
 
 // 这个项目中我们没有真正解析HTTP请求的消息体，只是判断它是否被完整的读入了
-http_conn::HTTP_CODE http_conn::parse_content( char* text ) {
-    if ( m_read_idx >= ( m_content_length + m_checked_idx ) )
+http_conn::HTTP_CODE http_conn::parse_content() {
+    if ( ( long )m_read_buf.size() >= ( m_content_length + m_checked_idx ) )
     {
-        text[ m_content_length ] = '\0';
+        // 跳过请求体，流水线中的下一个请求从请求体之后开始（不能在请求体末尾写'\0'，那是下一个请求的第一个字节）
+        m_checked_idx += m_content_length;
+        m_start_line = m_checked_idx;
         return GET_REQUEST;
     }
     return NO_REQUEST;
@@ -286,7 +460,7 @@ http_conn::HTTP_CODE http_conn::process_read() {
 
         // m_start_line：下一次要解析的行的起始位置
         m_start_line = m_checked_idx;  // m_checked_idx：当前扫描到的字符在读缓冲区中的位置（parse_line下次解析的开始）
-        printf( "got 1 http line: %s\n", text );
+        LOG_DEBUG( "got 1 http line: %s", text );
 
         switch ( m_check_state ) {
             case CHECK_STATE_REQUESTLINE: {
@@ -307,7 +481,7 @@ http_conn::HTTP_CODE http_conn::process_read() {
                 break;
             }
             case CHECK_STATE_CONTENT: {
-                ret = parse_content( text );
+                ret = parse_content();
                 if ( ret == GET_REQUEST ) {
                     // 获得了一个完整的客户请求
                     return do_request();  // 处理用户请求（获取用户请求资源），返回处理结果
@@ -323,238 +497,1085 @@ http_conn::HTTP_CODE http_conn::process_read() {
     return NO_REQUEST;
 }
 
+// 无符号整数转十六进制字符串，返回长度；buf至少16字节
+static int format_hex( char* buf, unsigned long n ) {
+    static const char digits[] = "0123456789abcdef";
+    char tmp[ 16 ];
+    int len = 0;
+    do {
+        tmp[ len++ ] = digits[ n & 15 ];
+        n >>= 4;
+    } while ( n );
+    for ( int i = 0; i < len; ++i ) {
+        buf[i] = tmp[ len - 1 - i ];
+    }
+    return len;
+}
+
+// HTTP日期（IMF-fixdate，如"Sun, 06 Nov 1994 08:49:37 GMT"）和time_t互相转换。
+// 自己按公历计算，不调用gmtime_r/timegm（glibc中它们要加时区的全局锁）
+static const char* const week_names[] = { "Thu", "Fri", "Sat", "Sun", "Mon", "Tue", "Wed" };    // 1970-01-01是星期四
+static const char* const month_names[] = { "Jan", "Feb", "Mar", "Apr", "May", "Jun", "Jul", "Aug", "Sep", "Oct", "Nov", "Dec" };
+
+// 公历日期到1970-01-01的天数
+static long days_from_civil( long y, int m, int d ) {
+    y -= m <= 2;
+    long era = ( y >= 0 ? y : y - 399 ) / 400;
+    long yoe = y - era * 400;
+    long doy = ( 153 * ( m + ( m > 2 ? -3 : 9 ) ) + 2 ) / 5 + d - 1;
+    long doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+// 写入29个字节，不带结尾的'\0'
+static int format_http_date( char* buf, time_t t ) {
+    long days = t >= 0 ? t / 86400 : ( t - 86399 ) / 86400;
+    long secs = t - days * 86400;
+    long z = days + 719468;
+    long era = ( z >= 0 ? z : z - 146096 ) / 146097;
+    long doe = z - era * 146097;
+    long yoe = ( doe - doe / 1460 + doe / 36524 - doe / 146096 ) / 365;
+    long doy = doe - ( 365 * yoe + yoe / 4 - yoe / 100 );
+    long mp = ( 5 * doy + 2 ) / 153;
+    int d = doy - ( 153 * mp + 2 ) / 5 + 1;
+    int m = mp < 10 ? mp + 3 : mp - 9;
+    long y = yoe + era * 400 + ( m <= 2 );
+    return snprintf( buf, 32, "%s, %02d %s %04ld %02ld:%02ld:%02ld GMT", week_names[ ( ( days % 7 ) + 7 ) % 7 ],
+                     d, month_names[ m - 1 ], y, secs / 3600, secs / 60 % 60, secs % 60 );
+}
+
+// 只接受IMF-fixdate格式，其他格式返回-1（调用者当作没有这个头部）
+static time_t parse_http_date( const char* s ) {
+    int d, y, hh, mm, ss;
+    char mon[ 4 ];
+    if ( strlen( s ) != 29 || sscanf( s + 5, "%2d %3s %4d %2d:%2d:%2d GMT", &d, mon, &y, &hh, &mm, &ss ) != 6 ) {
+        return -1;
+    }
+    for ( int m = 0; m < 12; ++m ) {
+        if ( strcmp( mon, month_names[m] ) == 0 ) {
+            return days_from_civil( y, m + 1, d ) * 86400 + hh * 3600 + mm * 60 + ss;
+        }
+    }
+    return -1;
+}
+
+// If-None-Match（"*"或逗号分隔的ETag列表）是否包含etag，弱比较：忽略W/前缀
+static bool etag_list_matches( const char* list, const char* etag, int etag_len ) {
+    const char* p = list;
+    while ( true ) {
+        p += strspn( p, " \t," );
+        if ( !*p ) {
+            return false;
+        }
+        if ( *p == '*' ) {
+            return true;
+        }
+        if ( p[0] == 'W' && p[1] == '/' ) {
+            p += 2;
+        }
+        if ( *p != '"' ) {
+            return false;
+        }
+        const char* end = strchr( p + 1, '"' );
+        if ( !end ) {
+            return false;
+        }
+        if ( end + 1 - p == etag_len && memcmp( p, etag, etag_len ) == 0 ) {
+            return true;
+        }
+        p = end + 1;
+    }
+}
+
+// Accept-Encoding是否接受gzip，如"gzip, deflate, br"、"gzip;q=0"（q=0表示拒绝）、"*;q=0.5"；
+// 明确列出gzip时以它为准，否则看"*"
+static bool accepts_gzip( const char* value ) {
+    if ( !value ) {
+        return false;
+    }
+    int gzip = -1;
+    int star = -1;
+    const char* p = value;
+    while ( *p ) {
+        p += strspn( p, " \t," );
+        const char* name = p;
+        size_t name_len = strcspn( p, " \t;," );
+        p += name_len;
+        // 参数中只关心q值：q=0、q=0.0、q=0.000都是拒绝
+        bool accepted = true;
+        while ( *p && *p != ',' ) {
+            if ( *p == ';' ) {
+                p += 1 + strspn( p + 1, " \t" );
+                if ( ( *p == 'q' || *p == 'Q' ) && p[1] == '=' ) {
+                    const char* q = p + 2;
+                    if ( *q == '0' ) {
+                        ++q;
+                        if ( *q == '.' ) {
+                            q += 1 + strspn( q + 1, "0" );
+                        }
+                        accepted = !( *q == '\0' || *q == ',' || *q == ';' || *q == ' ' || *q == '\t' );
+                    }
+                }
+                continue;
+            }
+            ++p;
+        }
+        if ( ( name_len == 4 && strncasecmp( name, "gzip", 4 ) == 0 )
+                || ( name_len == 6 && strncasecmp( name, "x-gzip", 6 ) == 0 ) ) {
+            gzip = accepted;
+        } else if ( name_len == 1 && *name == '*' ) {
+            star = accepted;
+        }
+    }
+    return gzip >= 0 ? gzip : star > 0;
+}
+
 // 处理用户请求（获取用户请求资源）
 // 当得到一个完整、正确的HTTP请求时，我们就分析目标文件的属性，
 // 如果目标文件存在、对所有用户可读，且不是目录，则使用mmap将其
 // 映射到内存地址m_file_address处，并告诉调用者获取文件成功
 http_conn::HTTP_CODE http_conn::do_request()
 {
+    if ( m_traces ) {
+        m_traces[ m_response_count ].stamp[ TRACE_REQUEST ] = timer_now_ns();
+    }
+
+    // 监控指标：汇总各线程的计数器，在内存中生成正文，不访问文件系统
+    const char* url = get_text( m_url );
+    size_t status_len = m_status_url ? strlen( m_status_url ) : 0;
+    if ( status_len > 0 && strncmp( url, m_status_url, status_len ) == 0
+            && ( url[ status_len ] == '\0' || url[ status_len ] == '?' ) ) {
+        m_prometheus = strstr( url + status_len, "format=prometheus" ) != NULL;
+        m_generated = metrics::get_instance()->render( m_prometheus, &m_body_len );
+        return STATUS_REQUEST;
+    }
+
     // "/home/nowcoder/webserver/resources" 资源文件夹位置
-    strcpy( m_real_file, doc_root );  // 将doc_root的值拷贝到m_real_file
+    strcpy( m_io->real_file, doc_root );  // 将doc_root的值拷贝到m_io->real_file
     int len = strlen( doc_root );
     // "/home/nowcoder/webserver/resources/index.html" 
-    strncpy( m_real_file + len, m_url, FILENAME_LEN - len - 1 );
-   
-    // 获取m_real_file文件的相关的状态信息给m_file_stat，-1失败，0成功
-    if ( stat( m_real_file, &m_file_stat ) < 0 ) {
-        return NO_RESOURCE;  // 服务器没有这个客户端请求的资源
+    strncpy( m_io->real_file + len, url, FILENAME_LEN - len - 1 );
+    m_io->real_file[ FILENAME_LEN - 1 ] = '\0';
+
+    // 条件请求：先只取文件状态（缓存命中时没有系统调用，未命中时只stat，不open/mmap），校验器匹配时直接返回304
+    if ( get_header( HEADER_IF_NONE_MATCH ) || get_header( HEADER_IF_MODIFIED_SINCE ) ) {
+        bool gzip_file;
+        if ( file_cache::get_instance()->get_stat( m_io->real_file, &m_io->file_stat, &gzip_file )
+                && S_ISREG( m_io->file_stat.st_mode ) && ( m_io->file_stat.st_mode & S_IROTH ) ) {
+            make_etag();
+            if ( not_modified() ) {
+                m_mime = mime_lookup( m_io->real_file );
+                m_gzip = false;
+                m_weak_etag = gzip_selected( gzip_file );
+                return NOT_MODIFIED;
+            }
+        }
+    }
+
+    // 从文件缓存中获取文件（状态信息+打开的fd+内存映射），命中时不需要stat/open/mmap
+    m_file = file_cache::get_instance()->acquire( m_io->real_file );
+    if ( !m_file ) {
+        if ( errno == EACCES ) {
+            return FORBIDDEN_REQUEST;
+        }
+        return ( errno == ENOENT || errno == ENOTDIR || errno == ENAMETOOLONG ) ? NO_RESOURCE : INTERNAL_ERROR;
     }
+    m_io->file_stat = m_file->st;
 
     // 判断访问权限
-    if ( ! ( m_file_stat.st_mode & S_IROTH ) ) { // S_IROTH 可访问/读权限
+    if ( ! ( m_io->file_stat.st_mode & S_IROTH ) ) { // S_IROTH 可访问/读权限
+        unmap();
         return FORBIDDEN_REQUEST;  // 没有访问权限
     }
 
     // 判断是否是目录
-    if ( S_ISDIR( m_file_stat.st_mode ) ) {
+    if ( S_ISDIR( m_io->file_stat.st_mode ) ) {
+        unmap();
         return BAD_REQUEST;
     }
 
-    // 以只读方式打开文件
-    int fd = open( m_real_file, O_RDONLY );
-    // 创建内存映射：mmap将网页数据映射到内存中，返回内存首地址（之后会将内存数据发送给客户端，注意创建了内存映射，在用完这块内存后要释放它）
-    m_file_address = ( char* )mmap( 0, m_file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
-    close( fd );
+    // 文件缓存中的内存映射是只读、共享的，响应发送完后只释放引用，不munmap
+    m_file_address = m_file->addr;
+    m_body_len = m_io->file_stat.st_size;
+    make_etag();
+    m_mime = mime_lookup( m_io->real_file );
+    m_gzip = false;
+    m_weak_etag = false;
+    m_range_count = S_ISREG( m_io->file_stat.st_mode ) ? parse_range() : 0;
+    if ( m_range_count < 0 ) {
+        unmap();
+        return RANGE_NOT_SATISFIABLE;
+    }
+    // 区间是针对原文件的，有Range时不压缩
+    if ( m_range_count == 0 && gzip_selected( m_file->gzip_file ) ) {
+        m_weak_etag = true;
+        use_gzip();
+    }
 
     return FILE_REQUEST;  // 获取文件成功
 }
 
-// 对内存映射区执行munmap操作，释放资源
+// 是否选择gzip编码：只看类型、Accept-Encoding和元数据（有可用的预压缩文件，或者文件能在运行时压缩），
+// 不看压缩结果是否已经生成。200和304都按它决定ETag是不是弱的，同一个文件的校验器才一致
+bool http_conn::gzip_selected( bool gzip_file ) {
+    return m_mime->compressible && accepts_gzip( get_header( HEADER_ACCEPT_ENCODING ) )
+        && ( gzip_file || file_cache::get_instance()->can_gzip( m_io->file_stat.st_size ) );
+}
+
+// 选择了gzip编码时，优先发送预压缩文件path.gz，没有时发送文件缓存中的压缩结果（第一次请求时生成）；
+// 其他线程正在压缩或压缩后没有变小时这次发送原文件，ETag仍然是弱的
+void http_conn::use_gzip() {
+    file_cache* cache = file_cache::get_instance();
+    if ( m_file->gzip_file ) {
+        char path[ FILENAME_LEN + 4 ];
+        snprintf( path, sizeof( path ), "%s.gz", m_io->real_file );
+        file_entry* gz = cache->acquire( path );
+        if ( gz && gz->fd >= 0 ) {
+            // 和原文件一样：映射了的和响应头一起sendmsg，否则sendfile
+            cache->release( m_file );
+            m_file = gz;
+            m_file_address = gz->addr;
+            m_body_len = gz->st.st_size;
+            m_gzip = true;
+            return;
+        }
+        if ( gz ) {
+            cache->release( gz );
+        }
+    }
+    if ( cache->gzip( m_file ) ) {
+        m_file_address = m_file->gzip_addr;
+        m_body_len = m_file->gzip_size;
+        m_gzip = true;
+    }
+}
+
+// 解析Range: bytes=0-99,200-,-500，区间按文件大小截断后保存到m_io->ranges。返回区间数；
+// 0表示忽略Range、发送整个文件（没有Range、格式不对、If-Range不匹配、区间太多或重叠过多），-1表示没有一个区间能满足（416）
+int http_conn::parse_range() {
+    const char* p = get_header( HEADER_RANGE );
+    if ( !p ) {
+        return 0;
+    }
+    // If-Range：文件没有变化时才按区间发送，否则发送整个文件
+    const char* if_range = get_header( HEADER_IF_RANGE );
+    if ( if_range && !if_range_matches( if_range ) ) {
+        return 0;
+    }
+    return parse_byte_ranges( p, m_io->file_stat.st_size, m_io->ranges, MAX_RANGES );
+}
+
+// 强ETag："inode-大小-修改时间（纳秒）"，都是十六进制
+void http_conn::make_etag() {
+    char* p = m_io->etag;
+    *p++ = '"';
+    p += format_hex( p, m_io->file_stat.st_ino );
+    *p++ = '-';
+    p += format_hex( p, m_io->file_stat.st_size );
+    *p++ = '-';
+    p += format_hex( p, m_io->file_stat.st_mtim.tv_sec * 1000000000UL + m_io->file_stat.st_mtim.tv_nsec );
+    *p++ = '"';
+    m_etag_len = p - m_io->etag;
+}
+
+// 条件请求的校验器是否匹配：有If-None-Match时只看它（弱比较），否则看If-Modified-Since
+bool http_conn::not_modified() {
+    const char* inm = get_header( HEADER_IF_NONE_MATCH );
+    if ( inm ) {
+        return etag_list_matches( inm, m_io->etag, m_etag_len );
+    }
+    time_t since = parse_http_date( get_header( HEADER_IF_MODIFIED_SINCE ) );
+    return since >= 0 && m_io->file_stat.st_mtime <= since;
+}
+
+// If-Range是强ETag或者Last-Modified的日期，和当前文件的完全相同才算匹配
+bool http_conn::if_range_matches( const char* value ) {
+    if ( *value == '"' ) {
+        return ( int )strlen( value ) == m_etag_len && memcmp( value, m_io->etag, m_etag_len ) == 0;
+    }
+    time_t t = parse_http_date( value );
+    return t >= 0 && t == m_io->file_stat.st_mtime;
+}
+
+// 释放对文件缓存条目的引用（最后一个引用释放时才真正munmap）
 void http_conn::unmap() {
-    if( m_file_address )
+    if( m_file )
     {
-        munmap( m_file_address, m_file_stat.st_size );
-        m_file_address = 0;
+        file_cache::get_instance()->release( m_file );
+        m_file = NULL;
     }
+    m_file_address = 0;
 }
 
 // 写HTTP响应（有两块不同内存——数组（写缓冲区，m_write_idx）：状态行+响应头部；内存映射：响应正文）
-// 由于有两块不连续的内存：使用writev()而非write(),writev因为可以将不连续的内存一次性发送出去
-// 使用writev()需要将两块内存封装在iovec型数组中：已在process_write函数中封装好
+// 由于有多块不连续的内存：使用sendmsg()（和writev一样是分散写），把队列中所有排队的响应一次发送出去
+// 文件没有映射时（sendfile模式）：响应头用MSG_MORE发送，正文用sendfile从page cache直接发送，不经过用户空间
+// 返回false时调用者关闭连接；返回true且has_pending_input()时调用者要继续解析读缓冲区中的请求
 bool http_conn::write()
 {
-    int temp = 0;
-    int bytes_have_send = 0;    // 已经发送的字节
-    int bytes_to_send = m_write_idx;// 将要发送的字节 （m_write_idx）写缓冲区中待发送的字节数
-
-    if ( bytes_to_send == 0 ) {
-        // 将要发送的字节为0，这一次响应结束。
-        modfd( m_epollfd, m_sockfd, EPOLLIN );
-        init();
-        return true;
-    }
+    while ( m_response_head < m_response_count ) {
+        response& r = m_io->responses[ m_response_head ];
+        ssize_t temp = 0;
+        size_t start;
+        body_part* part = file_part_at( r, &start );
+
+        if ( part ) {
+            if ( m_traces && m_traces[ m_response_head ].stamp[ TRACE_WRITE ] == 0 ) {
+                m_traces[ m_response_head ].stamp[ TRACE_WRITE ] = timer_now_ns();
+            }
+            // 前面的数据已发送完，sendfile从这一段中未发送的位置继续
+            off_t offset = part->offset + ( r.sent - start );
+            temp = sendfile( m_sockfd, r.file->fd, &offset, start + part->len - r.sent );
+            if ( temp == 0 ) {
+                // 文件在发送过程中被截断，无法再发送出声明的Content-Length
+                record_response( r );
+                return false;
+            }
+        } else {
+            temp = send_responses();
+        }
 
-    while(1) {
-        // 分散写
-        temp = writev(m_sockfd, m_iv, m_iv_count);
         if ( temp <= -1 ) {
             // 如果TCP写缓冲没有空间，则等待下一轮EPOLLOUT事件，虽然在此期间，
             // 服务器无法立即接收到同一客户的下一个请求，但可以保证连接的完整性。
             if( errno == EAGAIN ) {
-                modfd( m_epollfd, m_sockfd, EPOLLOUT );
+                modfd( m_epollfd, m_sockfd, EPOLLOUT, m_conn_trig_mode == ET );
                 return true;
             }
-            unmap();
+            record_response( r );
             return false;
         }
-        bytes_to_send -= temp;
-        bytes_have_send += temp;
-        if ( bytes_to_send <= bytes_have_send ) {
-            // 发送HTTP响应成功，根据HTTP请求中的Connection字段决定是否立即关闭连接
-            unmap();
-            if(m_linger) {
-                init();
-                modfd( m_epollfd, m_sockfd, EPOLLIN );  // 重置监听事件
-                return true;
-            } else {
-                modfd( m_epollfd, m_sockfd, EPOLLIN );
-                return false;
-            }
+
+        // 记录发送进度，下一次（EAGAIN之后）从未发送的位置继续
+        set_timeout( TIMEOUT_IDLE );  // 对方还在接收数据，续期
+        if ( part ) {
+            r.sent += temp;
+        } else {
+            advance_responses( temp );
+        }
+        if ( !pop_responses() ) {
+            return false;
         }
     }
+
+    finish_write();
+    if ( has_pending_input() ) {
+        return true;
+    }
+    modfd( m_epollfd, m_sockfd, EPOLLIN, m_conn_trig_mode == ET );  // 重置监听事件
+    return true;
 }
 
-// 往写缓冲（自己定义的数组m_write_buf）中按照格式写入待发送的数据
-bool http_conn::add_response( const char* format, ... ) {  // ...为可变参数
-    // 当前写索引大于写缓冲区长度（即写缓冲区满了）
-    if( m_write_idx >= WRITE_BUFFER_SIZE ) {
-        return false;
+// 发送完的响应出队，根据HTTP请求中的Connection字段决定是否立即关闭连接（返回false）
+bool http_conn::pop_responses() {
+    while ( m_response_head < m_response_count
+            && m_io->responses[ m_response_head ].sent == m_io->responses[ m_response_head ].bytes ) {
+        response& done = m_io->responses[ m_response_head++ ];
+        finish_response( done );
+        if ( !done.linger ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 队列中的响应都发送完了：整理读缓冲区，流水线中还有没解析的请求时由调用者继续处理
+void http_conn::finish_write() {
+    m_response_head = m_response_count = 0;
+    m_write_idx = 0;
+    compact_read_buf();
+    if ( m_read_buf.size() == 0 ) {
+        detach_io();  // 连接空闲了，读缓冲区在compact_read_buf()中已经归还
+    }
+    set_timeout( m_read_buf.size() > 0 ? TIMEOUT_HEADER : TIMEOUT_KEEPALIVE );  // 等待长连接上的下一个请求
+}
+
+// io_uring：sendmsg不会遇到sendfile的正文段（这种方式下文件都映射到内存中），一次最多发送MAX_IOV段，
+// 分段和msghdr放在io_block中，直到完成都有效
+struct msghdr* http_conn::prepare_send( bool* then_read ) {
+    bool more = false;
+    int count = gather_responses( m_io->iov, &more );
+    size_t len = 0;
+    for ( int i = 0; i < count; ++i ) {
+        len += m_io->iov[i].iov_len;
+    }
+    size_t left = 0;
+    for ( int i = m_response_head; i < m_response_count; ++i ) {
+        left += m_io->responses[i].bytes - m_io->responses[i].sent;
     }
+    *then_read = len == left && m_io->responses[ m_response_count - 1 ].linger && m_checked_idx == ( int )m_read_buf.size();
 
-    va_list arg_list;  
-    // 通过va_start获取可变参数列表的第一个参数（即format参数右边的可变参数列表的第一个参数）的地址给arg_list
-    va_start( arg_list, format );
-    
-    // 将可变参数（arg_list）格式化（format）输出到一个字符数组（m_write_buf + m_write_idx）
-    // 参数2是参数1可接受的最大字节数
-    // 执行成功，返回写入到字符数组中的字符个数（不包含终止符），最大不超过参数2；执行失败，返回负值
-    int len = vsnprintf( m_write_buf + m_write_idx, WRITE_BUFFER_SIZE - 1 - m_write_idx, format, arg_list );
-    if( len >= ( WRITE_BUFFER_SIZE - 1 - m_write_idx ) ) {
+    memset( &m_io->msg, 0, sizeof( m_io->msg ) );
+    m_io->msg.msg_iov = m_io->iov;
+    m_io->msg.msg_iovlen = count;
+    return &m_io->msg;
+}
+
+bool http_conn::complete_send( size_t bytes ) {
+    set_timeout( TIMEOUT_IDLE );
+    advance_responses( bytes );
+    if ( !pop_responses() ) {
         return false;
     }
-    m_write_idx += len;  // 新的写开始位置
+    if ( !has_pending_output() ) {
+        finish_write();
+    }
+    return true;
+}
+
+// r.sent处在一个要用sendfile发送的正文段中时返回这一段，start为它在响应中的起始位置；否则返回NULL
+http_conn::body_part* http_conn::file_part_at( response& r, size_t* start ) {
+    size_t pos = r.header_len;
+    for ( int i = 0; i < r.part_count && pos <= r.sent; ++i ) {
+        body_part& p = r.part( i );
+        if ( !p.data && r.sent < pos + p.len ) {
+            *start = pos;
+            return &p;
+        }
+        pos += p.len;
+    }
+    return NULL;
+}
 
-    // 释放arg_list指针
-    va_end( arg_list );
+// 从r.sent开始，直到下一个要用sendfile发送的正文段为止（都在内存中，可以一起sendmsg）的结束位置
+size_t http_conn::memory_end( response& r ) {
+    size_t pos = r.header_len;
+    for ( int i = 0; i < r.part_count; ++i ) {
+        body_part& p = r.part( i );
+        if ( !p.data && p.len > 0 && r.sent < pos + p.len ) {
+            return pos > r.sent ? pos : r.sent;
+        }
+        pos += p.len;
+    }
+    return r.bytes;
+}
+
+// 从队头开始，把直到第一个需要sendfile的正文段为止的所有数据（响应头、错误响应、映射的文件或其中的区间、
+// multipart的分隔行）用一次sendmsg发送
+ssize_t http_conn::send_responses() {
+    struct iovec iv[ MAX_IOV ];
+    bool more = false;
+    int count = gather_responses( iv, &more );
+
+    struct msghdr msg;
+    memset( &msg, 0, sizeof( msg ) );
+    msg.msg_iov = iv;
+    msg.msg_iovlen = count;
+    return sendmsg( m_sockfd, &msg, more ? MSG_MORE : 0 );
+}
+
+// 把队列中要一起发送的数据填入iv，返回段数；more为true表示后面紧跟着sendfile发送的正文
+int http_conn::gather_responses( struct iovec* iv, bool* more ) {
+    int count = 0;
+    long now = 0;
+    for ( int i = m_response_head; i < m_response_count && count < MAX_IOV; ++i ) {
+        response& r = m_io->responses[ i ];
+        size_t end = memory_end( r );
+        if ( m_traces && m_traces[i].stamp[ TRACE_WRITE ] == 0 ) {
+            now = now ? now : timer_now_ns();
+            m_traces[i].stamp[ TRACE_WRITE ] = now;
+        }
+        size_t pos = 0;
+        for ( int k = -1; k < r.part_count && pos < end && count < MAX_IOV; ++k ) {
+            // k为-1时是写缓冲区中的响应头
+            const char* data = k < 0 ? m_io->write_buf + r.header_off : r.part( k ).data;
+            size_t len = k < 0 ? r.header_len : r.part( k ).len;
+            if ( r.sent < pos + len ) {
+                size_t from = r.sent > pos ? r.sent - pos : 0;
+                iv[ count ].iov_base = ( char* )data + from;
+                iv[ count++ ].iov_len = ( pos + len < end ? len : end - pos ) - from;
+            }
+            pos += len;
+        }
+        if ( end < r.bytes ) {
+            // MSG_MORE：告诉内核后面还有数据（sendfile的正文），让响应头和正文合并成满的TCP报文段
+            *more = true;
+            break;
+        }
+    }
+    return count;
+}
+
+// 把sendmsg发送的bytes个字节按顺序记到队列中的各个响应上
+void http_conn::advance_responses( size_t bytes ) {
+    for ( int i = m_response_head; i < m_response_count && bytes > 0; ++i ) {
+        response& r = m_io->responses[ i ];
+        size_t limit = memory_end( r );  // sendfile的正文不在这次发送中
+        size_t n = bytes < limit - r.sent ? bytes : limit - r.sent;
+        r.sent += n;
+        bytes -= n;
+    }
+}
+
+// 一个响应发送完：计入监控指标、记访问日志，释放文件缓存条目的引用
+void http_conn::finish_response( response& r ) {
+    record_response( r );
+    release_response( r );
+}
+
+void http_conn::release_response( response& r ) {
+    if ( r.file ) {
+        file_cache::get_instance()->release( r.file );
+        r.file = NULL;
+    }
+    if ( r.parts ) {
+        buffer_pool::get_instance()->put( r.parts, r.parts_size );
+        r.parts = NULL;
+    }
+    delete [] r.generated;
+    r.generated = NULL;
+}
+
+const char* http_conn::get_header( int id, int* len ) {
+    int i = m_known_headers[ id ];
+    if ( i < 0 ) {
+        return NULL;
+    }
+    if ( len ) {
+        *len = m_io->headers[i].value_len;
+    }
+    return m_read_buf.data() + m_io->headers[i].value;
+}
+
+// 队列中的响应都发送完后，丢弃已经处理完的请求，把还没处理完的数据（流水线中的下一个请求）移到读缓冲区开头，
+// 已经解析出的偏移（请求行、头部表）跟着移动
+void http_conn::compact_read_buf() {
+    int shift = m_request_start;
+    if ( shift == 0 ) {
+        return;
+    }
+    m_read_buf.consume( shift );
+    m_checked_idx -= shift;
+    m_start_line -= shift;
+    m_request_start = 0;
+    if ( m_url >= 0 ) {
+        m_url -= shift;
+    }
+    if ( m_version >= 0 ) {
+        m_version -= shift;
+    }
+    for ( int i = 0; i < m_header_count; ++i ) {
+        m_io->headers[i].name -= shift;
+        m_io->headers[i].value -= shift;
+    }
+}
+
+// 一个请求结束（响应发送完或发送失败）：计入监控指标（只写本线程的计数器），
+// 开启访问日志时再写一行key=value格式的日志
+void http_conn::record_response( const response& r ) {
+    long now = timer_now_ns();
+    long elapsed = now - r.start_time;
+    metrics::get_instance()->add_response( r.status, r.sent, elapsed );
+    if ( m_traces ) {
+        request_trace& t = m_traces[ &r - m_io->responses ];
+        t.stamp[ TRACE_DONE ] = now;
+        tracer::get_instance()->finish( t, m_sockfd, r.status, r.sent, r.url >= 0 ? get_text( r.url ) : NULL );
+    }
+    if( !logger::m_access_enabled ) {
+        return;
+    }
+    char ip[ INET_ADDRSTRLEN ];
+    inet_ntop( AF_INET, &m_address.sin_addr, ip, sizeof( ip ) );
+    LOG_ACCESS( "client=%s:%d method=GET url=%s version=%s status=%d bytes=%zu sent=%zu keepalive=%d ms=%ld",
+                ip, ntohs( m_address.sin_port ), r.url >= 0 ? get_text( r.url ) : "-", r.version >= 0 ? get_text( r.version ) : "-",
+                r.status, r.bytes, r.sent, r.linger ? 1 : 0, elapsed / 1000000 );
+}
+
+// 响应头的固定片段和完整的错误响应在启动时准备好，生成响应时只需要memcpy，不再调用vsnprintf
+static const char crlf[] = "\r\n";
+static const char content_length_field[] = "Content-Length: ";
+static const char content_type_html[] = "Content-Type: text/html\r\n";
+static const char vary_field[] = "Vary: Accept-Encoding\r\n";
+static const char content_encoding_gzip[] = "Content-Encoding: gzip\r\n";
+static const char accept_ranges_field[] = "Accept-Ranges: bytes\r\n";
+static const char content_range_field[] = "Content-Range: bytes ";
+static const char etag_field[] = "ETag: ";
+static const char weak_prefix[] = "W/";
+static const char last_modified_field[] = "Last-Modified: ";
+static const char multipart_type_field[] = "Content-Type: multipart/byteranges; boundary=";
+static const char no_store_field[] = "Cache-Control: no-store\r\n";
+static const char content_type_status[ 2 ][ 64 ] = { "Content-Type: text/plain; charset=utf-8\r\n",
+                                                    "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n" };
+static const char connection_fields[ 2 ][ 32 ] = { "Connection: close\r\n", "Connection: keep-alive\r\n" };
+
+// 状态码对应的状态行
+static const char* status_line( int status, int* len ) {
+    static const struct {
+        int status;
+        const char* line;
+    } lines[] = {
+        { 200, "HTTP/1.1 200 OK\r\n" },
+        { 206, "HTTP/1.1 206 Partial Content\r\n" },
+        { 304, "HTTP/1.1 304 Not Modified\r\n" },
+        { 400, "HTTP/1.1 400 Bad Request\r\n" },
+        { 403, "HTTP/1.1 403 Forbidden\r\n" },
+        { 404, "HTTP/1.1 404 Not Found\r\n" },
+        { 416, "HTTP/1.1 416 Range Not Satisfiable\r\n" },
+        { 500, "HTTP/1.1 500 Internal Error\r\n" },
+    };
+    for ( size_t i = 0; i < sizeof( lines ) / sizeof( lines[0] ); ++i ) {
+        if ( lines[i].status == status ) {
+            *len = strlen( lines[i].line );
+            return lines[i].line;
+        }
+    }
+    *len = strlen( lines[ sizeof( lines ) / sizeof( lines[0] ) - 1 ].line );
+    return lines[ sizeof( lines ) / sizeof( lines[0] ) - 1 ].line;
+}
+
+// 无符号整数转十进制字符串（不经过printf），返回长度；buf至少20字节
+static int format_number( char* buf, unsigned long n ) {
+    char tmp[ 20 ];
+    int len = 0;
+    do {
+        tmp[ len++ ] = '0' + n % 10;
+        n /= 10;
+    } while ( n );
+    for ( int i = 0; i < len; ++i ) {
+        buf[i] = tmp[ len - 1 - i ];
+    }
+    return len;
+}
+
+// Date头部，每个线程每秒只格式化一次
+static thread_local time_t t_date_sec = -1;
+static thread_local char t_date[ 64 ];
+static thread_local int t_date_len = 0;
+
+static const char* date_field( int* len ) {
+    static const char prefix[] = "Date: ";
+    time_t now = time( NULL );
+    if ( now != t_date_sec ) {
+        memcpy( t_date, prefix, sizeof( prefix ) - 1 );
+        t_date_len = sizeof( prefix ) - 1;
+        t_date_len += format_http_date( t_date + t_date_len, now );
+        memcpy( t_date + t_date_len, "\r\n", 2 );
+        t_date_len += 2;
+        t_date_sec = now;
+    }
+    *len = t_date_len;
+    return t_date;
+}
+
+// 错误响应中状态行和Date之后的部分（Content-Length、Content-Type、Connection、空行和正文），
+// 启动时为长/短连接各生成一份，发送时直接指向它，不复制到写缓冲区
+struct error_page {
+    int status;
+    const char* form;
+    std::string rest[ 2 ];
+};
+
+static struct error_pages {
+    static const int PAGE_NUMBER = 5;
+    error_page pages[ PAGE_NUMBER ];
+
+    error_pages() {
+        const error_page init[] = {
+            { 400, error_400_form, {} },
+            { 403, error_403_form, {} },
+            { 404, error_404_form, {} },
+            { 416, error_416_form, {} },
+            { 500, error_500_form, {} },
+        };
+        for ( int i = 0; i < PAGE_NUMBER; ++i ) {
+            pages[i] = init[i];
+            for ( int linger = 0; linger < 2; ++linger ) {
+                char number[ 20 ];
+                std::string& rest = pages[i].rest[ linger ];
+                rest.append( content_length_field );
+                rest.append( number, format_number( number, strlen( init[i].form ) ) );
+                rest.append( crlf );
+                rest.append( content_type_html );
+                rest.append( connection_fields[ linger ] );
+                rest.append( crlf );
+                rest.append( init[i].form );
+            }
+        }
+    }
+
+    const error_page& get( int status ) const {
+        for ( int i = 0; i < PAGE_NUMBER - 1; ++i ) {
+            if ( pages[i].status == status ) {
+                return pages[i];
+            }
+        }
+        return pages[ PAGE_NUMBER - 1 ];
+    }
+} prebuilt_errors;
+
+// multipart/byteranges的分隔符，启动时随机生成一次，所有响应共用
+static const std::string multipart_boundary = [] {
+    std::random_device rd;
+    char buf[ 32 ];
+    snprintf( buf, sizeof( buf ), "%08x%08x", rd(), rd() );
+    return std::string( buf );
+}();
+
+// 各区间前面的分隔行和正文最后的结束分隔行
+static const std::string multipart_delimiter = "\r\n--" + multipart_boundary + "\r\n";
+static const std::string multipart_close = "\r\n--" + multipart_boundary + "--\r\n";
+
+// 追加len个字节，返回追加后的末尾（multipart的部分头部直接写到从内存池借用的块中）
+static char* append_bytes( char* q, const char* data, size_t len ) {
+    memcpy( q, data, len );
+    return q + len;
+}
+
+// 往写缓冲（自己定义的数组m_io->write_buf）中追加len个字节，空间不够时返回false
+bool http_conn::add_bytes( const char* data, int len ) {
+    if( m_write_idx + len > WRITE_BUFFER_SIZE ) {
+        return false;
+    }
+    memcpy( m_io->write_buf + m_write_idx, data, len );
+    m_write_idx += len;
     return true;
 }
 
 // 写HTTP响应报文的状态行
-bool http_conn::add_status_line( int status, const char* title ) {
-    return add_response( "%s %d %s\r\n", "HTTP/1.1", status, title );
+bool http_conn::add_status_line( int status ) {
+    int len;
+    const char* line = status_line( status, &len );
+    m_status = status;
+    return add_bytes( line, len );
+}
+
+// 写HTTP响应报文的响应头部：Date、Content-Length、Content-Type、（一个区间的206）Content-Range、Accept-Ranges、
+// ETag、Last-Modified、（可压缩的类型）Vary和Content-Encoding、Connection和空行
+bool http_conn::add_headers( size_t content_len ) {
+    return add_date() && add_content_length( content_len ) && add_content_type()
+        && ( m_range_count != 1 || add_content_range( m_io->ranges[0].first, m_io->ranges[0].last, m_io->file_stat.st_size ) )
+        && ( m_gzip || add_bytes( accept_ranges_field, sizeof( accept_ranges_field ) - 1 ) )
+        && add_validators() && add_content_encoding() && add_linger() && add_blank_line();
+}
+
+// ETag和Last-Modified；选择了gzip编码时内容和原文件字节不同，只能是弱ETag
+bool http_conn::add_validators() {
+    char date[ 32 ];
+    return add_bytes( etag_field, sizeof( etag_field ) - 1 )
+        && ( !m_weak_etag || add_bytes( weak_prefix, sizeof( weak_prefix ) - 1 ) )
+        && add_bytes( m_io->etag, m_etag_len ) && add_bytes( crlf, 2 )
+        && add_bytes( last_modified_field, sizeof( last_modified_field ) - 1 )
+        && add_bytes( date, format_http_date( date, m_io->file_stat.st_mtime ) ) && add_bytes( crlf, 2 );
 }
+// 注意：响应正文已经在内存映射中了，无需再写到写缓冲区（数组m_io->write_buf）
 
-// 写HTTP响应报文的响应头部（不完全）
-bool http_conn::add_headers(int content_len) {
-    add_content_length(content_len);
-    add_content_type();
-    add_linger();
-    add_blank_line();
+bool http_conn::add_date() {
+    int len;
+    const char* date = date_field( &len );
+    return add_bytes( date, len );
 }
-// 注意：响应正文已经在内存映射中了，无需再写到写缓冲区（数组m_write_buf）
 
-bool http_conn::add_content_length(int content_len) {
-    return add_response( "Content-Length: %d\r\n", content_len );
+bool http_conn::add_content_length( size_t content_len ) {
+    char number[ 20 ];
+    return add_bytes( content_length_field, sizeof( content_length_field ) - 1 )
+        && add_bytes( number, format_number( number, content_len ) )
+        && add_bytes( crlf, 2 );
 }
 
 bool http_conn::add_linger()
 {
-    return add_response( "Connection: %s\r\n", ( m_linger == true ) ? "keep-alive" : "close" );
+    return add_bytes( connection_fields[ m_linger ], strlen( connection_fields[ m_linger ] ) );
 }
 
 // 添加空行
 bool http_conn::add_blank_line()
 {
-    return add_response( "%s", "\r\n" );
+    return add_bytes( crlf, 2 );
 }
 
-bool http_conn::add_content( const char* content )
-{
-    return add_response( "%s", content );
+// 添加响应内容类型，由文件扩展名决定；多个区间时是multipart/byteranges，每个部分再带文件的类型
+bool http_conn::add_content_type() {
+    if ( m_range_count > 1 ) {
+        return add_bytes( multipart_type_field, sizeof( multipart_type_field ) - 1 )
+            && add_bytes( multipart_boundary.data(), multipart_boundary.size() ) && add_bytes( crlf, 2 );
+    }
+    return add_bytes( m_mime->field, m_mime->field_len );
 }
 
-// 添加响应内容类型（不完全），这里只给出了text/html类型
-bool http_conn::add_content_type() {
-    return add_response("Content-Type:%s\r\n", "text/html");
+// Content-Range: bytes first-last/size，first为-1时是416响应中的bytes */size
+bool http_conn::add_content_range( off_t first, off_t last, off_t size ) {
+    char number[ 20 ];
+    if ( !add_bytes( content_range_field, sizeof( content_range_field ) - 1 ) ) {
+        return false;
+    }
+    if ( first < 0 ) {
+        if ( !add_bytes( "*", 1 ) ) {
+            return false;
+        }
+    } else if ( !add_bytes( number, format_number( number, first ) ) || !add_bytes( "-", 1 )
+                || !add_bytes( number, format_number( number, last ) ) ) {
+        return false;
+    }
+    return add_bytes( "/", 1 ) && add_bytes( number, format_number( number, size ) ) && add_bytes( crlf, 2 );
+}
+
+// 多个区间的正文（multipart/byteranges）：每个区间前面是分隔行和这个部分的Content-Type、Content-Range，
+// 最后是结束分隔行。各段的数组和分隔行、部分头部放在从buffer_pool借用的一块内存中（大小由区间数决定），
+// 区间本身指向内存映射或用sendfile发送。正文的总长度写入body_len，内存不足时返回false
+bool http_conn::add_multipart( response& r, size_t* body_len ) {
+    size_t part_header_max = multipart_delimiter.size() + m_mime->field_len + sizeof( content_range_field ) - 1
+        + 3 * 20 + 2 + 4;
+    int part_count = m_range_count * 2 + 1;
+    size_t size = part_count * sizeof( body_part ) + part_header_max * m_range_count + multipart_close.size();
+    body_part* parts = ( body_part* )buffer_pool::get_instance()->get( size );
+    if ( !parts ) {
+        return false;
+    }
+    r.parts = parts;
+    r.parts_size = size;
+    r.part_count = part_count;
+
+    char* q = ( char* )( parts + part_count );
+    size_t total = 0;
+    for ( int i = 0; i < m_range_count; ++i ) {
+        const byte_range& range = m_io->ranges[i];
+        char* start = q;
+        q = append_bytes( q, multipart_delimiter.data(), multipart_delimiter.size() );
+        q = append_bytes( q, m_mime->field, m_mime->field_len );
+        q = append_bytes( q, content_range_field, sizeof( content_range_field ) - 1 );
+        q += format_number( q, range.first );
+        *q++ = '-';
+        q += format_number( q, range.last );
+        *q++ = '/';
+        q += format_number( q, m_io->file_stat.st_size );
+        q = append_bytes( q, "\r\n\r\n", 4 );
+
+        body_part& h = parts[ i * 2 ];
+        h.data = start;
+        h.offset = 0;
+        h.len = q - start;
+        body_part& b = parts[ i * 2 + 1 ];
+        b.offset = range.first;
+        b.len = range.last - range.first + 1;
+        b.data = m_file_address ? m_file_address + b.offset : NULL;
+        total += h.len + b.len;
+    }
+    body_part& end = parts[ part_count - 1 ];
+    end.data = multipart_close.data();
+    end.offset = 0;
+    end.len = multipart_close.size();
+    *body_len = total + end.len;
+    return true;
+}
+
+// 可压缩类型的响应内容随Accept-Encoding变化，缓存需要知道（Vary），压缩了的再加上Content-Encoding
+bool http_conn::add_content_encoding() {
+    if ( !m_mime->compressible ) {
+        return true;
+    }
+    return add_bytes( vary_field, sizeof( vary_field ) - 1 )
+        && ( !m_gzip || add_bytes( content_encoding_gzip, sizeof( content_encoding_gzip ) - 1 ) );
 }
 
-// 根据服务器处理HTTP请求的结果，决定返回给客户端的内容
+// 根据服务器处理HTTP请求的结果，决定返回给客户端的内容，生成的响应放入响应队列
 bool http_conn::process_write(HTTP_CODE ret) {
+    int header_off = m_write_idx;
+    const std::string* rest = NULL;  // 错误响应预先生成的部分
+    response& r = m_io->responses[ m_response_count ];
+    r.file = NULL;
+    r.parts = NULL;
+    r.generated = NULL;
+    r.part_count = 1;
+    r.body.data = NULL;
+    r.body.offset = 0;
+    r.body.len = 0;
+    if ( m_draining.load( std::memory_order_relaxed ) ) {
+        m_linger = false;  // 让客户端在新进程上建立下一个连接
+    }
     // 根据不用的HTTP请求解析结果作不同的响应
     switch (ret)
     {
         case INTERNAL_ERROR:
-            add_status_line( 500, error_500_title );
-            add_headers( strlen( error_500_form ) );
-            if ( ! add_content( error_500_form ) ) {
+        case BAD_REQUEST: {
+            // 解析状态已经不可靠，无法确定下一个请求从哪里开始，发送完就关闭连接
+            m_linger = false;
+            int status = ret == BAD_REQUEST ? 400 : 500;
+            if ( !add_status_line( status ) || !add_date() ) {
                 return false;
             }
+            rest = &prebuilt_errors.get( status ).rest[ m_linger ];
             break;
-        case BAD_REQUEST:
-            add_status_line( 400, error_400_title );
-            add_headers( strlen( error_400_form ) );
-            if ( ! add_content( error_400_form ) ) {
+        }
+        case NO_RESOURCE:
+        case FORBIDDEN_REQUEST: {
+            int status = ret == NO_RESOURCE ? 404 : 403;
+            if ( !add_status_line( status ) || !add_date() ) {
                 return false;
             }
+            rest = &prebuilt_errors.get( status ).rest[ m_linger ];
             break;
-        case NO_RESOURCE:
-            add_status_line( 404, error_404_title );
-            add_headers( strlen( error_404_form ) );
-            if ( ! add_content( error_404_form ) ) {
+        }
+        case NOT_MODIFIED:
+            // 没有正文，也不带Content-Length；Vary和校验器和200响应中的一样
+            if ( !add_status_line( 304 ) || !add_date() || !add_validators()
+                    || ( m_mime->compressible && !add_bytes( vary_field, sizeof( vary_field ) - 1 ) )
+                    || !add_linger() || !add_blank_line() ) {
+                return false;
+            }
+            break;
+        case RANGE_NOT_SATISFIABLE:
+            if ( !add_status_line( 416 ) || !add_date() || !add_content_range( -1, -1, m_io->file_stat.st_size ) ) {
                 return false;
             }
+            rest = &prebuilt_errors.get( 416 ).rest[ m_linger ];
             break;
-        case FORBIDDEN_REQUEST:
-            add_status_line( 403, error_403_title );
-            add_headers(strlen( error_403_form));
-            if ( ! add_content( error_403_form ) ) {
+        case STATUS_REQUEST:
+            // 正文交给响应，发送完后释放
+            r.generated = m_generated;
+            r.body.data = m_generated;
+            r.body.len = m_body_len;
+            m_generated = NULL;
+            if ( !add_status_line( 200 ) || !add_date() || !add_content_length( m_body_len )
+                    || !add_bytes( content_type_status[ m_prometheus ], strlen( content_type_status[ m_prometheus ] ) )
+                    || !add_bytes( no_store_field, sizeof( no_store_field ) - 1 ) || !add_linger() || !add_blank_line() ) {
+                release_response( r );
                 return false;
             }
             break;
-        case FILE_REQUEST:  
+        case FILE_REQUEST: {
             // 只有获取资源成功才会有两块不连续内存
-            // 内存映射的缓存区+写缓冲区（数组m_write_buf）
-            // 将两块不连续内存封装在iovec型数组中
-            add_status_line(200, ok_200_title );
-            add_headers(m_file_stat.st_size);
-            m_iv[ 0 ].iov_base = m_write_buf;
-            m_iv[ 0 ].iov_len = m_write_idx;
-            m_iv[ 1 ].iov_base = m_file_address;
-            m_iv[ 1 ].iov_len = m_file_stat.st_size;
-            m_iv_count = 2;
-            return true;
+            // 内存映射的缓存区+写缓冲区（数组m_io->write_buf）；文件没有映射（大文件/sendfile模式）时正文由write()用sendfile发送
+            // 有Range时只发送请求的区间
+            size_t body_len = m_body_len;
+            r.body.data = m_file_address;
+            r.body.len = m_body_len;
+            if ( m_range_count == 1 ) {
+                r.body.offset = m_io->ranges[0].first;
+                r.body.len = body_len = m_io->ranges[0].last - m_io->ranges[0].first + 1;
+                r.body.data = m_file_address ? m_file_address + r.body.offset : NULL;
+            } else if ( m_range_count > 1 && !add_multipart( r, &body_len ) ) {
+                return false;
+            }
+            if ( !add_status_line( m_range_count > 0 ? 206 : 200 ) || !add_headers( body_len ) ) {
+                release_response( r );
+                return false;
+            }
+            break;
+        }
         default:
             return false;
     }
 
-    m_iv[ 0 ].iov_base = m_write_buf;
-    m_iv[ 0 ].iov_len = m_write_idx;
-    m_iv_count = 1;
+    ++m_response_count;
+    r.status = m_status;
+    r.linger = m_linger;
+    r.url = m_url;
+    r.version = m_version;
+    r.start_time = m_start_time;
+    r.header_off = header_off;
+    r.header_len = m_write_idx - header_off;
+    r.bytes = r.header_len;
+    r.sent = 0;
+    if ( rest ) {
+        r.body.data = rest->data();
+        r.body.len = rest->size();
+    } else if ( ret == FILE_REQUEST ) {
+        // 文件缓存条目的引用交给响应，发送完后释放
+        r.file = m_file;
+        m_file = NULL;
+        m_file_address = NULL;
+    }
+    for ( int i = 0; i < r.part_count; ++i ) {
+        r.bytes += r.part( i ).len;
+    }
     return true;
 }
 
 // 由线程池中的工作线程调用，这是处理HTTP请求的入口函数
 void http_conn::process() {
-    // 由线程处理业务逻辑
-    // 解析HTTP请求：使用有限状态机
-    HTTP_CODE read_ret = process_read(); // 解析HTTP请求的结果
-    // 解析的流程：
-
-    // 如果解析结果是请求不完整，继续获取客户端数据
-    if ( read_ret == NO_REQUEST ) {
-        modfd( m_epollfd, m_sockfd, EPOLLIN );  
-        // 要继续检测该文件描述符的读事件（这个进程也算完成了对该http_conn对象的客户请求读任务，还没读完的任务就交给下一个进程）
-        return;
+    if ( tracer::m_enabled ) {
+        m_worker_time = timer_now_ns();
+    }
+    do_process();
+    leave_worker();  // 之后定时器才可以关闭这个连接
+}
+
+void http_conn::do_process() {
+    // Reactor模式：主线程只通知了socket就绪，由工作线程自己完成读写
+    if ( m_actor_model == REACTOR ) {
+        if ( m_io_state == IO_WRITE ) {
+            if ( !write() ) {
+                close_conn();
+                return;
+            }
+            if ( !has_pending_input() ) {
+                return;
+            }
+        } else if ( !read() ) {
+            close_conn();
+            return;
+        }
+    }
+
+    while ( true ) {
+        // 由线程处理业务逻辑
+        if ( !parse_requests() ) {
+            close_conn();
+            return;
+        }
+
+        if ( m_response_count == 0 ) {
+            modfd( m_epollfd, m_sockfd, EPOLLIN, m_conn_trig_mode == ET );
+            // 要继续检测该文件描述符的读事件（这个进程也算完成了对该http_conn对象的客户请求读任务，还没读完的任务就交给下一个进程）
+            return;
+        }
+
+        if ( m_actor_model != REACTOR ) {
+            // 响应数据准备好后，修改该文件描述符的检测信息：检测写事件
+            modfd( m_epollfd, m_sockfd, EPOLLOUT, m_conn_trig_mode == ET );  // 缓冲区有空闲就会触发写事件
+            return;
+        }
+
+        // Reactor模式：直接在工作线程中发送，发不完（EAGAIN）时write()会注册EPOLLOUT，由下一个写事件继续
+        if ( !write() ) {
+            close_conn();
+            return;
+        }
+        if ( !has_pending_input() ) {
+            return;
+        }
     }
+}
 
-    // 生成响应：把响应数据准备好，以便主线程下次检测到写事件时进行处理（发回给客户端）
-    // 根据HTTP请求的解析结果生成响应，不同结果不同响应
-    bool write_ret = process_write( read_ret );  
-    if ( !write_ret ) {
-        // 响应数据没有成功准备，为什么要关闭连接？？
-        close_conn();
+// 解析HTTP请求：使用有限状态机。一次读到的数据中可能有多个请求（流水线），
+// 依次解析并把响应放入队列，直到数据不够一个完整请求、队列或写缓冲区满、或者要关闭连接
+bool http_conn::parse_requests() {
+    if ( !attach_io() ) {
+        return false;
+    }
+    while ( m_response_count < MAX_PIPELINE && WRITE_BUFFER_SIZE - m_write_idx >= RESPONSE_RESERVE ) {
+        long begin = timer_now_ns();
+        request_trace* trace = m_traces ? &m_traces[ m_response_count ] : NULL;
+        if ( trace ) {
+            memset( trace, 0, sizeof( *trace ) );
+            trace->stamp[ TRACE_RECV ] = m_start_time;
+            trace->stamp[ TRACE_QUEUE ] = m_queue_time;
+            trace->stamp[ TRACE_WORKER ] = m_worker_time;
+            trace->stamp[ TRACE_PARSE ] = begin;
+        }
+        HTTP_CODE read_ret = process_read(); // 解析HTTP请求的结果
+        if ( read_ret == NO_REQUEST ) {
+            break;  // 请求不完整，继续获取客户端数据
+        }
+        if ( trace ) {
+            trace->stamp[ TRACE_RESPONSE ] = timer_now_ns();
+        }
+        // 生成响应：把响应数据准备好，以便主线程下次检测到写事件时进行处理（发回给客户端）
+        if ( !process_write( read_ret ) ) {
+            return false;
+        }
+        long end = timer_now_ns();
+        metrics::get_instance()->add_parse( end - begin );
+        if ( trace ) {
+            trace->stamp[ TRACE_SEND ] = end;
+        }
+        if ( !m_linger ) {
+            break;  // 这个响应发送完就关闭连接，后面的请求不再处理
+        }
+        init_request();
+    }
+    if ( m_response_count > 0 ) {
+        set_timeout( TIMEOUT_IDLE );  // 请求已完整，开始计算生成和发送响应的无活动超时
     }
-    // 响应数据准备好后，修改该文件描述符的检测信息：检测写事件
-    modfd( m_epollfd, m_sockfd, EPOLLOUT);  // 缓冲区有空闲就会触发写事件
-    // 
-}
\ No newline at end of file
+    return true;
+}
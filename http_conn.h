@@ -19,14 +19,30 @@
 #include <stdarg.h>
 #include <errno.h>
 #include "locker.h"
+#include "file_cache.h"
+#include "buffer.h"
+#include "scanner.h"
+#include "http_header.h"
+#include "mime.h"
+#include "trace.h"
+#include "timer_wheel.h"
+#include "range.h"
+#include <atomic>
 #include <sys/uio.h>
+#include <sys/sendfile.h>
+
+class event_loop;
 
 class http_conn
 {
 public:
     static const int FILENAME_LEN = 200;
-    static const int READ_BUFFER_SIZE = 2048;
-    static const int WRITE_BUFFER_SIZE = 1024;
+    static const int WRITE_BUFFER_SIZE = 4096;
+    static const int MAX_PIPELINE = 16;         // 一个连接上最多同时排队等待发送的响应数
+    static const int MAX_HEADERS = 32;          // 一个请求最多保存的头部个数，更多的只处理已知头部、不保存
+    static const int RESPONSE_RESERVE = 512;    // 写缓冲区剩余空间少于它时不再解析下一个请求（一个响应头的最大长度）
+    static const int MAX_RANGES = 16;           // Range头部最多接受的区间数，更多时忽略Range、发送整个文件
+    static const int MAX_IOV = 64;              // 一次sendmsg最多的分段数
     
 
     enum METHOD {GET = 0, POST, HEAD, PUT, DELETE, TRACE, OPTIONS, CONNECT};
@@ -36,21 +52,126 @@ public:
 
     enum LINE_STATUS { LINE_OK = 0, LINE_BAD, LINE_OPEN };
 
-    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, INTERNAL_ERROR, CLOSED_CONNECTION };
+    // 并发模式：模拟Proactor（主线程读写socket，工作线程只解析和生成响应）；Reactor（主线程只分发就绪事件，工作线程自己读写）
+    enum ACTOR_MODEL { PROACTOR = 0, REACTOR };
+
+    // epoll触发模式：水平触发/边沿触发
+    enum TRIG_MODE { LT = 0, ET };
+
+    // Reactor模式下交给工作线程的事件类型
+    enum IO_STATE { IO_READ = 0, IO_WRITE };
+
+    // 连接超时的种类：读请求超时（从请求的第一个字节开始计时，慢速发送不会续期）、
+    // 处理/发送响应时无活动超时、长连接等待下一个请求超时
+    enum TIMEOUT_KIND { TIMEOUT_HEADER = 0, TIMEOUT_IDLE, TIMEOUT_KEEPALIVE, TIMEOUT_KIND_NUMBER };
+
+    enum HTTP_CODE { NO_REQUEST, GET_REQUEST, BAD_REQUEST, NO_RESOURCE, FORBIDDEN_REQUEST, FILE_REQUEST, NOT_MODIFIED, RANGE_NOT_SATISFIABLE, INTERNAL_ERROR, STATUS_REQUEST, CLOSED_CONNECTION };
     
 
 
 public:
-    http_conn(){}
+    http_conn() : m_sockfd( -1 ), m_epollfd( -1 ), m_loop( NULL ), m_timer_gen( 0 ), m_deadline( 0 ),
+                  m_timeout_kind( TIMEOUT_HEADER ), m_busy( 0 ), m_io( NULL ), m_file( NULL ), m_file_address( NULL ),
+                  m_generated( NULL ), m_response_head( 0 ), m_response_count( 0 ), m_traces( NULL ),
+                  m_queue_time( 0 ), m_worker_time( 0 ) {}
     ~http_conn(){}
 public:
-    void init(int sockfd, const sockaddr_in& addr);
+    void init(int sockfd, const sockaddr_in& addr, event_loop* loop);
     void close_conn();
     void process();
     bool read();
     bool write();
+    void set_io_state( IO_STATE state ) { m_io_state = state; }
+    // 所有响应都已发送，读缓冲区中还有没有解析的数据（流水线中后面的请求），需要再交给工作线程解析
+    bool has_pending_input() const { return m_response_count == 0 && m_checked_idx < ( int )m_read_buf.size(); }
+    bool has_pending_output() const { return m_response_head < m_response_count; }
+
+    // 以下由io_uring事件循环使用：读写由循环提交给内核，完成后再交给连接，解析和生成响应与epoll方式相同
+    // 把recv收到的数据追加到读缓冲区，超过一个请求的最大字节数时返回false
+    bool feed( const char* data, size_t len );
+    // 解析读缓冲区中的请求，生成的响应放入队列；返回false时调用者关闭连接
+    bool parse_requests();
+    // 把队列中待发送的数据填入io_block中的msghdr（提交后到完成前内核还要读取正文）；
+    // then_read为true表示这些数据发送完后连接只需等待下一个请求，可以把recv链接在sendmsg后面
+    struct msghdr* prepare_send( bool* then_read );
+    // sendmsg完成了bytes个字节；返回false时调用者关闭连接
+    bool complete_send( size_t bytes );
+
+    // 以下由事件循环的定时器使用：到期时间只是一个原子变量，任何线程续期都是O(1)，
+    // 时间轮在到期时再比较，没有真正到期就按新的到期时间重新放回
+    bool is_open() const { return m_sockfd != -1; }
+    unsigned get_timer_gen() const { return m_timer_gen.load( std::memory_order_acquire ); }
+    long get_deadline() const { return m_deadline.load( std::memory_order_relaxed ); }
+    int get_timeout_kind() const { return m_timeout_kind.load( std::memory_order_relaxed ); }
+    // 事件循环把连接交给工作线程前调用，工作线程处理完后计数减一；计数不为0时定时器不能关闭连接
+    void enter_worker() {
+        m_busy.fetch_add( 1, std::memory_order_relaxed );
+        if ( tracer::m_enabled ) {
+            m_queue_time = timer_now_ns();
+        }
+    }
+    void leave_worker() { m_busy.fetch_sub( 1, std::memory_order_release ); }
+    bool is_busy() const { return m_busy.load( std::memory_order_acquire ) != 0; }
+private:
+    // 一个请求头部：字段名和值在读缓冲区中的偏移和长度（值已去掉前后空白，以'\0'结尾）
+    struct header_view {
+        int name;
+        int name_len;
+        int value;
+        int value_len;
+    };
+
+    // 响应正文的一段：内存中的数据，或者（data为NULL时）用sendfile发送的文件中从offset开始的len个字节
+    struct body_part {
+        const char* data;
+        off_t offset;
+        size_t len;
+    };
+
+    // 流水线中已经生成、按顺序等待发送的一个响应
+    struct response {
+        int status;
+        bool linger;            // 发送完后是否保持连接
+        int url;                // 在读缓冲区中的偏移，队列中的响应全部发送完之前不整理读缓冲区
+        int version;
+        long start_time;        // 开始接收请求的时间（timer_now_ns()）
+        int header_off;         // 写缓冲区中的响应头（错误响应只有状态行和Date）的位置和长度
+        int header_len;
+        file_entry* file;       // 正文文件，没有正文时为NULL
+        body_part body;         // 只有一段的正文：文件（或其中一个区间）、预先生成的错误响应
+        body_part* parts;       // multipart/byteranges的各段（分隔行和各区间交替），其他响应为NULL
+        size_t parts_size;      // parts所在的buffer_pool块（后面接着分隔行和各部分头部）的大小
+        char* generated;        // 内存中生成的正文（/status），new出来的，发送完后释放
+        int part_count;
+        size_t bytes;           // 响应的总字节数
+        size_t sent;            // 已经发送的字节数
+
+        body_part& part( int i ) { return parts ? parts[i] : body; }
+    };
+
+    // 只在处理请求、发送响应期间才需要的状态：从buffer_pool借用，连接空闲（没有未处理的数据、没有待发送的响应）时归还，
+    // 空闲的长连接只占用http_conn本身
+    struct io_block {
+        header_view headers[ MAX_HEADERS ];     // 头部表：按出现顺序保存（不复制）
+        byte_range ranges[ MAX_RANGES ];        // Range请求的区间（已按文件大小截断），个数为m_range_count
+        char real_file[ FILENAME_LEN ];
+        struct stat file_stat;                  // 请求的原文件的状态
+        char etag[ 64 ];                        // 原文件的强ETag（带引号），由inode、大小和修改时间生成；gzip编码的响应发送弱ETag W/"..."
+        // 响应队列：m_response_head之前的已经发送完，一次sendmsg尽可能多地发送队列中的响应
+        response responses[ MAX_PIPELINE ];
+        char write_buf[ WRITE_BUFFER_SIZE ];
+        // io_uring的sendmsg从提交到完成一直使用的分段
+        struct iovec iov[ MAX_IOV ];
+        struct msghdr msg;
+    };
+
 private:
     void init();
+    void init_request();
+    bool attach_io();
+    void detach_io();
+    void do_process();
+    void set_timeout( TIMEOUT_KIND kind );
     HTTP_CODE process_read();
     bool process_write( HTTP_CODE ret );
 
@@ -58,62 +179,123 @@ private:
 
     HTTP_CODE parse_request_line( char* text );
     HTTP_CODE parse_headers( char* text );
-    HTTP_CODE parse_content( char* text );
+    HTTP_CODE parse_content();
     HTTP_CODE do_request();
+    bool gzip_selected( bool gzip_file );
+    void use_gzip();
+    int parse_range();
+    void make_etag();
+    bool not_modified();
+    bool if_range_matches( const char* value );
 
 
     LINE_STATUS parse_line();
 
-    char* get_line() { return m_read_buf + m_start_line; }
+    char* get_line() { return m_read_buf.data() + m_start_line; }
+    // 读缓冲区中偏移off处的字符串，off为-1时返回NULL
+    char* get_text( int off ) { return off < 0 ? NULL : m_read_buf.data() + off; }
+    // 当前请求中已知头部的值（id为HEADER_ID），没有这个头部时返回NULL；O(1)，不扫描头部表
+    const char* get_header( int id, int* len = NULL );
     
 
 
     void unmap();
-    bool add_response( const char* format, ... );
-    bool add_content( const char* content );
+    int gather_responses( struct iovec* iv, bool* more );
+    ssize_t send_responses();
+    void advance_responses( size_t bytes );
+    body_part* file_part_at( response& r, size_t* start );
+    size_t memory_end( response& r );
+    bool pop_responses();
+    void finish_write();
+    void finish_response( response& r );
+    void release_response( response& r );
+    bool add_multipart( response& r, size_t* body_len );
+    void compact_read_buf();
+    void record_response( const response& r );
+    bool add_bytes( const char* data, int len );
     bool add_content_type();
-    bool add_status_line( int status, const char* title );
-    bool add_headers( int content_length );
-    bool add_content_length( int content_length );
+    bool add_content_encoding();
+    bool add_content_range( off_t first, off_t last, off_t size );
+    bool add_validators();
+    bool add_status_line( int status );
+    bool add_headers( size_t content_length );
+    bool add_date();
+    bool add_content_length( size_t content_length );
     bool add_linger();
     bool add_blank_line();
 
 public:
-    static int m_epollfd;
-    static int m_user_count;
+    static int m_actor_model;
+    static int m_conn_trig_mode;
+    // 三种超时的时长，单位毫秒
+    static int m_timeout[ TIMEOUT_KIND_NUMBER ];
+    // 读缓冲区的上限，即一个请求（请求行+头部+请求体）的最大字节数
+    static int m_max_request_size;
+    // 监控指标的URL（加上?format=prometheus时为Prometheus格式），NULL表示不提供
+    static const char* m_status_url;
+    // 进程正在排空（热重启后由新进程接受连接）：之后的响应都不保持连接
+    static std::atomic< bool > m_draining;
 
 private:
 
     int m_sockfd; 
+    int m_epollfd;          // 连接所属事件循环的epoll实例
+    event_loop* m_loop;     // 接受这个连接的事件循环
+    IO_STATE m_io_state;    // Reactor模式：工作线程要处理的是读事件还是写事件
+
+    std::atomic< unsigned > m_timer_gen;    // 每次建立新连接加一，时间轮中旧连接留下的项随之作废
+    std::atomic< long > m_deadline;         // 到期时间（timer_now_ms()）
+    std::atomic< int > m_timeout_kind;
+    std::atomic< int > m_busy;              // 正在（或等待）被工作线程处理的次数
 
     sockaddr_in m_address;
     
-    char m_read_buf[ READ_BUFFER_SIZE ];
-    int m_read_idx;
+    buffer m_read_buf;      // 读缓冲区，按需增长；解析器只保存偏移量
     
     int m_checked_idx;
     int m_start_line;
+    int m_request_start;    // 当前请求在读缓冲区中的起始位置
+    line_scan m_line;       // 当前行中冒号和空白的位置（相对行首），由parse_line()扫描时记下
 
     CHECK_STATE m_check_state;
 
-    char m_real_file[ FILENAME_LEN ];
-   
 
     METHOD m_method;
-    char* m_url;
-    char* m_version;
+    // 请求行在读缓冲区中的偏移（缓冲区扩容后地址会变），-1表示没有
+    int m_url;
+    int m_version;
     
 
-    char* m_host;
-    int m_content_length;
+    // m_known_headers记录每个已知头部第一次出现在头部表中的位置，没有为-1
+    int m_header_count;
+    int8_t m_known_headers[ HEADER_KNOWN_NUMBER ];
+    long m_content_length;
     bool m_linger;
 
-    char m_write_buf[ WRITE_BUFFER_SIZE ];
+    int m_status;               // 响应状态码
+    long m_start_time;          // 开始接收这个请求的时间（timer_now_ns()）
+
+    io_block* m_io;             // 正在处理请求或发送响应时才有，否则为NULL
     int m_write_idx;
-    char* m_file_address;
-    struct stat m_file_stat;
-    struct iovec m_iv[2];
-    int m_iv_count;
+    file_entry* m_file;         // 从文件缓存中获取的文件，生成响应后交给队列中的响应，发送完后释放
+    char* m_file_address;       // 内存中的正文：文件的内存映射或gzip压缩结果，NULL时用sendfile发送m_file
+    size_t m_body_len;          // 正文字节数（压缩后的大小）
+    const mime_type* m_mime;
+    bool m_gzip;                // 正文是gzip编码的（预压缩文件或内存中的压缩结果）
+    bool m_weak_etag;           // 选择了gzip编码（只由元数据决定，正文可能仍是原文件），ETag是弱的
+    int m_etag_len;
+    int m_range_count;          // 没有Range时为0
+    char* m_generated;          // 监控指标请求生成的正文（长度为m_body_len），生成响应后交给队列中的响应
+    bool m_prometheus;
+
+    int m_response_head;
+    int m_response_count;
+
+    // 开启-T时各请求的阶段时间，和io_block一起借用，下标与响应队列相同；
+    // 最近一次交给线程池、被工作线程取出的时间
+    request_trace* m_traces;
+    long m_queue_time;
+    long m_worker_time;
 };
 
 #endif
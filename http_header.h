@@ -0,0 +1,110 @@
+#ifndef HTTP_HEADER_H
+#define HTTP_HEADER_H
+
+#include <stdint.h>
+
+// 需要识别的请求头部，顺序必须和known_headers一致
+enum HEADER_ID {
+    HEADER_HOST = 0, HEADER_CONNECTION, HEADER_CONTENT_LENGTH, HEADER_TRANSFER_ENCODING,
+    HEADER_ACCEPT, HEADER_ACCEPT_ENCODING, HEADER_USER_AGENT, HEADER_COOKIE, HEADER_REFERER,
+    HEADER_RANGE, HEADER_IF_RANGE, HEADER_IF_NONE_MATCH, HEADER_IF_MODIFIED_SINCE, HEADER_EXPECT,
+    HEADER_KNOWN_NUMBER
+};
+
+struct header_name {
+    const char* name;   // 小写
+    int len;
+};
+
+constexpr header_name known_headers[ HEADER_KNOWN_NUMBER ] = {
+    { "host", 4 }, { "connection", 10 }, { "content-length", 14 }, { "transfer-encoding", 17 },
+    { "accept", 6 }, { "accept-encoding", 15 }, { "user-agent", 10 }, { "cookie", 6 }, { "referer", 7 },
+    { "range", 5 }, { "if-range", 8 }, { "if-none-match", 13 }, { "if-modified-since", 17 }, { "expect", 6 },
+};
+
+// known_headers中写的长度必须和名字一致
+constexpr bool header_names_ok() {
+    for ( int i = 0; i < HEADER_KNOWN_NUMBER; ++i ) {
+        int len = 0;
+        while ( known_headers[i].name[ len ] ) {
+            ++len;
+        }
+        if ( len != known_headers[i].len ) {
+            return false;
+        }
+    }
+    return true;
+}
+static_assert( header_names_ok(), "known_headers: wrong name length" );
+
+constexpr char header_lower( char c ) {
+    return ( c >= 'A' && c <= 'Z' ) ? c + ( 'a' - 'A' ) : c;
+}
+
+// 字段名转小写后的FNV-1a哈希，seed不同得到不同的哈希函数
+constexpr uint32_t header_hash( const char* name, int len, uint32_t seed ) {
+    uint32_t h = seed;
+    for ( int i = 0; i < len; ++i ) {
+        h = ( h ^ ( uint8_t )header_lower( name[i] ) ) * 16777619u;
+    }
+    return h;
+}
+
+// 完美哈希：编译期从FNV的初始值开始找一个seed，使所有已知头部落到不同的槽里，
+// 运行时一次哈希+一次比较就能判断一个字段名是哪个已知头部
+constexpr int HEADER_SLOT_NUMBER = 64;
+
+constexpr bool header_seed_ok( uint32_t seed ) {
+    bool used[ HEADER_SLOT_NUMBER ] = {};
+    for ( int i = 0; i < HEADER_KNOWN_NUMBER; ++i ) {
+        uint32_t slot = header_hash( known_headers[i].name, known_headers[i].len, seed ) % HEADER_SLOT_NUMBER;
+        if ( used[ slot ] ) {
+            return false;
+        }
+        used[ slot ] = true;
+    }
+    return true;
+}
+
+constexpr uint32_t header_find_seed() {
+    uint32_t seed = 2166136261u;
+    while ( !header_seed_ok( seed ) ) {
+        ++seed;
+    }
+    return seed;
+}
+
+constexpr uint32_t HEADER_SEED = header_find_seed();
+
+struct header_slots {
+    int8_t id[ HEADER_SLOT_NUMBER ];    // 槽对应的HEADER_ID，空槽为-1
+};
+
+constexpr header_slots header_build_slots() {
+    header_slots slots = {};
+    for ( int i = 0; i < HEADER_SLOT_NUMBER; ++i ) {
+        slots.id[i] = -1;
+    }
+    for ( int i = 0; i < HEADER_KNOWN_NUMBER; ++i ) {
+        slots.id[ header_hash( known_headers[i].name, known_headers[i].len, HEADER_SEED ) % HEADER_SLOT_NUMBER ] = i;
+    }
+    return slots;
+}
+
+constexpr header_slots HEADER_SLOTS = header_build_slots();
+
+// 字段名（不区分大小写）对应的HEADER_ID，不是已知头部时返回-1
+inline int header_lookup( const char* name, int len ) {
+    int id = HEADER_SLOTS.id[ header_hash( name, len, HEADER_SEED ) % HEADER_SLOT_NUMBER ];
+    if ( id < 0 || known_headers[ id ].len != len ) {
+        return -1;
+    }
+    for ( int i = 0; i < len; ++i ) {
+        if ( header_lower( name[i] ) != known_headers[ id ].name[i] ) {
+            return -1;
+        }
+    }
+    return id;
+}
+
+#endif
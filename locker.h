@@ -4,6 +4,11 @@
 #include <exception>
 #include <pthread.h>
 #include <semaphore.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <atomic>
 
 
 class locker {
@@ -121,4 +126,44 @@ private:
     sem_t m_sem;
 };
 
+
+
+// 自旋等待时告诉CPU正在忙等，降低功耗并让出超线程的执行资源
+inline void cpu_relax() {
+#if defined( __x86_64__ ) || defined( __i386__ )
+    __builtin_ia32_pause();
+#else
+    __asm__ __volatile__( "" ::: "memory" );
+#endif
+}
+
+
+// futex等待/唤醒，给无锁结构做空闲等待：只有空闲时才陷入内核，忙时没有任何系统调用
+class futex {
+public:
+    futex() : m_word( 0 ) {}
+
+    unsigned value() const {
+        return m_word.load( std::memory_order_seq_cst );
+    }
+
+    // 值仍等于val时睡眠，直到notify()；在读取val之后发生的notify()不会丢失
+    void wait( unsigned val ) {
+        syscall( SYS_futex, &m_word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0 );
+    }
+
+    // 改变值并唤醒最多n个等待者
+    void notify( int n ) {
+        m_word.fetch_add( 1, std::memory_order_seq_cst );
+        syscall( SYS_futex, &m_word, FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0 );
+    }
+
+    void notify_all() {
+        notify( INT_MAX );
+    }
+
+private:
+    std::atomic< unsigned > m_word;
+};
+
 #endif
\ No newline at end of file
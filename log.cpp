@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+#include <sys/time.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include "log.h"
+
+// 每个线程每个通道的缓冲区大小、单条日志的最大长度、后台线程空闲时的等待时间
+static const size_t LOG_RING_SIZE = 256 * 1024;
+static const int LOG_LINE_MAX = 1024;
+static const int LOG_FLUSH_INTERVAL_US = 20000;
+static const int LOG_MAX_IOV = 512;
+
+static const char* level_names[] = { "DEBUG", "INFO ", "WARN ", "ERROR" };
+
+int logger::m_level = LOG_LEVEL_INFO;
+bool logger::m_access_enabled = false;
+
+// 当前线程的缓冲区和时间前缀（同一秒内只格式化一次日期）
+static thread_local log_ring* t_rings[ logger::CHANNEL_NUMBER ];
+static thread_local time_t t_last_sec = -1;
+static thread_local char t_time_str[ 32 ];
+static thread_local long t_tid = 0;
+
+log_ring::log_ring( size_t size ) : head( 0 ), tail( 0 ), dropped( 0 ) {
+    buf = new char[ size ];
+    mask = size - 1;
+}
+
+log_ring::~log_ring() {
+    delete [] buf;
+}
+
+bool log_ring::push( const char* data, size_t len ) {
+    size_t h = head.load( std::memory_order_relaxed );
+    size_t t = tail.load( std::memory_order_acquire );
+    if( mask + 1 - ( h - t ) < len ) {
+        dropped.fetch_add( 1, std::memory_order_relaxed );
+        return false;
+    }
+    size_t pos = h & mask;
+    size_t first = len < mask + 1 - pos ? len : mask + 1 - pos;
+    memcpy( buf + pos, data, first );
+    memcpy( buf, data + first, len - first );
+    head.store( h + len, std::memory_order_release );
+    return true;
+}
+
+logger::logger() : m_max_file_size( 0 ), m_running( false ), m_stop( false ), m_flush_seq( 0 ) {
+    for( int i = 0; i < CHANNEL_NUMBER; ++i ) {
+        m_channels[i].fd = i == CHANNEL_SERVER ? STDOUT_FILENO : -1;
+        m_channels[i].size = 0;
+        m_channels[i].day = 0;
+        m_channels[i].index = 0;
+    }
+}
+
+logger::~logger() {
+    if( m_running ) {
+        m_stop = true;
+        pthread_join( m_thread, NULL );
+        drain();
+    }
+    for( int i = 0; i < CHANNEL_NUMBER; ++i ) {
+        if( m_channels[i].fd > STDERR_FILENO ) {
+            close( m_channels[i].fd );
+            m_channels[i].fd = -1;
+        }
+    }
+}
+
+void logger::stop() {
+    if( m_running ) {
+        m_stop = true;
+        pthread_join( m_thread, NULL );
+        drain();
+        m_running = false;  // 之后的日志直接写
+    }
+    for( int i = 0; i < CHANNEL_NUMBER; ++i ) {
+        for( size_t k = 0; k < m_rings[i].size(); ++k ) {
+            delete m_rings[i][k];
+        }
+        m_rings[i].clear();
+    }
+}
+
+// 当天的日期，如20211016
+static int today( time_t now ) {
+    struct tm tm;
+    localtime_r( &now, &tm );
+    return ( tm.tm_year + 1900 ) * 10000 + ( tm.tm_mon + 1 ) * 100 + tm.tm_mday;
+}
+
+bool logger::init( const char* server_log, const char* access_log, int level, size_t max_file_size ) {
+    m_level = level;
+    m_max_file_size = max_file_size;
+
+    const char* prefixes[ CHANNEL_NUMBER ] = { server_log, access_log };
+    int day = today( time( NULL ) );
+    for( int i = 0; i < CHANNEL_NUMBER; ++i ) {
+        if( !prefixes[i] ) {
+            continue;
+        }
+        m_channels[i].prefix = prefixes[i];
+        rotate( m_channels[i], day );
+        if( m_channels[i].fd < 0 ) {
+            return false;
+        }
+    }
+    m_access_enabled = access_log != NULL;
+
+    if( pthread_create( &m_thread, NULL, worker, this ) != 0 ) {
+        return false;
+    }
+    m_running = true;
+    return true;
+}
+
+// 关闭当前文件，打开新文件：日期变了从0开始编号，否则（文件太大）编号加一
+void logger::rotate( channel& ch, int day ) {
+    if( ch.fd >= 0 ) {
+        close( ch.fd );
+    }
+    ch.index = ( day == ch.day ) ? ch.index + 1 : 0;
+    ch.day = day;
+
+    char name[ PATH_MAX ];
+    if( ch.index == 0 ) {
+        snprintf( name, sizeof( name ), "%s-%04d-%02d-%02d.log", ch.prefix.c_str(), day / 10000, day / 100 % 100, day % 100 );
+    } else {
+        snprintf( name, sizeof( name ), "%s-%04d-%02d-%02d.%d.log", ch.prefix.c_str(), day / 10000, day / 100 % 100, day % 100, ch.index );
+    }
+    ch.fd = open( name, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644 );
+    ch.size = 0;
+    struct stat st;
+    if( ch.fd >= 0 && fstat( ch.fd, &st ) == 0 ) {
+        ch.size = st.st_size;
+    }
+}
+
+log_ring* logger::get_ring( int channel ) {
+    log_ring* ring = t_rings[ channel ];
+    if( !ring ) {
+        ring = new log_ring( LOG_RING_SIZE );
+        m_rings_lock.lock();
+        m_rings[ channel ].push_back( ring );
+        m_rings_lock.unlock();
+        t_rings[ channel ] = ring;
+    }
+    return ring;
+}
+
+void logger::append( int channel, const char* data, size_t len ) {
+    if( !m_running ) {
+        // 后台线程还没启动（或没有初始化）时直接写
+        if( m_channels[ channel ].fd >= 0 ) {
+            ssize_t ret = ::write( m_channels[ channel ].fd, data, len );
+            ( void )ret;
+        }
+        return;
+    }
+    get_ring( channel )->push( data, len );
+}
+
+void logger::write_log( int level, const char* format, ... ) {
+    char buf[ LOG_LINE_MAX ];
+
+    struct timeval tv;
+    gettimeofday( &tv, NULL );
+    if( tv.tv_sec != t_last_sec ) {
+        struct tm tm;
+        localtime_r( &tv.tv_sec, &tm );
+        strftime( t_time_str, sizeof( t_time_str ), "%Y-%m-%d %H:%M:%S", &tm );
+        t_last_sec = tv.tv_sec;
+    }
+    if( t_tid == 0 ) {
+        t_tid = syscall( SYS_gettid );
+    }
+
+    int n = snprintf( buf, sizeof( buf ), "%s.%06ld %s [%ld] ", t_time_str, (long)tv.tv_usec, level_names[ level ], t_tid );
+
+    va_list arg_list;
+    va_start( arg_list, format );
+    int len = vsnprintf( buf + n, sizeof( buf ) - n - 1, format, arg_list );
+    va_end( arg_list );
+    if( len < 0 ) {
+        return;
+    }
+    n += len < (int)sizeof( buf ) - n - 1 ? len : (int)sizeof( buf ) - n - 2;
+    buf[ n++ ] = '\n';
+
+    append( CHANNEL_SERVER, buf, n );
+}
+
+void logger::write_access( const char* format, ... ) {
+    char buf[ LOG_LINE_MAX ];
+
+    va_list arg_list;
+    va_start( arg_list, format );
+    int n = vsnprintf( buf, sizeof( buf ) - 1, format, arg_list );
+    va_end( arg_list );
+    if( n < 0 ) {
+        return;
+    }
+    if( n > (int)sizeof( buf ) - 2 ) {
+        n = sizeof( buf ) - 2;
+    }
+    buf[ n++ ] = '\n';
+
+    append( CHANNEL_ACCESS, buf, n );
+}
+
+void logger::flush() {
+    if( !m_running ) {
+        return;
+    }
+    // 等后台线程完整地跑完一轮：调用之前写入缓冲区的日志都已写到文件
+    unsigned long seq = m_flush_seq.load();
+    while( m_flush_seq.load() < seq + 2 ) {
+        usleep( 1000 );
+    }
+}
+
+unsigned long logger::dropped() {
+    unsigned long ret = 0;
+    m_rings_lock.lock();
+    for( int i = 0; i < CHANNEL_NUMBER; ++i ) {
+        for( size_t j = 0; j < m_rings[i].size(); ++j ) {
+            ret += m_rings[i][j]->dropped.load( std::memory_order_relaxed );
+        }
+    }
+    m_rings_lock.unlock();
+    return ret;
+}
+
+void* logger::worker( void* arg ) {
+    logger* log = ( logger* )arg;
+    log->run();
+    return log;
+}
+
+void logger::run() {
+    while( !m_stop ) {
+        bool wrote = drain();
+        m_flush_seq.fetch_add( 1 );
+        if( !wrote ) {
+            usleep( LOG_FLUSH_INTERVAL_US );
+        }
+    }
+}
+
+// 把每个通道所有线程缓冲区中的数据用一次writev写出，返回是否写了数据
+bool logger::drain() {
+    bool wrote = false;
+    int day = -1;
+
+    for( int c = 0; c < CHANNEL_NUMBER; ++c ) {
+        channel& ch = m_channels[c];
+
+        m_rings_lock.lock();
+        std::vector< log_ring* > rings = m_rings[c];
+        m_rings_lock.unlock();
+
+        for( size_t first = 0; first < rings.size(); first += LOG_MAX_IOV / 2 ) {
+            size_t last = first + LOG_MAX_IOV / 2 < rings.size() ? first + LOG_MAX_IOV / 2 : rings.size();
+
+            struct iovec iv[ LOG_MAX_IOV ];
+            size_t avail[ LOG_MAX_IOV / 2 ];
+            int count = 0;
+            size_t total = 0;
+            for( size_t i = first; i < last; ++i ) {
+                log_ring* ring = rings[i];
+                size_t t = ring->tail.load( std::memory_order_relaxed );
+                size_t n = ring->head.load( std::memory_order_acquire ) - t;
+                avail[ i - first ] = n;
+                if( n == 0 ) {
+                    continue;
+                }
+                size_t pos = t & ring->mask;
+                size_t part = n < ring->mask + 1 - pos ? n : ring->mask + 1 - pos;
+                iv[ count ].iov_base = ring->buf + pos;
+                iv[ count++ ].iov_len = part;
+                if( part < n ) {
+                    iv[ count ].iov_base = ring->buf;
+                    iv[ count++ ].iov_len = n - part;
+                }
+                total += n;
+            }
+            if( total == 0 ) {
+                continue;
+            }
+
+            if( !ch.prefix.empty() ) {
+                if( day < 0 ) {
+                    day = today( time( NULL ) );
+                }
+                if( day != ch.day || ch.size >= m_max_file_size ) {
+                    rotate( ch, day );
+                }
+            }
+
+            // 只写出了一部分时从断开的地方接着写，直到整批写完（留到下一轮的话，其他线程的日志会插在半行中间）；
+            // 写失败时丢弃剩下的数据，否则缓冲区会一直满
+            struct iovec* v = iv;
+            int left = count;
+            while( ch.fd >= 0 && left > 0 ) {
+                ssize_t ret = writev( ch.fd, v, left );
+                if( ret < 0 ) {
+                    if( errno == EINTR ) {
+                        continue;
+                    }
+                    break;
+                }
+                ch.size += ret;
+                size_t done = ret;
+                while( left > 0 && done >= v->iov_len ) {
+                    done -= v->iov_len;
+                    ++v;
+                    --left;
+                }
+                if( left > 0 ) {
+                    v->iov_base = ( char* )v->iov_base + done;
+                    v->iov_len -= done;
+                }
+            }
+            for( size_t i = first; i < last; ++i ) {
+                log_ring* ring = rings[i];
+                ring->tail.store( ring->tail.load( std::memory_order_relaxed ) + avail[ i - first ], std::memory_order_release );
+            }
+            wrote = true;
+        }
+    }
+    return wrote;
+}
@@ -0,0 +1,124 @@
+#ifndef LOG_H
+#define LOG_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include <string>
+#include "locker.h"
+
+// 日志级别
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+
+// 编译期最低级别：低于它的日志调用直接被编译掉（如 -DLOG_COMPILE_LEVEL=1 去掉所有DEBUG日志）
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// 每个线程一个单生产者单消费者的字节环形缓冲区：写日志的线程只追加自己的缓冲区，不加锁、不做系统调用，
+// 由后台线程把所有缓冲区中的数据批量writev到文件；缓冲区满时丢弃日志并计数，不阻塞业务线程
+struct log_ring {
+    explicit log_ring( size_t size );
+    ~log_ring();
+
+    bool push( const char* data, size_t len );
+
+    char* buf;
+    size_t mask;
+    alignas( 64 ) std::atomic< size_t > head;   // 生产者写到的位置
+    alignas( 64 ) std::atomic< size_t > tail;   // 后台线程读到的位置
+    std::atomic< unsigned long > dropped;
+};
+
+// 异步日志：服务器日志（带级别）和访问日志（每个请求一行key=value）两个通道，各自写一个文件，
+// 按天和按大小切分文件；没有指定服务器日志文件时写到标准输出
+class logger {
+public:
+    enum CHANNEL { CHANNEL_SERVER = 0, CHANNEL_ACCESS, CHANNEL_NUMBER };
+
+public:
+    static logger* get_instance() {
+        static logger instance;
+        return &instance;
+    }
+
+    // server_log/access_log：日志文件路径前缀（实际文件名为 前缀-YYYY-MM-DD[.N].log），
+    // server_log为NULL时写标准输出，access_log为NULL时不记录访问日志；max_file_size：单个文件的最大字节数
+    bool init( const char* server_log, const char* access_log, int level, size_t max_file_size );
+
+    void write_log( int level, const char* format, ... ) __attribute__(( format( printf, 3, 4 ) ));
+    void write_access( const char* format, ... ) __attribute__(( format( printf, 2, 3 ) ));
+
+    // 等待后台线程把已经写入缓冲区的日志全部写到文件
+    void flush();
+
+    unsigned long dropped();
+
+    // 停止后台线程，写出剩余的日志并释放各线程的缓冲区，之后的日志直接写文件。
+    // 只能在其他线程都已经结束后调用（排空后正常退出时）
+    void stop();
+
+public:
+    static int m_level;             // 运行期级别，低于它的日志只多一次判断
+    static bool m_access_enabled;
+
+private:
+    logger();
+    ~logger();
+
+    struct channel {
+        std::string prefix;     // 文件路径前缀，为空表示标准输出
+        int fd;
+        size_t size;            // 当前文件已写的字节数
+        int day;                // 当前文件的日期（yyyymmdd）
+        int index;              // 当天第几个文件（按大小切分）
+    };
+
+    log_ring* get_ring( int channel );
+    void append( int channel, const char* data, size_t len );
+    static void* worker( void* arg );
+    void run();
+    bool drain();
+    void rotate( channel& ch, int day );
+
+private:
+    channel m_channels[ CHANNEL_NUMBER ];
+    size_t m_max_file_size;
+
+    // 所有线程的缓冲区，只在线程第一次写日志时加锁注册
+    std::vector< log_ring* > m_rings[ CHANNEL_NUMBER ];
+    locker m_rings_lock;
+
+    pthread_t m_thread;
+    std::atomic< bool > m_running;
+    std::atomic< bool > m_stop;
+    std::atomic< unsigned long > m_flush_seq;   // 后台线程每完成一轮加一
+};
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG( format, ... ) do { if( logger::m_level <= LOG_LEVEL_DEBUG ) logger::get_instance()->write_log( LOG_LEVEL_DEBUG, format, ##__VA_ARGS__ ); } while( 0 )
+#else
+#define LOG_DEBUG( format, ... ) do {} while( 0 )
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO( format, ... ) do { if( logger::m_level <= LOG_LEVEL_INFO ) logger::get_instance()->write_log( LOG_LEVEL_INFO, format, ##__VA_ARGS__ ); } while( 0 )
+#else
+#define LOG_INFO( format, ... ) do {} while( 0 )
+#endif
+
+#if LOG_COMPILE_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN( format, ... ) do { if( logger::m_level <= LOG_LEVEL_WARN ) logger::get_instance()->write_log( LOG_LEVEL_WARN, format, ##__VA_ARGS__ ); } while( 0 )
+#else
+#define LOG_WARN( format, ... ) do {} while( 0 )
+#endif
+
+#define LOG_ERROR( format, ... ) do { if( logger::m_level <= LOG_LEVEL_ERROR ) logger::get_instance()->write_log( LOG_LEVEL_ERROR, format, ##__VA_ARGS__ ); } while( 0 )
+
+#define LOG_ACCESS( format, ... ) do { if( logger::m_access_enabled ) logger::get_instance()->write_access( format, ##__VA_ARGS__ ); } while( 0 )
+
+#endif
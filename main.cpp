@@ -11,16 +11,14 @@
 #include "locker.h"
 #include "threadpool.h"
 #include "http_conn.h"
-
-
-
-#define MAX_FD 65536
-#define MAX_EVENT_NUMBER 10000
-
-
-extern void addfd( int epollfd, int fd, bool one_shot );
-
-extern void removefd( int epollfd, int fd );
+#include "file_cache.h"
+#include "config.h"
+#include "eventloop.h"
+#include "log.h"
+#include "scanner.h"
+#include "metrics.h"
+#include "trace.h"
+#include "handoff.h"
 
 
 void addsig(int sig, void( handler )(int)){
@@ -35,117 +33,149 @@ void addsig(int sig, void( handler )(int)){
 
 int main( int argc, char* argv[] ) {
     
-    if( argc <= 1 ) {
+    config conf;
+    if( !conf.parse_arg( argc, argv ) ) {
 
-        printf( "usage: %s port_number\n", basename(argv[0]));
+        conf.usage( basename(argv[0]) );
         return 1;
     }
 
-    int port = atoi( argv[1] );
-
+    // 日志：没有指定-L时写到标准输出
+    if( !logger::get_instance()->init( conf.log_file, conf.access_log, conf.log_level, conf.log_max_size ) ) {
 
-    addsig( SIGPIPE, SIG_IGN );
-
-
-    threadpool< http_conn >* pool = NULL;
-    try {
-        pool = new threadpool<http_conn>;
-    } catch( ... ) {
-        return 1;  // exit(-1)
+        printf( "open log file failed, errno is: %d\n", errno );
+        return 1;
     }
 
+    if( ( conf.trace_every > 0 || conf.trace_slow_ms > 0 )
+        && !tracer::get_instance()->init( conf.trace_every, conf.trace_slow_ms, conf.trace_prefix ) ) {
 
-    http_conn* users = new http_conn[ MAX_FD ];
-
+        LOG_ERROR( "start tracer failed" );
+        return 1;
+    }
 
-    int listenfd = socket( PF_INET, SOCK_STREAM, 0 );
+    int port = conf.port;
+    LOG_INFO( "request scanner: %s", scanner_name() );
 
+    http_conn::m_actor_model = conf.actor_model;
+    http_conn::m_conn_trig_mode = conf.conn_trig_mode;
+    http_conn::m_timeout[ http_conn::TIMEOUT_HEADER ] = conf.header_timeout * 1000;
+    http_conn::m_timeout[ http_conn::TIMEOUT_IDLE ] = conf.idle_timeout * 1000;
+    http_conn::m_timeout[ http_conn::TIMEOUT_KEEPALIVE ] = conf.keepalive_timeout * 1000;
+    http_conn::m_max_request_size = conf.max_request_size;
+    http_conn::m_status_url = conf.status_url;
 
-    int reuse = 1;
-    setsockopt( listenfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof( reuse ) );
-    
+    if( conf.io_backend == config::IO_URING && conf.transport != config::TRANSPORT_WRITEV ) {
 
-    int ret = 0;
-    struct sockaddr_in address;
-    address.sin_addr.s_addr = INADDR_ANY;
-    address.sin_family = AF_INET;
-    address.sin_port = htons( port );
-    ret = bind( listenfd, ( struct sockaddr* )&address, sizeof( address ) );
-    
-
-    ret = listen( listenfd, 5 );
+        // io_uring用sendmsg发送映射的文件，没有sendfile
+        LOG_WARN( "io_uring backend sends mapped files, ignoring -t" );
+        conf.transport = config::TRANSPORT_WRITEV;
+    }
+    if( conf.transport == config::TRANSPORT_SENDFILE ) {
+        file_cache::get_instance()->set_map_limit( 0 );
+    } else if( conf.transport == config::TRANSPORT_AUTO ) {
+        file_cache::get_instance()->set_map_limit( conf.sendfile_min );
+    }
+    file_cache::get_instance()->set_gzip_level( conf.gzip_level );
 
 
-    int epollfd = epoll_create( 5 );
+    addsig( SIGPIPE, SIG_IGN );
 
-    addfd( epollfd, listenfd, false );
-    http_conn::m_epollfd = epollfd;
 
-    epoll_event events[ MAX_EVENT_NUMBER ];
+    // 热重启：先从正在运行的旧进程取得监听socket，多出来的关闭（上面排队的连接会被重置）
+    int inherited[ HANDOFF_MAX_FDS ];
+    int inherited_number = 0;
+    if( conf.handoff_path ) {
 
-    while(true) {
+        inherited_number = handoff::get_instance()->take_over( conf.handoff_path, port, conf.loops, inherited );
+        if( inherited_number < 0 ) {
 
-        int number = epoll_wait( epollfd, events, MAX_EVENT_NUMBER, -1 );
-        if ( ( number < 0 ) && ( errno != EINTR ) ) {
+            LOG_ERROR( "take over from %s failed, errno is: %d", conf.handoff_path, errno );
+            return 1;
+        }
+        if( inherited_number > conf.loops ) {
 
-            printf( "epoll failure\n" );
-            break;
+            LOG_WARN( "the old server has %d event loops, closing %d listening sockets", inherited_number,
+                      inherited_number - conf.loops );
+            for( int i = conf.loops; i < inherited_number; ++i ) {
+                close( inherited[i] );
+            }
+            inherited_number = conf.loops;
         }
+    }
 
-        for ( int i = 0; i < number; i++ ) {
-            
-            int sockfd = events[i].data.fd;
-            
-            if( sockfd == listenfd ) {
 
-                struct sockaddr_in client_address;
-                socklen_t client_addrlength = sizeof( client_address );
-                int connfd = accept( listenfd, ( struct sockaddr* )&client_address, &client_addrlength );
-                
+    threadpool< http_conn >* pool = NULL;
+    try {
+        pool = new threadpool<http_conn>( conf.thread_number, 10000, conf.work_stealing, conf.worker_cpus );
+    } catch( ... ) {
+        return 1;  // exit(-1)
+    }
 
-                if ( connfd < 0 ) {
-                    printf( "errno is: %d\n", errno );
-                    continue;
-                } 
 
+    http_conn* users = new http_conn[ MAX_FD ];
 
-                if( http_conn::m_user_count >= MAX_FD ) {
 
-                    close(connfd);
-                    continue;
-                }
+    // 每个事件循环各自监听端口（多个循环时使用SO_REUSEPORT），第0个循环在主线程中运行
+    int loop_number = conf.loops;
+    event_loop** loops = new event_loop*[ loop_number ];
+    for( int i = 0; i < loop_number; ++i ) {
 
+        loops[i] = new event_loop( i, users, pool );
+        if( !conf.loop_cpus.empty() ) {
 
-                users[connfd].init( connfd, client_address);
+            loops[i]->set_cpu( conf.loop_cpus[ i % conf.loop_cpus.size() ], conf.incoming_cpu );
+        }
+        int listenfd = i < inherited_number ? inherited[i] : -1;
+        if( !loops[i]->init( port, loop_number > 1, conf.listen_trig_mode == http_conn::ET, conf.backlog, listenfd ) ) {
 
-            } else if( events[i].events & ( EPOLLRDHUP | EPOLLHUP | EPOLLERR ) ) {
+            LOG_ERROR( "init event loop %d failed, errno is: %d", i, errno );
+            return 1;
+        }
+        if( conf.io_backend == config::IO_URING ) {
 
-                users[sockfd].close_conn();
+            loops[i]->use_uring( conf.fixed_files );
+        }
+    }
 
-            } else if(events[i].events & EPOLLIN) {
+    metrics::get_instance()->set_sources( loops, loop_number, pool );
 
-                if(users[sockfd].read()) {
+    for( int i = 1; i < loop_number; ++i ) {
 
-                    pool->append(users + sockfd);
-                } else {
+        if( !loops[i]->start() ) {
 
-                    users[sockfd].close_conn();
-                }
+            LOG_ERROR( "start event loop %d failed", i );
+            return 1;
+        }
+    }
 
-            }  else if( events[i].events & EPOLLOUT ) {
+    if( conf.handoff_path
+        && !handoff::get_instance()->serve( conf.handoff_path, loops, loop_number, conf.drain_timeout * 1000 ) ) {
 
-                if( !users[sockfd].write() ) {
+        LOG_ERROR( "listen on %s failed, errno is: %d", conf.handoff_path, errno );
+        return 1;
+    }
 
-                    users[sockfd].close_conn();
-                }
+    if( !loops[0]->loop() ) {
+        return 1;
+    }
 
-            }
-        }
+    // 交接给了新进程，连接都已关闭：等其他事件循环和所有工作线程退出
+    for( int i = 1; i < loop_number; ++i ) {
+        loops[i]->join();
     }
+    delete pool;
+    LOG_INFO( "drained, exiting" );
 
-    close( epollfd );
-    close( listenfd );
+    for( int i = 0; i < loop_number; ++i ) {
+        delete loops[i];
+    }
+    delete [] loops;
     delete [] users;
-    delete pool;
+
+    // 只有这里所有线程都已经结束，可以释放各线程的计数器和日志缓冲区；出错返回时不释放
+    tracer::get_instance()->stop();
+    metrics::get_instance()->free_blocks();
+    logger::get_instance()->stop();
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,349 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+#include "metrics.h"
+#include "eventloop.h"
+#include "file_cache.h"
+#include "buffer.h"
+#include "log.h"
+#include "timer_wheel.h"
+#include "trace.h"
+
+thread_local metrics_block* metrics::t_block = NULL;
+
+// 分别统计的状态码，其余的记在最后一项
+static const int status_codes[ metrics_block::STATUS_NUMBER - 1 ] = { 200, 206, 304, 400, 403, 404, 416, 500 };
+
+static const char* timeout_names[ http_conn::TIMEOUT_KIND_NUMBER ] = { "header", "idle", "keepalive" };
+
+// Prometheus直方图的桶：2^10到2^35纳秒（约1微秒到34秒），和细分的格子的边界对齐，计数是精确的
+static const int PROMETHEUS_MIN_SHIFT = 10;
+static const int PROMETHEUS_MAX_SHIFT = 35;
+
+// 所有线程的直方图相加的结果
+struct histogram_sum {
+    unsigned long counts[ metrics_histogram::BUCKETS ];
+    unsigned long count;
+    unsigned long sum;
+    unsigned long max;
+
+    histogram_sum() : count( 0 ), sum( 0 ), max( 0 ) {
+        memset( counts, 0, sizeof( counts ) );
+    }
+
+    void add( const metrics_histogram& h ) {
+        for( int i = 0; i < metrics_histogram::BUCKETS; ++i ) {
+            unsigned long n = h.counts[i].load( std::memory_order_relaxed );
+            counts[i] += n;
+            count += n;
+        }
+        sum += h.sum.load( std::memory_order_relaxed );
+        unsigned long m = h.max.load( std::memory_order_relaxed );
+        if( m > max ) {
+            max = m;
+        }
+    }
+
+    // 第q分位（0~1）所在格子的上界，不超过最大值
+    unsigned long percentile( double q ) const {
+        unsigned long rank = ( unsigned long )( q * count + 0.5 );
+        if( rank == 0 ) {
+            rank = 1;
+        }
+        unsigned long seen = 0;
+        for( int i = 0; i < metrics_histogram::BUCKETS; ++i ) {
+            seen += counts[i];
+            if( seen >= rank ) {
+                unsigned long v = metrics_histogram::upper( i );
+                return v < max ? v : max;
+            }
+        }
+        return max;
+    }
+
+    // 小于limit纳秒的个数（limit是2的幂）
+    unsigned long below( unsigned long limit ) const {
+        unsigned long n = 0;
+        for( int i = 0; i < metrics_histogram::index( limit ); ++i ) {
+            n += counts[i];
+        }
+        return n;
+    }
+};
+
+static void append( std::string& out, const char* format, ... ) __attribute__(( format( printf, 2, 3 ) ));
+
+static void append( std::string& out, const char* format, ... ) {
+    char buf[ 512 ];
+    va_list arg_list;
+    va_start( arg_list, format );
+    int n = vsnprintf( buf, sizeof( buf ), format, arg_list );
+    va_end( arg_list );
+    if( n > 0 ) {
+        out.append( buf, n < ( int )sizeof( buf ) ? n : sizeof( buf ) - 1 );
+    }
+}
+
+metrics::metrics() : m_start_time( timer_now_ms() ), m_loops( NULL ), m_loop_number( 0 ), m_pool( NULL ) {
+}
+
+metrics::~metrics() {
+}
+
+void metrics::free_blocks() {
+    m_blocks_lock.lock();
+    for( size_t i = 0; i < m_blocks.size(); ++i ) {
+        delete m_blocks[i];
+    }
+    m_blocks.clear();
+    m_blocks_lock.unlock();
+    t_block = NULL;
+}
+
+void metrics::set_sources( event_loop** loops, int loop_number, threadpool< http_conn >* pool ) {
+    m_loops = loops;
+    m_loop_number = loop_number;
+    m_pool = pool;
+}
+
+int metrics::status_index( int status ) {
+    for( int i = 0; i < metrics_block::STATUS_NUMBER - 1; ++i ) {
+        if( status_codes[i] == status ) {
+            return i;
+        }
+    }
+    return metrics_block::STATUS_NUMBER - 1;
+}
+
+metrics_block* metrics::attach() {
+    t_block = new metrics_block();  // 值初始化，计数器都是0
+    m_blocks_lock.lock();
+    m_blocks.push_back( t_block );
+    m_blocks_lock.unlock();
+    return t_block;
+}
+
+char* metrics::render( bool prometheus, size_t* len ) {
+    std::string out;
+    out.reserve( 8192 );
+    if( prometheus ) {
+        render_prometheus( out );
+    } else {
+        render_text( out );
+    }
+    char* body = new char[ out.size() ];
+    memcpy( body, out.data(), out.size() );
+    *len = out.size();
+    return body;
+}
+
+// 汇总所有线程的计数器
+struct metrics_total {
+    unsigned long responses[ metrics_block::STATUS_NUMBER ];
+    unsigned long requests;
+    unsigned long bytes_sent;
+    unsigned long bytes_received;
+    unsigned long accepted;
+    histogram_sum latency;
+    histogram_sum parse;
+};
+
+static void sum_blocks( const std::vector< metrics_block* >& blocks, metrics_total& t ) {
+    memset( t.responses, 0, sizeof( t.responses ) );
+    t.requests = t.bytes_sent = t.bytes_received = t.accepted = 0;
+    for( size_t i = 0; i < blocks.size(); ++i ) {
+        const metrics_block* b = blocks[i];
+        for( int k = 0; k < metrics_block::STATUS_NUMBER; ++k ) {
+            unsigned long n = b->responses[k].load( std::memory_order_relaxed );
+            t.responses[k] += n;
+            t.requests += n;
+        }
+        t.bytes_sent += b->bytes_sent.load( std::memory_order_relaxed );
+        t.bytes_received += b->bytes_received.load( std::memory_order_relaxed );
+        t.accepted += b->accepted.load( std::memory_order_relaxed );
+        t.latency.add( b->latency );
+        t.parse.add( b->parse );
+    }
+}
+
+static void text_histogram( std::string& out, const char* name, const histogram_sum& h ) {
+    append( out, "%-10s count %lu mean %.1fus p50 %.1fus p90 %.1fus p99 %.1fus p99.9 %.1fus max %.1fus\n", name, h.count,
+            h.count ? h.sum / 1000.0 / h.count : 0.0, h.percentile( 0.5 ) / 1000.0, h.percentile( 0.9 ) / 1000.0,
+            h.percentile( 0.99 ) / 1000.0, h.percentile( 0.999 ) / 1000.0, h.max / 1000.0 );
+}
+
+void metrics::render_text( std::string& out ) {
+    metrics_total t;
+    m_blocks_lock.lock();
+    sum_blocks( m_blocks, t );
+    m_blocks_lock.unlock();
+
+    append( out, "uptime     %lds\n", ( timer_now_ms() - m_start_time ) / 1000 );
+
+    int connections = 0;
+    for( int i = 0; i < m_loop_number; ++i ) {
+        connections += m_loops[i]->get_user_count();
+    }
+    append( out, "connections %d open, %lu accepted\n", connections, t.accepted );
+    for( int i = 0; i < m_loop_number; ++i ) {
+        event_loop* loop = m_loops[i];
+        append( out, "  loop %d: %d open, %lu shed, expired", i, loop->get_user_count(), loop->get_shed() );
+        for( int k = 0; k < http_conn::TIMEOUT_KIND_NUMBER; ++k ) {
+            append( out, " %s %lu", timeout_names[k], loop->get_expired( k ) );
+        }
+        out.append( "\n" );
+    }
+
+    append( out, "requests   %lu,", t.requests );
+    for( int i = 0; i < metrics_block::STATUS_NUMBER; ++i ) {
+        if( i < metrics_block::STATUS_NUMBER - 1 ) {
+            append( out, " %d: %lu", status_codes[i], t.responses[i] );
+        } else {
+            append( out, " other: %lu", t.responses[i] );
+        }
+    }
+    out.append( "\n" );
+    append( out, "bytes      %lu sent, %lu received\n", t.bytes_sent, t.bytes_received );
+    text_histogram( out, "latency", t.latency );
+    text_histogram( out, "parse", t.parse );
+
+    if( m_pool ) {
+        bool stealing = m_pool->is_work_stealing();
+        append( out, "threadpool %d workers, %s\n", m_pool->get_thread_number(), stealing ? "work stealing" : "shared queue" );
+        if( !stealing ) {
+            append( out, "  queue %zu (max %zu)\n", m_pool->queue_depth( 0 ), m_pool->max_queue_depth( 0 ) );
+        }
+        for( int i = 0; i < m_pool->get_thread_number(); ++i ) {
+            append( out, "  worker %d: ", i );
+            if( stealing ) {
+                append( out, "queue %zu (max %zu), ", m_pool->queue_depth( i ), m_pool->max_queue_depth( i ) );
+            }
+            append( out, "tasks %lu, steals %lu, parks %lu\n", m_pool->tasks( i ), m_pool->steals( i ), m_pool->parks( i ) );
+        }
+    }
+
+    file_cache* cache = file_cache::get_instance();
+    append( out, "file_cache %d entries, %zu bytes, %lu hits, %lu misses, %lu evictions, %lu gzips\n", cache->entries(),
+            cache->bytes(), cache->hits(), cache->misses(), cache->evictions(), cache->gzips() );
+    append( out, "buffers    %zu idle bytes\n", buffer_pool::get_instance()->idle_bytes() );
+    append( out, "log        %lu dropped\n", logger::get_instance()->dropped() );
+    if( tracer::m_enabled ) {
+        append( out, "trace      %lu dropped\n", tracer::get_instance()->dropped() );
+    }
+}
+
+static void prometheus_header( std::string& out, const char* name, const char* type, const char* help ) {
+    append( out, "# HELP webserver_%s %s\n# TYPE webserver_%s %s\n", name, help, name, type );
+}
+
+static void prometheus_histogram( std::string& out, const char* name, const char* help, const histogram_sum& h ) {
+    prometheus_header( out, name, "histogram", help );
+    for( int shift = PROMETHEUS_MIN_SHIFT; shift <= PROMETHEUS_MAX_SHIFT; ++shift ) {
+        append( out, "webserver_%s_bucket{le=\"%.12g\"} %lu\n", name, ( double )( 1UL << shift ) / 1e9, h.below( 1UL << shift ) );
+    }
+    append( out, "webserver_%s_bucket{le=\"+Inf\"} %lu\n", name, h.count );
+    append( out, "webserver_%s_sum %.9f\n", name, h.sum / 1e9 );
+    append( out, "webserver_%s_count %lu\n", name, h.count );
+}
+
+// 线程池第i个队列的标签：工作窃取模式下是所属的工作线程，共享队列模式下只有一个队列
+static void queue_label( char* buf, size_t size, threadpool< http_conn >* pool, int i ) {
+    if( pool->is_work_stealing() ) {
+        snprintf( buf, size, "worker=\"%d\"", i );
+    } else {
+        snprintf( buf, size, "queue=\"shared\"" );
+    }
+}
+
+void metrics::render_prometheus( std::string& out ) {
+    metrics_total t;
+    m_blocks_lock.lock();
+    sum_blocks( m_blocks, t );
+    m_blocks_lock.unlock();
+
+    prometheus_header( out, "uptime_seconds", "gauge", "Seconds since the server started." );
+    append( out, "webserver_uptime_seconds %ld\n", ( timer_now_ms() - m_start_time ) / 1000 );
+
+    prometheus_header( out, "connections", "gauge", "Open connections per event loop." );
+    for( int i = 0; i < m_loop_number; ++i ) {
+        append( out, "webserver_connections{loop=\"%d\"} %d\n", i, m_loops[i]->get_user_count() );
+    }
+    prometheus_header( out, "connections_accepted_total", "counter", "Connections accepted." );
+    append( out, "webserver_connections_accepted_total %lu\n", t.accepted );
+    prometheus_header( out, "connections_shed_total", "counter", "Connections closed right after accept because fds ran out." );
+    for( int i = 0; i < m_loop_number; ++i ) {
+        append( out, "webserver_connections_shed_total{loop=\"%d\"} %lu\n", i, m_loops[i]->get_shed() );
+    }
+    prometheus_header( out, "connections_expired_total", "counter", "Connections closed by a timeout." );
+    for( int i = 0; i < m_loop_number; ++i ) {
+        for( int k = 0; k < http_conn::TIMEOUT_KIND_NUMBER; ++k ) {
+            append( out, "webserver_connections_expired_total{loop=\"%d\",reason=\"%s\"} %lu\n", i, timeout_names[k],
+                    m_loops[i]->get_expired( k ) );
+        }
+    }
+
+    prometheus_header( out, "responses_total", "counter", "Responses by status code." );
+    for( int i = 0; i < metrics_block::STATUS_NUMBER; ++i ) {
+        if( i < metrics_block::STATUS_NUMBER - 1 ) {
+            append( out, "webserver_responses_total{code=\"%d\"} %lu\n", status_codes[i], t.responses[i] );
+        } else {
+            append( out, "webserver_responses_total{code=\"other\"} %lu\n", t.responses[i] );
+        }
+    }
+    prometheus_header( out, "sent_bytes_total", "counter", "Response bytes written to sockets." );
+    append( out, "webserver_sent_bytes_total %lu\n", t.bytes_sent );
+    prometheus_header( out, "received_bytes_total", "counter", "Request bytes read from sockets." );
+    append( out, "webserver_received_bytes_total %lu\n", t.bytes_received );
+    prometheus_histogram( out, "request_duration_seconds", "From the first byte of a request until its response is sent.", t.latency );
+    prometheus_histogram( out, "parse_duration_seconds", "Parsing a request and building its response.", t.parse );
+
+    if( m_pool ) {
+        int n = m_pool->get_thread_number();
+        int queues = m_pool->queue_number();
+        char label[ 32 ];
+        prometheus_header( out, "threadpool_queue_depth", "gauge", "Tasks waiting in a threadpool queue." );
+        for( int i = 0; i < queues; ++i ) {
+            queue_label( label, sizeof( label ), m_pool, i );
+            append( out, "webserver_threadpool_queue_depth{%s} %zu\n", label, m_pool->queue_depth( i ) );
+        }
+        prometheus_header( out, "threadpool_queue_depth_max", "gauge", "Largest queue depth seen." );
+        for( int i = 0; i < queues; ++i ) {
+            queue_label( label, sizeof( label ), m_pool, i );
+            append( out, "webserver_threadpool_queue_depth_max{%s} %zu\n", label, m_pool->max_queue_depth( i ) );
+        }
+        prometheus_header( out, "threadpool_tasks_total", "counter", "Tasks run by a worker." );
+        for( int i = 0; i < n; ++i ) {
+            append( out, "webserver_threadpool_tasks_total{worker=\"%d\"} %lu\n", i, m_pool->tasks( i ) );
+        }
+        prometheus_header( out, "threadpool_steals_total", "counter", "Tasks a worker took from another worker's queue." );
+        for( int i = 0; i < n; ++i ) {
+            append( out, "webserver_threadpool_steals_total{worker=\"%d\"} %lu\n", i, m_pool->steals( i ) );
+        }
+        prometheus_header( out, "threadpool_parks_total", "counter", "Times a worker went to sleep." );
+        for( int i = 0; i < n; ++i ) {
+            append( out, "webserver_threadpool_parks_total{worker=\"%d\"} %lu\n", i, m_pool->parks( i ) );
+        }
+    }
+
+    file_cache* cache = file_cache::get_instance();
+    prometheus_header( out, "file_cache_entries", "gauge", "Files held in the file cache." );
+    append( out, "webserver_file_cache_entries %d\n", cache->entries() );
+    prometheus_header( out, "file_cache_bytes", "gauge", "Mapped and compressed bytes held in the file cache." );
+    append( out, "webserver_file_cache_bytes %zu\n", cache->bytes() );
+    prometheus_header( out, "file_cache_hits_total", "counter", "File cache hits." );
+    append( out, "webserver_file_cache_hits_total %lu\n", cache->hits() );
+    prometheus_header( out, "file_cache_misses_total", "counter", "File cache misses." );
+    append( out, "webserver_file_cache_misses_total %lu\n", cache->misses() );
+    prometheus_header( out, "file_cache_evictions_total", "counter", "File cache evictions." );
+    append( out, "webserver_file_cache_evictions_total %lu\n", cache->evictions() );
+    prometheus_header( out, "file_cache_gzips_total", "counter", "Files compressed at run time." );
+    append( out, "webserver_file_cache_gzips_total %lu\n", cache->gzips() );
+    prometheus_header( out, "buffer_pool_idle_bytes", "gauge", "Free bytes in the shared buffer pool lists." );
+    append( out, "webserver_buffer_pool_idle_bytes %zu\n", buffer_pool::get_instance()->idle_bytes() );
+    prometheus_header( out, "log_dropped_total", "counter", "Log lines dropped because a log buffer was full." );
+    append( out, "webserver_log_dropped_total %lu\n", logger::get_instance()->dropped() );
+    if( tracer::m_enabled ) {
+        prometheus_header( out, "trace_dropped_total", "counter", "Sampled request traces dropped because a dump interval was full." );
+        append( out, "webserver_trace_dropped_total %lu\n", tracer::get_instance()->dropped() );
+    }
+}
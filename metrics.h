@@ -0,0 +1,126 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include <string>
+#include "locker.h"
+
+class event_loop;
+class http_conn;
+template< typename T > class threadpool;
+
+// 对数线性直方图：小于16的值每个一格，之后每个2的幂区间分成8格（相对误差不超过1/8），单位纳秒，
+// 超过2^41纳秒（约37分钟）的都记在最后一格。只由所属线程写，读取时可能和写并发，读到的是近似值
+struct metrics_histogram {
+    static const int SUB_BITS = 3;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int BUCKETS = ( 41 - SUB_BITS + 1 ) * SUB_COUNT;
+
+    std::atomic< unsigned long > counts[ BUCKETS ];
+    std::atomic< unsigned long > sum;
+    std::atomic< unsigned long > max;
+
+    static int index( unsigned long v ) {
+        if( v < 2 * SUB_COUNT ) {
+            return ( int )v;
+        }
+        int shift = 63 - __builtin_clzl( v ) - SUB_BITS;
+        int i = ( shift + 1 ) * SUB_COUNT + ( int )( v >> shift ) - SUB_COUNT;
+        return i < BUCKETS ? i : BUCKETS - 1;
+    }
+
+    // 第i格中最大的值
+    static unsigned long upper( int i ) {
+        if( i < 2 * SUB_COUNT ) {
+            return i;
+        }
+        int shift = i / SUB_COUNT - 1;
+        unsigned long sub = i % SUB_COUNT + SUB_COUNT;
+        return ( ( sub + 1 ) << shift ) - 1;
+    }
+};
+
+// 一个线程的计数器：按缓存行对齐，只由所属线程写（普通的读和写，不用原子的读-改-写），
+// 没有伪共享也没有锁；读取时把所有线程的加起来
+struct alignas( 64 ) metrics_block {
+    // 按状态码统计的响应数，下标见metrics::status_index()
+    static const int STATUS_NUMBER = 9;
+
+    std::atomic< unsigned long > responses[ STATUS_NUMBER ];
+    std::atomic< unsigned long > bytes_sent;
+    std::atomic< unsigned long > bytes_received;
+    std::atomic< unsigned long > accepted;
+    metrics_histogram latency;      // 从收到请求的第一个字节到响应发送完（或发送失败）
+    metrics_histogram parse;        // 解析一个请求并生成响应（包括do_request()中查找文件）
+};
+
+// 监控指标：每个线程一个metrics_block（第一次记录时注册），热路径上只是给自己线程的计数器加一；
+// 请求保留的URL（默认/status）时才汇总所有线程的计数器，再加上线程池、事件循环、文件缓存和日志已有的统计，
+// 生成文本或Prometheus格式的响应，完全在内存中完成
+class metrics {
+public:
+    static metrics* get_instance() {
+        static metrics instance;
+        return &instance;
+    }
+
+    // 汇总时读取的事件循环和线程池，在它们创建后调用
+    void set_sources( event_loop** loops, int loop_number, threadpool< http_conn >* pool );
+
+    void add_response( int status, size_t bytes, long latency_ns ) {
+        metrics_block* b = local();
+        bump( b->responses[ status_index( status ) ], 1 );
+        bump( b->bytes_sent, bytes );
+        record( b->latency, latency_ns );
+    }
+    void add_parse( long ns ) { record( local()->parse, ns ); }
+    void add_received( size_t bytes ) { bump( local()->bytes_received, bytes ); }
+    void add_accepted() { bump( local()->accepted, 1 ); }
+
+    // 生成/status的正文：text为人看的格式，否则为Prometheus的文本格式；返回new出来的缓冲区，由调用者delete []
+    char* render( bool prometheus, size_t* len );
+
+    // 释放所有线程的计数器，只能在其他线程都已经结束后调用（排空后正常退出时）
+    void free_blocks();
+
+private:
+    metrics();
+    ~metrics();
+
+    static int status_index( int status );
+    static void bump( std::atomic< unsigned long >& counter, unsigned long n ) {
+        counter.store( counter.load( std::memory_order_relaxed ) + n, std::memory_order_relaxed );
+    }
+    static void record( metrics_histogram& h, long v ) {
+        unsigned long value = v > 0 ? v : 0;
+        bump( h.counts[ metrics_histogram::index( value ) ], 1 );
+        bump( h.sum, value );
+        if( value > h.max.load( std::memory_order_relaxed ) ) {
+            h.max.store( value, std::memory_order_relaxed );
+        }
+    }
+
+    metrics_block* local() {
+        return t_block ? t_block : attach();
+    }
+    metrics_block* attach();
+
+    void render_text( std::string& out );
+    void render_prometheus( std::string& out );
+
+private:
+    static thread_local metrics_block* t_block;
+
+    // 所有线程的计数器，只在线程第一次记录时加锁注册，线程退出后也保留（计数不能丢）
+    std::vector< metrics_block* > m_blocks;
+    locker m_blocks_lock;
+
+    long m_start_time;      // 启动时间（timer_now_ms()）
+    event_loop** m_loops;
+    int m_loop_number;
+    threadpool< http_conn >* m_pool;
+};
+
+#endif
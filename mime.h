@@ -0,0 +1,61 @@
+#ifndef MIME_H
+#define MIME_H
+
+#include <string.h>
+#include <strings.h>
+
+// 按文件扩展名确定的响应类型：完整的Content-Type头部行，以及是否值得gzip压缩（文本类）
+struct mime_type {
+    const char* ext;
+    const char* field;
+    int field_len;
+    bool compressible;
+};
+
+#define MIME_TYPE( ext, type, compressible ) { ext, "Content-Type: " type "\r\n", sizeof( "Content-Type: " type "\r\n" ) - 1, compressible }
+
+static const mime_type mime_types[] = {
+    MIME_TYPE( "html", "text/html", true ),
+    MIME_TYPE( "htm", "text/html", true ),
+    MIME_TYPE( "css", "text/css", true ),
+    MIME_TYPE( "js", "application/javascript", true ),
+    MIME_TYPE( "json", "application/json", true ),
+    MIME_TYPE( "xml", "application/xml", true ),
+    MIME_TYPE( "txt", "text/plain", true ),
+    MIME_TYPE( "csv", "text/csv", true ),
+    MIME_TYPE( "svg", "image/svg+xml", true ),
+    MIME_TYPE( "ico", "image/x-icon", true ),
+    MIME_TYPE( "png", "image/png", false ),
+    MIME_TYPE( "jpg", "image/jpeg", false ),
+    MIME_TYPE( "jpeg", "image/jpeg", false ),
+    MIME_TYPE( "gif", "image/gif", false ),
+    MIME_TYPE( "webp", "image/webp", false ),
+    MIME_TYPE( "mp4", "video/mp4", false ),
+    MIME_TYPE( "mp3", "audio/mpeg", false ),
+    MIME_TYPE( "pdf", "application/pdf", false ),
+    MIME_TYPE( "woff", "font/woff", false ),
+    MIME_TYPE( "woff2", "font/woff2", false ),
+    MIME_TYPE( "zip", "application/zip", false ),
+    MIME_TYPE( "gz", "application/gzip", false ),
+};
+
+// 没有扩展名或扩展名未知时
+static const mime_type mime_default = MIME_TYPE( "", "application/octet-stream", false );
+
+#undef MIME_TYPE
+
+// 根据路径的扩展名（不区分大小写）查找类型
+inline const mime_type* mime_lookup( const char* path ) {
+    const char* dot = strrchr( path, '.' );
+    if ( !dot || strchr( dot, '/' ) ) {
+        return &mime_default;
+    }
+    for ( size_t i = 0; i < sizeof( mime_types ) / sizeof( mime_types[0] ); ++i ) {
+        if ( strcasecmp( dot + 1, mime_types[i].ext ) == 0 ) {
+            return &mime_types[i];
+        }
+    }
+    return &mime_default;
+}
+
+#endif
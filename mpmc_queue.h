@@ -0,0 +1,105 @@
+#ifndef MPMC_QUEUE_H
+#define MPMC_QUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+
+// 有界无锁多生产者多消费者环形队列（Dmitry Vyukov的算法）
+// 每个槽位带一个序号：序号==位置时可写，序号==位置+1时可读，生产者/消费者各自用CAS抢位置，
+// 入队出队都不加锁、不分配内存；容量向上取整为2的幂
+template< typename T >
+class mpmc_queue {
+public:
+    explicit mpmc_queue( size_t capacity ) : m_buffer( NULL ), m_mask( 0 ), m_enqueue_pos( 0 ), m_dequeue_pos( 0 ) {
+        if( capacity < 2 ) {
+            capacity = 2;
+        }
+        size_t size = 1;
+        while( size < capacity ) {
+            size <<= 1;
+        }
+        m_buffer = new cell[ size ];
+        m_mask = size - 1;
+        for( size_t i = 0; i < size; ++i ) {
+            m_buffer[i].seq.store( i, std::memory_order_relaxed );
+        }
+    }
+
+    ~mpmc_queue() {
+        delete [] m_buffer;
+    }
+
+    // 队列满时返回false
+    bool push( const T& data ) {
+        cell* c;
+        size_t pos = m_enqueue_pos.load( std::memory_order_relaxed );
+        while( true ) {
+            c = &m_buffer[ pos & m_mask ];
+            size_t seq = c->seq.load( std::memory_order_acquire );
+            long diff = (long)seq - (long)pos;
+            if( diff == 0 ) {
+                if( m_enqueue_pos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) {
+                    break;
+                }
+            } else if( diff < 0 ) {
+                return false;  // 这个槽位上一轮的数据还没被取走：队列满
+            } else {
+                pos = m_enqueue_pos.load( std::memory_order_relaxed );
+            }
+        }
+        c->data = data;
+        c->seq.store( pos + 1, std::memory_order_release );
+        return true;
+    }
+
+    // 队列空时返回false
+    bool pop( T& data ) {
+        cell* c;
+        size_t pos = m_dequeue_pos.load( std::memory_order_relaxed );
+        while( true ) {
+            c = &m_buffer[ pos & m_mask ];
+            size_t seq = c->seq.load( std::memory_order_acquire );
+            long diff = (long)seq - (long)( pos + 1 );
+            if( diff == 0 ) {
+                if( m_dequeue_pos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed ) ) {
+                    break;
+                }
+            } else if( diff < 0 ) {
+                return false;  // 这个槽位还没有写入数据：队列空
+            } else {
+                pos = m_dequeue_pos.load( std::memory_order_relaxed );
+            }
+        }
+        data = c->data;
+        c->seq.store( pos + m_mask + 1, std::memory_order_release );
+        return true;
+    }
+
+    // 当前元素个数（并发时只是近似值）
+    size_t size() const {
+        size_t tail = m_enqueue_pos.load( std::memory_order_relaxed );
+        size_t head = m_dequeue_pos.load( std::memory_order_relaxed );
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const { return m_mask + 1; }
+
+private:
+    struct cell {
+        std::atomic< size_t > seq;
+        T data;
+    };
+
+    mpmc_queue( const mpmc_queue& );
+    mpmc_queue& operator=( const mpmc_queue& );
+
+private:
+    // 生产者和消费者的位置放在不同的缓存行，避免伪共享
+    alignas( 64 ) cell* m_buffer;
+    size_t m_mask;
+    alignas( 64 ) std::atomic< size_t > m_enqueue_pos;
+    alignas( 64 ) std::atomic< size_t > m_dequeue_pos;
+    char m_pad[ 64 - sizeof( std::atomic< size_t > ) ];
+};
+
+#endif
@@ -0,0 +1,85 @@
+#include <string.h>
+#include <strings.h>
+#include "range.h"
+
+// 解析Range中的一个非负整数，没有数字或溢出时返回false
+static bool parse_offset( const char*& p, off_t* out ) {
+    if ( *p < '0' || *p > '9' ) {
+        return false;
+    }
+    off_t n = 0;
+    for ( ; *p >= '0' && *p <= '9'; ++p ) {
+        if ( n > ( off_t )1 << 56 ) {
+            return false;
+        }
+        n = n * 10 + ( *p - '0' );
+    }
+    *out = n;
+    return true;
+}
+
+int parse_byte_ranges( const char* value, off_t size, byte_range* ranges, int max ) {
+    const char* p = value;
+    if ( strncasecmp( p, "bytes=", 6 ) != 0 ) {
+        return 0;
+    }
+    p += 6;
+
+    off_t total = 0;
+    int specs = 0;
+    int count = 0;
+    while ( true ) {
+        p += strspn( p, " \t," );
+        if ( !*p ) {
+            break;
+        }
+        off_t first, last;
+        if ( *p == '-' ) {
+            // 最后n个字节
+            ++p;
+            off_t n;
+            if ( !parse_offset( p, &n ) ) {
+                return 0;
+            }
+            first = n < size ? size - n : 0;
+            last = n > 0 ? size - 1 : -1;
+        } else {
+            if ( !parse_offset( p, &first ) || *p++ != '-' ) {
+                return 0;
+            }
+            last = size - 1;
+            off_t n;
+            if ( parse_offset( p, &n ) ) {
+                if ( n < first ) {
+                    return 0;
+                }
+                last = n < size ? n : size - 1;
+            }
+        }
+        p += strspn( p, " \t" );
+        if ( *p && *p != ',' ) {
+            return 0;
+        }
+        ++specs;
+
+        if ( first >= size || last < first ) {
+            continue;   // 这个区间无法满足
+        }
+        if ( count == max ) {
+            return 0;
+        }
+        ranges[ count ].first = first;
+        ranges[ count ].last = last;
+        total += last - first + 1;
+        ++count;
+    }
+
+    if ( specs == 0 ) {
+        return 0;
+    }
+    if ( count == 0 ) {
+        return -1;
+    }
+    // 重叠的区间加起来比文件还大，按区间发送反而更多，直接发送整个文件
+    return total > size ? 0 : count;
+}
@@ -0,0 +1,17 @@
+#ifndef RANGE_H
+#define RANGE_H
+
+#include <sys/types.h>
+
+// 请求的一个字节区间[first, last]
+struct byte_range {
+    off_t first;
+    off_t last;
+};
+
+// 解析Range头部的值（如"bytes=0-99,200-,-500"），区间按文件大小size截断后依次保存到ranges，最多max个。
+// 返回区间数；0表示忽略Range、发送整个文件（不是bytes单位、格式不对、区间超过max个或者重叠过多），
+// -1表示没有一个区间能满足（416）
+int parse_byte_ranges( const char* value, off_t size, byte_range* ranges, int max );
+
+#endif
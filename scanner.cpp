@@ -0,0 +1,123 @@
+#include "scanner.h"
+
+#if defined( __x86_64__ ) || defined( __i386__ )
+#include <immintrin.h>
+#define SCANNER_X86 1
+#endif
+
+static void scan_init( line_scan* out ) {
+    out->eol = -1;
+    out->colon = -1;
+    out->spaces = 0;
+}
+
+// 从第i个字节开始逐字节扫描（没有SIMD时，以及SIMD处理不满一个块的尾部）
+static void scan_scalar_from( const char* p, int i, int len, line_scan* out ) {
+    for ( ; i < len; ++i ) {
+        char c = p[i];
+        if ( c == '\r' || c == '\n' ) {
+            out->eol = i;
+            return;
+        } else if ( c == ':' ) {
+            if ( out->colon < 0 ) {
+                out->colon = i;
+            }
+        } else if ( ( c == ' ' || c == '\t' ) && out->spaces < 2 ) {
+            out->space[ out->spaces++ ] = i;
+        }
+    }
+}
+
+static void scan_scalar( const char* p, int len, line_scan* out ) {
+    scan_init( out );
+    scan_scalar_from( p, 0, len, out );
+}
+
+#ifdef SCANNER_X86
+
+// 处理一个块的比较结果（每个字节一位）：只保留行尾之前的位，找到行尾时返回true
+static inline bool scan_block( int base, unsigned eol, unsigned space, unsigned colon, line_scan* out ) {
+    if ( eol ) {
+        unsigned keep = ( 1u << __builtin_ctz( eol ) ) - 1;
+        space &= keep;
+        colon &= keep;
+    }
+    if ( colon && out->colon < 0 ) {
+        out->colon = base + __builtin_ctz( colon );
+    }
+    while ( space && out->spaces < 2 ) {
+        out->space[ out->spaces++ ] = base + __builtin_ctz( space );
+        space &= space - 1;
+    }
+    if ( eol ) {
+        out->eol = base + __builtin_ctz( eol );
+        return true;
+    }
+    return false;
+}
+
+static void scan_sse2( const char* p, int len, line_scan* out ) {
+    scan_init( out );
+    const __m128i cr = _mm_set1_epi8( '\r' ), lf = _mm_set1_epi8( '\n' );
+    const __m128i sp = _mm_set1_epi8( ' ' ), tab = _mm_set1_epi8( '\t' ), colon = _mm_set1_epi8( ':' );
+    int i = 0;
+    for ( ; i + 16 <= len; i += 16 ) {
+        __m128i v = _mm_loadu_si128( ( const __m128i* )( p + i ) );
+        unsigned eol_mask = _mm_movemask_epi8( _mm_or_si128( _mm_cmpeq_epi8( v, cr ), _mm_cmpeq_epi8( v, lf ) ) );
+        unsigned space_mask = _mm_movemask_epi8( _mm_or_si128( _mm_cmpeq_epi8( v, sp ), _mm_cmpeq_epi8( v, tab ) ) );
+        unsigned colon_mask = _mm_movemask_epi8( _mm_cmpeq_epi8( v, colon ) );
+        if ( scan_block( i, eol_mask, space_mask, colon_mask, out ) ) {
+            return;
+        }
+    }
+    scan_scalar_from( p, i, len, out );
+}
+
+__attribute__(( target( "avx2" ) ))
+static void scan_avx2( const char* p, int len, line_scan* out ) {
+    scan_init( out );
+    const __m256i cr = _mm256_set1_epi8( '\r' ), lf = _mm256_set1_epi8( '\n' );
+    const __m256i sp = _mm256_set1_epi8( ' ' ), tab = _mm256_set1_epi8( '\t' ), colon = _mm256_set1_epi8( ':' );
+    int i = 0;
+    for ( ; i + 32 <= len; i += 32 ) {
+        __m256i v = _mm256_loadu_si256( ( const __m256i* )( p + i ) );
+        unsigned eol_mask = _mm256_movemask_epi8( _mm256_or_si256( _mm256_cmpeq_epi8( v, cr ), _mm256_cmpeq_epi8( v, lf ) ) );
+        unsigned space_mask = _mm256_movemask_epi8( _mm256_or_si256( _mm256_cmpeq_epi8( v, sp ), _mm256_cmpeq_epi8( v, tab ) ) );
+        unsigned colon_mask = _mm256_movemask_epi8( _mm256_cmpeq_epi8( v, colon ) );
+        if ( scan_block( i, eol_mask, space_mask, colon_mask, out ) ) {
+            return;
+        }
+    }
+    scan_scalar_from( p, i, len, out );
+}
+
+#endif
+
+typedef void ( *scan_fn )( const char*, int, line_scan* );
+
+static const char* s_scanner_name = "scalar";
+
+static scan_fn select_scanner() {
+#ifdef SCANNER_X86
+    __builtin_cpu_init();
+    if ( __builtin_cpu_supports( "avx2" ) ) {
+        s_scanner_name = "avx2";
+        return scan_avx2;
+    }
+    if ( __builtin_cpu_supports( "sse2" ) ) {
+        s_scanner_name = "sse2";
+        return scan_sse2;
+    }
+#endif
+    return scan_scalar;
+}
+
+static scan_fn s_scan = select_scanner();
+
+void scan_line( const char* p, int len, line_scan* out ) {
+    s_scan( p, len, out );
+}
+
+const char* scanner_name() {
+    return s_scanner_name;
+}
@@ -0,0 +1,19 @@
+#ifndef SCANNER_H
+#define SCANNER_H
+
+// 扫描一行的结果，位置都是相对扫描起点的偏移，没有找到为-1
+struct line_scan {
+    int eol;        // 第一个'\r'或'\n'
+    int colon;      // 行尾之前的第一个':'（头部字段名的结束）
+    int space[2];   // 行尾之前的前两个空白（' '或'\t'，请求行中方法、URL、版本的分隔）
+    int spaces;     // space中有效的个数
+};
+
+// 一次扫描[p, p + len)，找到行尾，同时记下行尾之前的冒号和空白。
+// 启动时按CPU选择实现：AVX2每次比较32字节，SSE2每次16字节，其他平台逐字节
+void scan_line( const char* p, int len, line_scan* out );
+
+// 当前使用的实现："avx2"、"sse2"或"scalar"
+const char* scanner_name();
+
+#endif
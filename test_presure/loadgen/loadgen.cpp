@@ -0,0 +1,821 @@
+// HTTP/1.1压测工具：多线程，每个线程一个epoll实例和一部分连接，支持长连接、流水线和按权重混合的URL，
+// 输出吞吐量和延迟分布（p50/p90/p99/p99.9/p99.99/max）
+//
+// 闭环（默认）：每个连接上始终有depth个请求在等待响应，一个响应到达才发下一个请求，
+//   测的是服务器在这个并发度下的吞吐量；服务器变慢时请求也发得慢，延迟被低估（coordinated omission）
+// 开环（-R rate）：按固定速率产生请求，不管服务器是否跟得上；没有空闲连接时请求排队，
+//   延迟从请求"应该发出"的时间算起（排队时间也算在内），这样才能看到真实的尾延迟。
+//   同时输出从实际发出时间算起的延迟作为对比
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include <deque>
+
+static const int MAX_DEPTH = 64;            // 每个连接最多同时等待的请求数
+static const int MAX_EVENTS = 1024;
+static const size_t READ_CHUNK = 64 * 1024;
+static const size_t MAX_BACKLOG = 1 << 20;  // 开环模式下排队等待连接的请求数上限，超过的计为丢弃
+
+static uint64_t now_us() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ( uint64_t )ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// 对数线性直方图（和HdrHistogram相同的思路）：小于128微秒每1微秒一格，之后每个2的幂区间分成64格，
+// 相对误差不超过1/64；记录O(1)，各线程的直方图直接相加
+class histogram {
+public:
+    static const int SUB_BITS = 6;
+    static const int SUB_COUNT = 1 << SUB_BITS;
+    static const int BUCKETS = ( 64 - SUB_BITS ) * SUB_COUNT;
+
+    histogram() : m_count( 0 ), m_sum( 0 ), m_max( 0 ), m_counts( BUCKETS, 0 ) {}
+
+    void record( uint64_t v ) {
+        ++m_counts[ index( v ) ];
+        ++m_count;
+        m_sum += v;
+        if( v > m_max ) {
+            m_max = v;
+        }
+    }
+
+    void merge( const histogram& h ) {
+        for( int i = 0; i < BUCKETS; ++i ) {
+            m_counts[i] += h.m_counts[i];
+        }
+        m_count += h.m_count;
+        m_sum += h.m_sum;
+        if( h.m_max > m_max ) {
+            m_max = h.m_max;
+        }
+    }
+
+    // 第q分位（0~1）的值：所在格子的上界，不超过最大值
+    uint64_t percentile( double q ) const {
+        if( m_count == 0 ) {
+            return 0;
+        }
+        uint64_t rank = ( uint64_t )( q * m_count + 0.5 );
+        if( rank == 0 ) {
+            rank = 1;
+        }
+        uint64_t seen = 0;
+        for( int i = 0; i < BUCKETS; ++i ) {
+            seen += m_counts[i];
+            if( seen >= rank ) {
+                uint64_t v = upper( i );
+                return v < m_max ? v : m_max;
+            }
+        }
+        return m_max;
+    }
+
+    uint64_t count() const { return m_count; }
+    uint64_t max() const { return m_max; }
+    double mean() const { return m_count ? ( double )m_sum / m_count : 0; }
+
+private:
+    static int index( uint64_t v ) {
+        if( v < 2 * SUB_COUNT ) {
+            return ( int )v;
+        }
+        int shift = 63 - __builtin_clzll( v ) - SUB_BITS;
+        return ( shift + 1 ) * SUB_COUNT + ( int )( v >> shift ) - SUB_COUNT;
+    }
+
+    static uint64_t upper( int i ) {
+        if( i < 2 * SUB_COUNT ) {
+            return i;
+        }
+        int shift = i / SUB_COUNT - 1;
+        uint64_t sub = i % SUB_COUNT + SUB_COUNT;
+        return ( ( sub + 1 ) << shift ) - 1;
+    }
+
+    uint64_t m_count;
+    uint64_t m_sum;
+    uint64_t m_max;
+    std::vector< uint64_t > m_counts;
+};
+
+// 一个要请求的URL和它在混合中的权重
+struct target {
+    std::string path;
+    int weight;
+    std::string request;  // 预先生成的完整请求
+};
+
+// 启动参数
+struct options {
+    const char* host;
+    int port;
+    int connections;
+    int threads;
+    int duration;
+    int warmup;
+    int depth;
+    bool keepalive;
+    double rate;          // 开环模式的总请求速率（每秒），0为闭环
+    int timeout_ms;       // 一个请求等待响应的上限，超过时关闭连接、计为超时
+    std::vector< target > targets;
+    int total_weight;
+};
+
+static options opt;
+static struct sockaddr_in server_addr;
+static volatile bool stop = false;
+static uint64_t start_us;   // 开始计入统计的时间（预热之后）
+
+// 一个已发出、等待响应的请求
+struct pending {
+    uint64_t intended;    // 应该发出的时间（开环），闭环时等于sent
+    uint64_t sent;
+};
+
+struct connection {
+    int fd;
+    bool connected;
+    std::string out;              // 还没写出去的请求
+    size_t out_off;
+    std::string in;               // 收到的、还没解析完的响应
+    std::deque< pending > inflight;
+    // 正在接收的响应：头部已解析完时body_left为剩余正文字节数，-1表示正文到连接关闭为止
+    bool in_body;
+    long body_left;
+    int status;
+    bool close_after;
+    uint64_t requests;            // 这个连接上已经完成的请求数
+};
+
+// 每个线程的统计，结束后合并
+struct thread_stats {
+    histogram latency;            // 闭环：从发出算起；开环：从应该发出的时间算起
+    histogram service;            // 开环时从实际发出算起的延迟（没有修正coordinated omission）
+    uint64_t requests;
+    uint64_t bytes;
+    uint64_t status[6];           // 1xx~5xx，其他
+    uint64_t connects;
+    uint64_t connect_errors;
+    uint64_t read_errors;
+    uint64_t write_errors;
+    uint64_t timeouts;
+    uint64_t dropped;             // 开环模式下排队超过上限而放弃的请求
+    uint64_t queued;              // 开环模式下结束时还在排队、没有发出的请求
+    std::vector< uint64_t > per_target;
+
+    thread_stats() : requests( 0 ), bytes( 0 ), connects( 0 ), connect_errors( 0 ), read_errors( 0 ), write_errors( 0 ),
+            timeouts( 0 ), dropped( 0 ), queued( 0 ), per_target( opt.targets.size(), 0 ) {
+        memset( status, 0, sizeof( status ) );
+    }
+};
+
+class worker {
+public:
+    worker( int id, int connections, double rate );
+    ~worker();
+    static void* run( void* arg );
+    void loop();
+
+    thread_stats stats;
+
+private:
+    void open_conn( connection& c );
+    void close_conn( connection& c, bool reconnect );
+    void update_events( connection& c );
+    void send_requests( connection& c, uint64_t now );
+    bool flush( connection& c );
+    bool on_readable( connection& c );
+    bool parse( connection& c );
+    void complete( connection& c, uint64_t now );
+    void generate( uint64_t now );
+    void dispatch( uint64_t now );
+    void check_timeouts( uint64_t now );
+    const target& pick();
+
+    int m_id;
+    int m_epollfd;
+    int m_timerfd;                  // 开环：在下一个请求应该发出的时间唤醒（epoll_wait的超时只精确到毫秒）
+    std::vector< connection > m_conns;
+    double m_interval_us;           // 开环：相邻两个请求应该发出的时间间隔
+    double m_next_us;
+    std::deque< uint64_t > m_backlog;  // 开环：已经到了发出时间、还没有连接可用的请求
+    uint64_t m_rand;
+    std::vector< std::deque< int > > m_inflight_target;  // 每个连接上等待响应的请求是哪个URL（与inflight对应）
+};
+
+worker::worker( int id, int connections, double rate ) : m_id( id ), m_epollfd( -1 ), m_timerfd( -1 ), m_conns( connections ),
+        m_interval_us( rate > 0 ? 1e6 / rate : 0 ), m_next_us( 0 ), m_rand( 0x9e3779b97f4a7c15ULL * ( id + 1 ) ),
+        m_inflight_target( connections ) {
+    for( size_t i = 0; i < m_conns.size(); ++i ) {
+        m_conns[i].fd = -1;
+    }
+}
+
+worker::~worker() {
+    for( size_t i = 0; i < m_conns.size(); ++i ) {
+        if( m_conns[i].fd >= 0 ) {
+            close( m_conns[i].fd );
+        }
+    }
+    if( m_timerfd >= 0 ) {
+        close( m_timerfd );
+    }
+    if( m_epollfd >= 0 ) {
+        close( m_epollfd );
+    }
+}
+
+void* worker::run( void* arg ) {
+    ( ( worker* )arg )->loop();
+    return arg;
+}
+
+// 按权重随机选一个URL（xorshift64）
+const target& worker::pick() {
+    if( opt.targets.size() == 1 ) {
+        return opt.targets[0];
+    }
+    m_rand ^= m_rand << 13;
+    m_rand ^= m_rand >> 7;
+    m_rand ^= m_rand << 17;
+    int r = ( int )( m_rand % opt.total_weight );
+    for( size_t i = 0; i < opt.targets.size(); ++i ) {
+        r -= opt.targets[i].weight;
+        if( r < 0 ) {
+            return opt.targets[i];
+        }
+    }
+    return opt.targets.back();
+}
+
+void worker::open_conn( connection& c ) {
+    c.connected = false;
+    c.out.clear();
+    c.out_off = 0;
+    c.in.clear();
+    c.inflight.clear();
+    m_inflight_target[ &c - &m_conns[0] ].clear();
+    c.in_body = false;
+    c.close_after = false;
+    c.requests = 0;
+
+    c.fd = socket( AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0 );
+    if( c.fd < 0 ) {
+        ++stats.connect_errors;
+        return;
+    }
+    int one = 1;
+    setsockopt( c.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof( one ) );
+    if( connect( c.fd, ( struct sockaddr* )&server_addr, sizeof( server_addr ) ) < 0 && errno != EINPROGRESS ) {
+        ++stats.connect_errors;
+        close( c.fd );
+        c.fd = -1;
+        return;
+    }
+    ++stats.connects;
+
+    epoll_event ev;
+    ev.events = EPOLLOUT;  // 可写时连接建立完成
+    ev.data.ptr = &c;
+    epoll_ctl( m_epollfd, EPOLL_CTL_ADD, c.fd, &ev );
+}
+
+// 关闭连接；等待中的请求作废（开环模式下放回队列重新发送，延迟仍从原来应该发出的时间算起）
+void worker::close_conn( connection& c, bool reconnect ) {
+    if( c.fd >= 0 ) {
+        epoll_ctl( m_epollfd, EPOLL_CTL_DEL, c.fd, NULL );
+        close( c.fd );
+        c.fd = -1;
+    }
+    if( m_interval_us > 0 ) {
+        for( size_t i = c.inflight.size(); i > 0; --i ) {
+            m_backlog.push_front( c.inflight[ i - 1 ].intended );
+        }
+    }
+    c.inflight.clear();
+    m_inflight_target[ &c - &m_conns[0] ].clear();
+    if( reconnect && !stop ) {
+        open_conn( c );
+    }
+}
+
+void worker::update_events( connection& c ) {
+    epoll_event ev;
+    ev.events = EPOLLIN | ( c.out_off < c.out.size() ? ( unsigned )EPOLLOUT : 0u );
+    ev.data.ptr = &c;
+    epoll_ctl( m_epollfd, EPOLL_CTL_MOD, c.fd, &ev );
+}
+
+// 把写缓冲区中的请求写出去，返回false表示连接出错
+bool worker::flush( connection& c ) {
+    while( c.out_off < c.out.size() ) {
+        ssize_t n = send( c.fd, c.out.data() + c.out_off, c.out.size() - c.out_off, MSG_NOSIGNAL );
+        if( n < 0 ) {
+            if( errno == EAGAIN ) {
+                break;
+            }
+            return false;
+        }
+        c.out_off += n;
+    }
+    if( c.out_off == c.out.size() ) {
+        c.out.clear();
+        c.out_off = 0;
+    }
+    return true;
+}
+
+// 闭环：把连接上等待的请求补满到depth个，流水线中的请求一次写出
+void worker::send_requests( connection& c, uint64_t now ) {
+    int depth = opt.keepalive ? opt.depth : 1;
+    size_t before = c.out.size();
+    while( ( int )c.inflight.size() < depth ) {
+        const target& t = pick();
+        c.out += t.request;
+        pending p = { now, now };
+        c.inflight.push_back( p );
+        m_inflight_target[ &c - &m_conns[0] ].push_back( &t - &opt.targets[0] );
+    }
+    if( c.out.size() != before ) {
+        if( !flush( c ) ) {
+            ++stats.write_errors;
+            close_conn( c, true );
+            return;
+        }
+        update_events( c );
+    }
+}
+
+// 开环：按速率产生到期的请求
+void worker::generate( uint64_t now ) {
+    if( m_next_us == 0 ) {
+        m_next_us = now;
+    }
+    while( m_next_us <= now ) {
+        if( m_backlog.size() < MAX_BACKLOG ) {
+            m_backlog.push_back( ( uint64_t )m_next_us );
+        } else if( m_next_us >= start_us ) {
+            ++stats.dropped;
+        }
+        m_next_us += m_interval_us;
+    }
+}
+
+// 开环：把排队的请求分给还有空位的连接（每个连接最多depth个）
+void worker::dispatch( uint64_t now ) {
+    int depth = opt.keepalive ? opt.depth : 1;
+    for( size_t i = 0; i < m_conns.size() && !m_backlog.empty(); ++i ) {
+        connection& c = m_conns[i];
+        if( c.fd < 0 || !c.connected || c.close_after ) {
+            continue;
+        }
+        size_t before = c.out.size();
+        while( ( int )c.inflight.size() < depth && !m_backlog.empty() ) {
+            const target& t = pick();
+            c.out += t.request;
+            pending p = { m_backlog.front(), now };
+            m_backlog.pop_front();
+            c.inflight.push_back( p );
+            m_inflight_target[i].push_back( &t - &opt.targets[0] );
+        }
+        if( c.out.size() != before ) {
+            if( !flush( c ) ) {
+                ++stats.write_errors;
+                close_conn( c, true );
+                continue;
+            }
+            update_events( c );
+        }
+    }
+}
+
+// 一个响应接收完
+void worker::complete( connection& c, uint64_t now ) {
+    pending p = c.inflight.front();
+    c.inflight.pop_front();
+    std::deque< int >& targets = m_inflight_target[ &c - &m_conns[0] ];
+    int t = targets.front();
+    targets.pop_front();
+    ++c.requests;
+
+    if( now < start_us ) {
+        return;  // 预热期间完成的请求不计入
+    }
+    stats.latency.record( now - p.intended );
+    if( m_interval_us > 0 ) {
+        stats.service.record( now - p.sent );
+    }
+    ++stats.requests;
+    ++stats.per_target[t];
+    int cls = c.status / 100;
+    ++stats.status[ cls >= 1 && cls <= 5 ? cls - 1 : 5 ];
+}
+
+// 解析收到的数据中完整的响应，返回false表示连接要关闭（响应格式错误或服务器要求关闭）
+bool worker::parse( connection& c ) {
+    uint64_t now = now_us();
+    size_t pos = 0;
+    while( true ) {
+        if( !c.in_body ) {
+            size_t end = c.in.find( "\r\n\r\n", pos );
+            if( end == std::string::npos ) {
+                break;
+            }
+            const char* head = c.in.c_str() + pos;
+            if( strncmp( head, "HTTP/1.", 7 ) != 0 || c.inflight.empty() ) {
+                ++stats.read_errors;
+                return false;
+            }
+            c.status = atoi( head + 9 );
+            c.body_left = -1;
+            c.close_after = strncmp( head, "HTTP/1.0", 8 ) == 0;
+            // 逐行查找需要的头部（不区分大小写）
+            for( size_t line = c.in.find( "\r\n", pos ) + 2; line < end; ) {
+                size_t next = c.in.find( "\r\n", line );
+                const char* l = c.in.c_str() + line;
+                if( strncasecmp( l, "Content-Length:", 15 ) == 0 ) {
+                    c.body_left = atol( l + 15 );
+                } else if( strncasecmp( l, "Connection:", 11 ) == 0 ) {
+                    const char* v = l + 11;
+                    while( *v == ' ' ) {
+                        ++v;
+                    }
+                    if( strncasecmp( v, "close", 5 ) == 0 ) {
+                        c.close_after = true;
+                    } else if( strncasecmp( v, "keep-alive", 10 ) == 0 ) {
+                        c.close_after = false;
+                    }
+                }
+                line = next + 2;
+            }
+            if( c.status == 204 || c.status == 304 || c.status / 100 == 1 ) {
+                c.body_left = 0;
+            }
+            if( c.body_left < 0 && !c.close_after ) {
+                c.body_left = 0;  // 没有长度又不关闭连接（服务器不发送chunked），当作没有正文
+            }
+            stats.bytes += end + 4 - pos;
+            pos = end + 4;
+            c.in_body = true;
+        }
+
+        size_t avail = c.in.size() - pos;
+        if( c.body_left < 0 ) {
+            stats.bytes += avail;  // 正文到连接关闭为止
+            pos += avail;
+            break;
+        }
+        size_t n = avail < ( size_t )c.body_left ? avail : c.body_left;
+        stats.bytes += n;
+        pos += n;
+        c.body_left -= n;
+        if( c.body_left > 0 ) {
+            break;
+        }
+        c.in_body = false;
+        complete( c, now );
+        if( c.close_after ) {
+            c.in.clear();
+            return false;
+        }
+    }
+    c.in.erase( 0, pos );
+    return true;
+}
+
+// 返回false表示连接已关闭（对方关闭、出错或者要求关闭），调用者重新建立连接
+bool worker::on_readable( connection& c ) {
+    char buf[ READ_CHUNK ];
+    while( true ) {
+        ssize_t n = recv( c.fd, buf, sizeof( buf ), 0 );
+        if( n > 0 ) {
+            // 正文不需要保存，只统计字节数
+            if( c.in_body && c.body_left > 0 && c.in.empty() ) {
+                size_t skip = ( size_t )n < ( size_t )c.body_left ? n : c.body_left;
+                c.body_left -= skip;
+                stats.bytes += skip;
+                c.in.append( buf + skip, n - skip );
+            } else {
+                c.in.append( buf, n );
+            }
+            if( !parse( c ) ) {
+                return false;
+            }
+            continue;
+        }
+        if( n == 0 ) {
+            // 正文到连接关闭为止的响应在这里结束
+            if( c.in_body && c.body_left < 0 && !c.inflight.empty() ) {
+                c.in_body = false;
+                complete( c, now_us() );
+            } else if( !c.inflight.empty() ) {
+                ++stats.read_errors;
+            }
+            return false;
+        }
+        if( errno == EAGAIN ) {
+            return true;
+        }
+        ++stats.read_errors;
+        return false;
+    }
+}
+
+// 等待响应超过-o毫秒的连接关闭重连，最早的请求计为超时
+void worker::check_timeouts( uint64_t now ) {
+    uint64_t limit = ( uint64_t )opt.timeout_ms * 1000;
+    for( size_t i = 0; i < m_conns.size(); ++i ) {
+        connection& c = m_conns[i];
+        if( c.fd >= 0 && !c.inflight.empty() && now - c.inflight.front().sent > limit ) {
+            ++stats.timeouts;
+            c.inflight.pop_front();  // 超时的请求不重新发送
+            m_inflight_target[i].pop_front();
+            close_conn( c, true );
+        }
+    }
+}
+
+void worker::loop() {
+    m_epollfd = epoll_create1( EPOLL_CLOEXEC );
+    for( size_t i = 0; i < m_conns.size(); ++i ) {
+        open_conn( m_conns[i] );
+    }
+    if( m_interval_us > 0 ) {
+        m_timerfd = timerfd_create( CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC );
+        epoll_event ev;
+        ev.events = EPOLLIN;
+        ev.data.ptr = NULL;
+        epoll_ctl( m_epollfd, EPOLL_CTL_ADD, m_timerfd, &ev );
+    }
+
+    epoll_event events[ MAX_EVENTS ];
+    uint64_t last_check = now_us();
+    while( !stop ) {
+        uint64_t now = now_us();
+        if( m_interval_us > 0 ) {
+            generate( now );
+            dispatch( now );
+            // 下一个请求到了发出时间时由timerfd唤醒；排队的请求在连接收到响应、空出位置时发出
+            struct itimerspec ts;
+            memset( &ts, 0, sizeof( ts ) );
+            uint64_t next = ( uint64_t )m_next_us;
+            ts.it_value.tv_sec = next / 1000000;
+            ts.it_value.tv_nsec = next % 1000000 * 1000;
+            timerfd_settime( m_timerfd, TFD_TIMER_ABSTIME, &ts, NULL );
+        }
+
+        int n = epoll_wait( m_epollfd, events, MAX_EVENTS, 10 );
+        for( int i = 0; i < n; ++i ) {
+            if( events[i].data.ptr == NULL ) {
+                uint64_t expirations;
+                ssize_t ret = read( m_timerfd, &expirations, sizeof( expirations ) );
+                ( void )ret;
+                continue;
+            }
+            connection& c = *( connection* )events[i].data.ptr;
+            if( !c.connected ) {
+                int err = 0;
+                socklen_t len = sizeof( err );
+                getsockopt( c.fd, SOL_SOCKET, SO_ERROR, &err, &len );
+                if( err != 0 || ( events[i].events & ( EPOLLERR | EPOLLHUP ) ) ) {
+                    ++stats.connect_errors;
+                    close_conn( c, false );
+                    usleep( 1000 );  // 服务器没有启动或拒绝连接时不要空转
+                    open_conn( c );
+                    continue;
+                }
+                c.connected = true;
+                update_events( c );
+                if( m_interval_us == 0 ) {
+                    send_requests( c, now_us() );
+                }
+                continue;
+            }
+            if( events[i].events & ( EPOLLIN | EPOLLERR | EPOLLHUP ) ) {
+                if( !on_readable( c ) ) {
+                    close_conn( c, true );
+                    continue;
+                }
+                if( m_interval_us == 0 && c.inflight.empty() ) {
+                    send_requests( c, now_us() );
+                } else if( m_interval_us == 0 && opt.depth > 1 && ( int )c.inflight.size() < opt.depth ) {
+                    send_requests( c, now_us() );
+                }
+            }
+            if( c.fd >= 0 && ( events[i].events & EPOLLOUT ) ) {
+                if( !flush( c ) ) {
+                    ++stats.write_errors;
+                    close_conn( c, true );
+                    continue;
+                }
+                update_events( c );
+            }
+        }
+
+        now = now_us();
+        if( now - last_check > 100000 ) {
+            check_timeouts( now );
+            last_check = now;
+        }
+    }
+    stats.queued = m_backlog.size();
+}
+
+static void on_alarm( int ) {
+    stop = true;
+}
+
+static void usage( const char* prog ) {
+    printf( "usage: %s [options] host:port path[@weight] [path[@weight] ...]\n", prog );
+    printf( "  -c connections   total connections, spread over the threads (default 100)\n" );
+    printf( "  -t threads       worker threads, one epoll instance each (default 4)\n" );
+    printf( "  -d seconds       measured duration (default 10)\n" );
+    printf( "  -w seconds       warm-up excluded from the results (default 1)\n" );
+    printf( "  -p depth         pipelined requests outstanding per connection (default 1, max %d)\n", MAX_DEPTH );
+    printf( "  -R rate          open loop: total requests per second, latency measured from the intended\n"
+            "                   send time (corrects coordinated omission); 0 is closed loop (default 0)\n" );
+    printf( "  -C               no keep-alive: Connection: close and a new connection per request\n" );
+    printf( "  -o ms            response timeout; the connection is reopened (default 5000)\n" );
+    printf( "paths are picked at random in proportion to their weights (default 1)\n" );
+}
+
+static bool parse_args( int argc, char* argv[] ) {
+    opt.connections = 100;
+    opt.threads = 4;
+    opt.duration = 10;
+    opt.warmup = 1;
+    opt.depth = 1;
+    opt.keepalive = true;
+    opt.rate = 0;
+    opt.timeout_ms = 5000;
+
+    int c;
+    while( ( c = getopt( argc, argv, "c:t:d:w:p:R:Co:" ) ) != -1 ) {
+        switch( c ) {
+            case 'c': opt.connections = atoi( optarg ); break;
+            case 't': opt.threads = atoi( optarg ); break;
+            case 'd': opt.duration = atoi( optarg ); break;
+            case 'w': opt.warmup = atoi( optarg ); break;
+            case 'p': opt.depth = atoi( optarg ); break;
+            case 'R': opt.rate = atof( optarg ); break;
+            case 'C': opt.keepalive = false; break;
+            case 'o': opt.timeout_ms = atoi( optarg ); break;
+            default: return false;
+        }
+    }
+    if( opt.connections <= 0 || opt.threads <= 0 || opt.duration <= 0 || opt.warmup < 0
+        || opt.depth <= 0 || opt.depth > MAX_DEPTH || opt.rate < 0 || opt.timeout_ms <= 0 || argc - optind < 2 ) {
+        return false;
+    }
+    if( opt.threads > opt.connections ) {
+        opt.threads = opt.connections;
+    }
+
+    static std::string host;
+    host = argv[ optind ];
+    size_t colon = host.rfind( ':' );
+    if( colon == std::string::npos ) {
+        return false;
+    }
+    opt.port = atoi( host.c_str() + colon + 1 );
+    host.resize( colon );
+    opt.host = host.c_str();
+
+    struct addrinfo hints, *res;
+    memset( &hints, 0, sizeof( hints ) );
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_STREAM;
+    if( opt.port <= 0 || getaddrinfo( opt.host, NULL, &hints, &res ) != 0 ) {
+        fprintf( stderr, "cannot resolve %s\n", opt.host );
+        return false;
+    }
+    server_addr = *( struct sockaddr_in* )res->ai_addr;
+    server_addr.sin_port = htons( opt.port );
+    freeaddrinfo( res );
+
+    opt.total_weight = 0;
+    for( int i = optind + 1; i < argc; ++i ) {
+        target t;
+        t.path = argv[i];
+        t.weight = 1;
+        size_t at = t.path.rfind( '@' );
+        if( at != std::string::npos ) {
+            t.weight = atoi( t.path.c_str() + at + 1 );
+            t.path.resize( at );
+        }
+        if( t.path.empty() || t.path[0] != '/' || t.weight <= 0 ) {
+            return false;
+        }
+        t.request = "GET " + t.path + " HTTP/1.1\r\nHost: " + host + ":" + std::to_string( opt.port ) + "\r\n"
+                    + ( opt.keepalive ? "" : "Connection: close\r\n" ) + "\r\n";
+        opt.total_weight += t.weight;
+        opt.targets.push_back( t );
+    }
+    return true;
+}
+
+static void print_latency( const char* title, const histogram& h ) {
+    printf( "%s\n", title );
+    printf( "  %-6s %10.1f us\n", "mean", h.mean() );
+    const double qs[] = { 0.5, 0.75, 0.9, 0.99, 0.999, 0.9999 };
+    const char* names[] = { "p50", "p75", "p90", "p99", "p99.9", "p99.99" };
+    for( int i = 0; i < 6; ++i ) {
+        printf( "  %-6s %10lu us\n", names[i], ( unsigned long )h.percentile( qs[i] ) );
+    }
+    printf( "  max    %10lu us\n", ( unsigned long )h.max() );
+}
+
+int main( int argc, char* argv[] ) {
+    if( !parse_args( argc, argv ) ) {
+        usage( argv[0] );
+        return 2;
+    }
+    signal( SIGPIPE, SIG_IGN );
+
+    std::vector< worker* > workers;
+    std::vector< pthread_t > threads( opt.threads );
+    for( int i = 0; i < opt.threads; ++i ) {
+        int conns = opt.connections / opt.threads + ( i < opt.connections % opt.threads ? 1 : 0 );
+        workers.push_back( new worker( i, conns, opt.rate / opt.threads ) );
+    }
+
+    start_us = now_us() + ( uint64_t )opt.warmup * 1000000;
+    signal( SIGALRM, on_alarm );
+    alarm( opt.warmup + opt.duration );
+    for( int i = 0; i < opt.threads; ++i ) {
+        pthread_create( &threads[i], NULL, worker::run, workers[i] );
+    }
+    for( int i = 0; i < opt.threads; ++i ) {
+        pthread_join( threads[i], NULL );
+    }
+    double seconds = ( now_us() - start_us ) / 1e6;
+
+    thread_stats total;
+    for( int i = 0; i < opt.threads; ++i ) {
+        thread_stats& s = workers[i]->stats;
+        total.latency.merge( s.latency );
+        total.service.merge( s.service );
+        total.requests += s.requests;
+        total.bytes += s.bytes;
+        for( int k = 0; k < 6; ++k ) {
+            total.status[k] += s.status[k];
+        }
+        total.connects += s.connects;
+        total.connect_errors += s.connect_errors;
+        total.read_errors += s.read_errors;
+        total.write_errors += s.write_errors;
+        total.timeouts += s.timeouts;
+        total.dropped += s.dropped;
+        total.queued += s.queued;
+        for( size_t k = 0; k < opt.targets.size(); ++k ) {
+            total.per_target[k] += s.per_target[k];
+        }
+        delete workers[i];
+    }
+
+    printf( "%s:%d, %d threads, %d connections, %s, depth %d, %s, %ds (+%ds warm-up)\n",
+            opt.host, opt.port, opt.threads, opt.connections, opt.keepalive ? "keep-alive" : "close",
+            opt.keepalive ? opt.depth : 1, opt.rate > 0 ? "open loop" : "closed loop", opt.duration, opt.warmup );
+    if( opt.rate > 0 ) {
+        printf( "target rate %.0f req/s, %lu still queued at the end\n", opt.rate, ( unsigned long )total.queued );
+    }
+    printf( "requests   %lu (%.0f req/s), %.2f MB/s\n", ( unsigned long )total.requests, total.requests / seconds,
+            total.bytes / seconds / ( 1024 * 1024 ) );
+    printf( "status     2xx %lu, 3xx %lu, 4xx %lu, 5xx %lu, other %lu\n", ( unsigned long )total.status[1],
+            ( unsigned long )total.status[2], ( unsigned long )total.status[3], ( unsigned long )total.status[4],
+            ( unsigned long )( total.status[0] + total.status[5] ) );
+    printf( "errors     connect %lu, read %lu, write %lu, timeout %lu, dropped %lu (connections opened %lu)\n",
+            ( unsigned long )total.connect_errors, ( unsigned long )total.read_errors, ( unsigned long )total.write_errors,
+            ( unsigned long )total.timeouts, ( unsigned long )total.dropped, ( unsigned long )total.connects );
+    if( opt.targets.size() > 1 ) {
+        for( size_t k = 0; k < opt.targets.size(); ++k ) {
+            printf( "  %-30s %lu\n", opt.targets[k].path.c_str(), ( unsigned long )total.per_target[k] );
+        }
+    }
+    if( opt.rate > 0 ) {
+        print_latency( "latency (from intended send time, corrected for coordinated omission)", total.latency );
+        print_latency( "service time (from actual send time, uncorrected)", total.service );
+    } else {
+        print_latency( "latency", total.latency );
+    }
+    return total.requests > 0 ? 0 : 1;
+}
@@ -0,0 +1,15 @@
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <stdio.h>
+#include <stdlib.h>
+
+// 单元测试的断言：不成立时打印位置和表达式，测试进程以1退出
+#define CHECK( expr ) do { \
+    if( !( expr ) ) { \
+        fprintf( stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #expr ); \
+        exit( 1 ); \
+    } \
+} while( 0 )
+
+#endif
@@ -0,0 +1,104 @@
+#include <string.h>
+#include <ctype.h>
+#include <string>
+#include "check.h"
+#include "http_header.h"
+
+// 每个已知头部在完美哈希表中恰好占一个槽
+static void test_slots() {
+    int count[ HEADER_KNOWN_NUMBER ] = {};
+    for( int i = 0; i < HEADER_SLOT_NUMBER; ++i ) {
+        int id = HEADER_SLOTS.id[i];
+        CHECK( id >= -1 && id < HEADER_KNOWN_NUMBER );
+        if( id >= 0 ) {
+            ++count[ id ];
+        }
+    }
+    for( int i = 0; i < HEADER_KNOWN_NUMBER; ++i ) {
+        CHECK( count[i] == 1 );
+    }
+}
+
+// 已知头部不区分大小写都能找到
+static void test_known() {
+    for( int i = 0; i < HEADER_KNOWN_NUMBER; ++i ) {
+        std::string name = known_headers[i].name;
+        CHECK( header_lookup( name.c_str(), name.size() ) == i );
+
+        std::string upper = name;
+        for( size_t k = 0; k < upper.size(); ++k ) {
+            upper[k] = toupper( upper[k] );
+        }
+        CHECK( header_lookup( upper.c_str(), upper.size() ) == i );
+
+        // 常见写法：每个单词首字母大写
+        std::string title = name;
+        for( size_t k = 0; k < title.size(); ++k ) {
+            if( k == 0 || title[ k - 1 ] == '-' ) {
+                title[k] = toupper( title[k] );
+            }
+        }
+        CHECK( header_lookup( title.c_str(), title.size() ) == i );
+    }
+    CHECK( header_lookup( "Content-Length", 14 ) == HEADER_CONTENT_LENGTH );
+    CHECK( header_lookup( "IF-NONE-MATCH", 13 ) == HEADER_IF_NONE_MATCH );
+}
+
+// 字段名只按给定的长度比较（不要求'\0'结尾）
+static void test_length() {
+    const char* line = "Host: localhost";
+    CHECK( header_lookup( line, 4 ) == HEADER_HOST );
+    CHECK( header_lookup( line, 3 ) == -1 );
+    CHECK( header_lookup( line, 5 ) == -1 );
+    CHECK( header_lookup( "", 0 ) == -1 );
+}
+
+// 不是已知头部：前后缀、改了一个字符、未知名字，以及和已知头部落在同一个槽里的名字
+static void test_unknown() {
+    const char* names[] = { "hos", "hostx", "x-host", "content-lengtH2", "accept-encodinx", "x-forwarded-for",
+                            "authorization", "cache-control", "origin", "te", "ranges", "if-match" };
+    for( size_t i = 0; i < sizeof( names ) / sizeof( names[0] ); ++i ) {
+        CHECK( header_lookup( names[i], strlen( names[i] ) ) == -1 );
+    }
+
+    for( int i = 0; i < HEADER_KNOWN_NUMBER; ++i ) {
+        std::string name = known_headers[i].name;
+        for( size_t k = 0; k < name.size(); ++k ) {
+            std::string changed = name;
+            changed[k] = changed[k] == 'z' ? 'y' : 'z';
+            CHECK( header_lookup( changed.c_str(), changed.size() ) == -1 );
+        }
+    }
+
+    // 找一些和已知头部同槽、同长度的名字，必须靠逐字节比较排除
+    int collisions = 0;
+    char name[ 8 ];
+    for( int n = 0; n < 26 * 26 * 26 * 26 && collisions < 100; ++n ) {
+        int v = n;
+        for( int k = 0; k < 4; ++k ) {
+            name[k] = 'a' + v % 26;
+            v /= 26;
+        }
+        int slot = HEADER_SLOTS.id[ header_hash( name, 4, HEADER_SEED ) % HEADER_SLOT_NUMBER ];
+        if( slot >= 0 && known_headers[ slot ].len == 4 && memcmp( name, known_headers[ slot ].name, 4 ) != 0 ) {
+            CHECK( header_lookup( name, 4 ) == -1 );
+            ++collisions;
+        }
+    }
+    CHECK( collisions > 0 );
+}
+
+// 哈希不区分大小写
+static void test_hash() {
+    CHECK( header_hash( "Accept-Encoding", 15, HEADER_SEED ) == header_hash( "accept-encoding", 15, HEADER_SEED ) );
+    CHECK( header_hash( "host", 4, 1 ) != header_hash( "host", 4, 2 ) );
+}
+
+int main() {
+    test_slots();
+    test_known();
+    test_length();
+    test_unknown();
+    test_hash();
+    return 0;
+}
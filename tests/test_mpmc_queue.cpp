@@ -0,0 +1,136 @@
+#include <pthread.h>
+#include <vector>
+#include <atomic>
+#include "check.h"
+#include "mpmc_queue.h"
+
+static const int PRODUCERS = 4;
+static const int CONSUMERS = 4;
+static const int PER_PRODUCER = 200000;
+
+// 容量向上取整为2的幂，最小为2
+static void test_capacity() {
+    CHECK( mpmc_queue< int >( 0 ).capacity() == 2 );
+    CHECK( mpmc_queue< int >( 1 ).capacity() == 2 );
+    CHECK( mpmc_queue< int >( 5 ).capacity() == 8 );
+    CHECK( mpmc_queue< int >( 8 ).capacity() == 8 );
+    CHECK( mpmc_queue< int >( 10000 ).capacity() == 16384 );
+}
+
+// 单线程：先进先出，满时push失败，空时pop失败，转多圈后仍然正确
+static void test_fifo() {
+    mpmc_queue< int > q( 4 );
+    int v;
+    CHECK( !q.pop( v ) );
+    for( int round = 0; round < 10; ++round ) {
+        for( int i = 0; i < 4; ++i ) {
+            CHECK( q.push( round * 10 + i ) );
+        }
+        CHECK( q.size() == 4 );
+        CHECK( !q.push( -1 ) );
+        for( int i = 0; i < 4; ++i ) {
+            CHECK( q.pop( v ) );
+            CHECK( v == round * 10 + i );
+        }
+        CHECK( q.size() == 0 );
+        CHECK( !q.pop( v ) );
+    }
+
+    // 交替入队出队，队列中始终有元素
+    CHECK( q.push( 0 ) );
+    for( int i = 1; i < 100; ++i ) {
+        CHECK( q.push( i ) );
+        CHECK( q.pop( v ) );
+        CHECK( v == i - 1 );
+    }
+    CHECK( q.size() == 1 );
+}
+
+struct shared_state {
+    mpmc_queue< int >* queue;
+    std::atomic< int > produced_done;
+    std::vector< std::atomic< int > >* seen;
+};
+
+struct worker_arg {
+    shared_state* state;
+    int index;
+    bool ordered;   // 消费者：同一个生产者的元素是否按顺序取到
+};
+
+static void* producer( void* p ) {
+    worker_arg* arg = ( worker_arg* )p;
+    for( int i = 0; i < PER_PRODUCER; ++i ) {
+        int v = arg->index * PER_PRODUCER + i;
+        while( !arg->state->queue->push( v ) ) {
+            sched_yield();
+        }
+    }
+    arg->state->produced_done.fetch_add( 1 );
+    return NULL;
+}
+
+static void* consumer( void* p ) {
+    worker_arg* arg = ( worker_arg* )p;
+    int last[ PRODUCERS ];
+    for( int i = 0; i < PRODUCERS; ++i ) {
+        last[i] = -1;
+    }
+    arg->ordered = true;
+    int v;
+    while( true ) {
+        if( arg->state->queue->pop( v ) ) {
+            ( *arg->state->seen )[ v ].fetch_add( 1 );
+            int from = v / PER_PRODUCER;
+            if( v <= last[ from ] ) {
+                arg->ordered = false;
+            }
+            last[ from ] = v;
+        } else if( arg->state->produced_done.load() == PRODUCERS && arg->state->queue->size() == 0 ) {
+            break;
+        } else {
+            sched_yield();
+        }
+    }
+    return NULL;
+}
+
+// 多个生产者和消费者：每个元素恰好被取到一次，同一个生产者的元素在每个消费者看来都是有序的
+static void test_concurrent() {
+    mpmc_queue< int > q( 1024 );
+    std::vector< std::atomic< int > > seen( PRODUCERS * PER_PRODUCER );
+    for( size_t i = 0; i < seen.size(); ++i ) {
+        seen[i] = 0;
+    }
+    shared_state state;
+    state.queue = &q;
+    state.produced_done = 0;
+    state.seen = &seen;
+
+    pthread_t threads[ PRODUCERS + CONSUMERS ];
+    worker_arg args[ PRODUCERS + CONSUMERS ];
+    for( int i = 0; i < PRODUCERS + CONSUMERS; ++i ) {
+        args[i].state = &state;
+        args[i].index = i < PRODUCERS ? i : i - PRODUCERS;
+        CHECK( pthread_create( &threads[i], NULL, i < PRODUCERS ? producer : consumer, &args[i] ) == 0 );
+    }
+    for( int i = 0; i < PRODUCERS + CONSUMERS; ++i ) {
+        pthread_join( threads[i], NULL );
+    }
+
+    for( size_t i = 0; i < seen.size(); ++i ) {
+        CHECK( seen[i].load() == 1 );
+    }
+    for( int i = PRODUCERS; i < PRODUCERS + CONSUMERS; ++i ) {
+        CHECK( args[i].ordered );
+    }
+    int v;
+    CHECK( !q.pop( v ) );
+}
+
+int main() {
+    test_capacity();
+    test_fifo();
+    test_concurrent();
+    return 0;
+}
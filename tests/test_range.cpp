@@ -0,0 +1,106 @@
+#include "check.h"
+#include "range.h"
+
+static const int MAX = 16;
+
+struct expect_range {
+    off_t first;
+    off_t last;
+};
+
+// 解析value，结果必须是n个给定的区间（n为0或-1时只比较返回值）
+static void expect( const char* value, off_t size, int n, const expect_range* ranges = NULL ) {
+    byte_range got[ MAX ];
+    int ret = parse_byte_ranges( value, size, got, MAX );
+    if( ret != n ) {
+        fprintf( stderr, "\"%s\" (size %ld): got %d, expected %d\n", value, ( long )size, ret, n );
+    }
+    CHECK( ret == n );
+    for( int i = 0; i < n; ++i ) {
+        CHECK( got[i].first == ranges[i].first && got[i].last == ranges[i].last );
+    }
+}
+
+static void test_single() {
+    expect_range r1[] = { { 0, 99 } };
+    expect( "bytes=0-99", 1000, 1, r1 );
+    expect( "BYTES=0-99", 1000, 1, r1 );
+
+    // 没有结尾：到文件末尾；结尾超过文件：截断
+    expect_range r2[] = { { 500, 999 } };
+    expect( "bytes=500-", 1000, 1, r2 );
+    expect( "bytes=500-5000", 1000, 1, r2 );
+
+    // 后缀：最后n个字节，超过文件大小时是整个文件
+    expect_range r3[] = { { 900, 999 } };
+    expect( "bytes=-100", 1000, 1, r3 );
+    expect_range r4[] = { { 0, 999 } };
+    expect( "bytes=-5000", 1000, 1, r4 );
+
+    expect_range r5[] = { { 999, 999 } };
+    expect( "bytes=999-999", 1000, 1, r5 );
+    expect( "bytes=-1", 1000, 1, r5 );
+}
+
+static void test_multiple() {
+    expect_range r1[] = { { 0, 9 }, { 20, 29 }, { 990, 999 } };
+    expect( "bytes=0-9,20-29,-10", 1000, 3, r1 );
+    expect( "bytes=0-9, 20-29 ,\t-10", 1000, 3, r1 );
+    expect( "bytes=,0-9,,20-29,-10,", 1000, 3, r1 );
+
+    // 无法满足的区间被跳过，剩下的照常发送
+    expect_range r2[] = { { 0, 9 } };
+    expect( "bytes=0-9,2000-3000", 1000, 1, r2 );
+}
+
+// 没有一个区间能满足：416
+static void test_unsatisfiable() {
+    expect( "bytes=1000-", 1000, -1 );
+    expect( "bytes=1000-2000,5000-", 1000, -1 );
+    expect( "bytes=-0", 1000, -1 );
+    expect( "bytes=0-", 0, -1 );
+    expect( "bytes=-10", 0, -1 );
+}
+
+// 格式不对、不是bytes单位：忽略Range，发送整个文件
+static void test_ignored() {
+    expect( "", 1000, 0 );
+    expect( "bytes=", 1000, 0 );
+    expect( "bytes= , ", 1000, 0 );
+    expect( "items=0-9", 1000, 0 );
+    expect( "bytes 0-9", 1000, 0 );
+    expect( "bytes=9-0", 1000, 0 );
+    expect( "bytes=a-9", 1000, 0 );
+    expect( "bytes=0-9x", 1000, 0 );
+    expect( "bytes=0_9", 1000, 0 );
+    expect( "bytes=-", 1000, 0 );
+    expect( "bytes=0-9;10-19", 1000, 0 );
+    expect( "bytes=99999999999999999999-", 1000, 0 );
+}
+
+// 区间太多，或者重叠的区间加起来超过文件大小：发送整个文件
+static void test_limits() {
+    char value[ 512 ] = "bytes=";
+    int len = 6;
+    for( int i = 0; i < MAX; ++i ) {
+        len += snprintf( value + len, sizeof( value ) - len, "%s%d-%d", i ? "," : "", i * 10, i * 10 + 4 );
+    }
+    byte_range got[ MAX ];
+    CHECK( parse_byte_ranges( value, 1000, got, MAX ) == MAX );
+    CHECK( got[ MAX - 1 ].first == ( MAX - 1 ) * 10 && got[ MAX - 1 ].last == ( MAX - 1 ) * 10 + 4 );
+    snprintf( value + len, sizeof( value ) - len, ",900-909" );
+    CHECK( parse_byte_ranges( value, 1000, got, MAX ) == 0 );
+
+    expect( "bytes=0-599,400-999", 1000, 0 );
+    expect_range r[] = { { 0, 499 }, { 400, 899 } };
+    expect( "bytes=0-499,400-899", 1000, 2, r );
+}
+
+int main() {
+    test_single();
+    test_multiple();
+    test_unsatisfiable();
+    test_ignored();
+    test_limits();
+    return 0;
+}
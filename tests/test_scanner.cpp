@@ -0,0 +1,129 @@
+#include <string.h>
+#include <stdlib.h>
+#include <vector>
+#include "check.h"
+
+// 直接包含实现，测试每一种扫描函数（不只是启动时选中的那个）
+#include "scanner.cpp"
+
+// 逐字节的参考实现
+static void reference( const char* p, int len, line_scan* out ) {
+    out->eol = -1;
+    out->colon = -1;
+    out->spaces = 0;
+    for( int i = 0; i < len; ++i ) {
+        if( p[i] == '\r' || p[i] == '\n' ) {
+            out->eol = i;
+            return;
+        }
+        if( p[i] == ':' && out->colon < 0 ) {
+            out->colon = i;
+        }
+        if( ( p[i] == ' ' || p[i] == '\t' ) && out->spaces < 2 ) {
+            out->space[ out->spaces++ ] = i;
+        }
+    }
+}
+
+static bool same( const line_scan& a, const line_scan& b ) {
+    if( a.eol != b.eol || a.colon != b.colon || a.spaces != b.spaces ) {
+        return false;
+    }
+    for( int i = 0; i < a.spaces; ++i ) {
+        if( a.space[i] != b.space[i] ) {
+            return false;
+        }
+    }
+    return true;
+}
+
+struct scanner {
+    const char* name;
+    scan_fn fn;
+};
+
+static std::vector< scanner > scanners() {
+    std::vector< scanner > ret;
+    ret.push_back( { "scalar", scan_scalar } );
+#ifdef SCANNER_X86
+    __builtin_cpu_init();
+    if( __builtin_cpu_supports( "sse2" ) ) {
+        ret.push_back( { "sse2", scan_sse2 } );
+    }
+    if( __builtin_cpu_supports( "avx2" ) ) {
+        ret.push_back( { "avx2", scan_avx2 } );
+    }
+#endif
+    ret.push_back( { "scan_line", scan_line } );
+    return ret;
+}
+
+static void check_all( const std::vector< scanner >& impls, const char* p, int len ) {
+    line_scan expect;
+    reference( p, len, &expect );
+    for( size_t k = 0; k < impls.size(); ++k ) {
+        line_scan got;
+        impls[k].fn( p, len, &got );
+        if( !same( expect, got ) ) {
+            fprintf( stderr, "%s: \"%.*s\" (len %d): eol %d/%d colon %d/%d spaces %d/%d\n", impls[k].name, len, p, len,
+                     got.eol, expect.eol, got.colon, expect.colon, got.spaces, expect.spaces );
+        }
+        CHECK( same( expect, got ) );
+    }
+}
+
+// 典型的请求行和头部
+static void test_lines( const std::vector< scanner >& impls ) {
+    const char* lines[] = {
+        "GET /index.html HTTP/1.1\r\n",
+        "Host: localhost:8080\r\n",
+        "\r\n",
+        "",
+        "no line end at all, longer than one thirty-two byte block: a b",
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko)\r\n",
+        "X-Tab:\tvalue\twith\ttabs\n",
+        "GET /a:b HTTP/1.0\r\nHost: x\r\n",
+    };
+    for( size_t i = 0; i < sizeof( lines ) / sizeof( lines[0] ); ++i ) {
+        check_all( impls, lines[i], strlen( lines[i] ) );
+    }
+
+    line_scan s;
+    scan_line( "GET /index.html HTTP/1.1\r\n", 26, &s );
+    CHECK( s.eol == 24 && s.colon == -1 && s.spaces == 2 && s.space[0] == 3 && s.space[1] == 15 );
+    scan_line( "Host: localhost:8080\r\n", 22, &s );
+    CHECK( s.eol == 20 && s.colon == 4 && s.spaces == 1 && s.space[0] == 5 );
+}
+
+// 随机内容：各种长度（跨越16/32字节块的边界）和起始对齐，特殊字符较密
+static void test_random( const std::vector< scanner >& impls ) {
+    const char alphabet[] = "abcdefgh  ::\t\r\nxyz";
+    char buf[ 256 + 64 ];
+    srand( 1 );
+    for( int iter = 0; iter < 200000; ++iter ) {
+        int offset = rand() % 64;
+        int len = rand() % 200;
+        // 特殊字符的密度也随机，让行尾、冒号、空白可能出现在块中的任何位置，也可能一个都没有
+        int density = rand() % 4;
+        for( int i = 0; i < len; ++i ) {
+            char c = 'a' + rand() % 26;
+            if( density > 0 && rand() % ( 64 >> density ) == 0 ) {
+                c = alphabet[ rand() % ( sizeof( alphabet ) - 1 ) ];
+            }
+            buf[ offset + i ] = c;
+        }
+        check_all( impls, buf + offset, len );
+    }
+}
+
+int main() {
+    std::vector< scanner > impls = scanners();
+    printf( "scanners:" );
+    for( size_t i = 0; i < impls.size(); ++i ) {
+        printf( " %s", impls[i].name );
+    }
+    printf( "\n" );
+    test_lines( impls );
+    test_random( impls );
+    return 0;
+}
@@ -0,0 +1,133 @@
+#include <vector>
+#include <algorithm>
+#include "check.h"
+#include "timer_wheel.h"
+
+// 时间轮的起点是构造时的timer_now_ms()，测试中的时间都从构造之后取的base算起
+
+static bool contains( const std::vector< timer_entry >& v, void* data ) {
+    for( size_t i = 0; i < v.size(); ++i ) {
+        if( v[i].data == data ) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 到期时间所在的tick之前不会取出，推进到到期时间时一定取出，data/gen/expire原样返回
+static void test_expire() {
+    timer_wheel w( 16, 100 );
+    long base = timer_now_ms();
+    int a, b;
+    w.add( &a, 7, base + 250 );
+    w.add( &b, 8, base + 1000 );
+    CHECK( w.size() == 2 );
+
+    std::vector< timer_entry > expired;
+    w.advance( base + 250 - 100, expired );
+    CHECK( expired.empty() );
+    w.advance( base + 250, expired );
+    CHECK( expired.size() == 1 );
+    CHECK( expired[0].data == &a && expired[0].gen == 7 && expired[0].expire == base + 250 );
+    CHECK( w.size() == 1 );
+
+    expired.clear();
+    w.advance( base + 1000 - 100, expired );
+    CHECK( expired.empty() );
+    w.advance( base + 1000, expired );
+    CHECK( expired.size() == 1 && expired[0].data == &b );
+    CHECK( w.size() == 0 );
+}
+
+// 比一圈还远的项落在同一个槽里，前几圈经过时留在槽中
+static void test_rounds() {
+    timer_wheel w( 8, 10 );
+    long base = timer_now_ms();
+    int near, far;
+    w.add( &near, 0, base + 30 );
+    w.add( &far, 0, base + 30 + 8 * 10 * 5 );   // 和near同一个槽，晚5圈
+
+    std::vector< timer_entry > expired;
+    for( long t = base; t <= base + 30 + 8 * 10 * 5 - 10; t += 10 ) {
+        w.advance( t, expired );
+    }
+    CHECK( expired.size() == 1 && expired[0].data == &near );
+    w.advance( base + 30 + 8 * 10 * 5, expired );
+    CHECK( expired.size() == 2 && expired[1].data == &far );
+}
+
+// 已经过期的项在下一个tick取出
+static void test_past() {
+    timer_wheel w( 16, 10 );
+    long base = timer_now_ms();
+    int a;
+    w.add( &a, 0, base - 1000 );
+    std::vector< timer_entry > expired;
+    w.advance( base - 1000, expired );
+    CHECK( expired.empty() );
+    w.advance( base + 10, expired );
+    CHECK( expired.size() == 1 && expired[0].data == &a );
+}
+
+// 很久没有推进时每个槽只检查一遍，到期的全部取出，没到期的留下
+static void test_long_gap() {
+    timer_wheel w( 16, 10 );
+    long base = timer_now_ms();
+    std::vector< int > items( 200 );
+    for( size_t i = 0; i < items.size(); ++i ) {
+        w.add( &items[i], i, base + 10 + ( long )i * 37 );
+    }
+    int late;
+    w.add( &late, 0, base + 100000 );
+
+    std::vector< timer_entry > expired;
+    w.advance( base + 10 + 199 * 37, expired );
+    CHECK( expired.size() == items.size() );
+    for( size_t i = 0; i < items.size(); ++i ) {
+        CHECK( contains( expired, &items[i] ) );
+    }
+    CHECK( w.size() == 1 );
+
+    std::vector< timer_entry > all;
+    w.entries( all );
+    CHECK( all.size() == 1 && all[0].data == &late );
+}
+
+// 空时不用定时醒来，有项时最多等一个tick
+static void test_wait_time() {
+    timer_wheel w( 16, 100 );
+    long base = timer_now_ms();
+    CHECK( w.wait_time( base ) == -1 );
+    int a;
+    w.add( &a, 0, base + 5000 );
+    int wait = w.wait_time( base );
+    CHECK( wait >= 0 && wait <= 100 );
+    CHECK( w.wait_time( base + 1000 ) == 0 );
+}
+
+// entries()返回所有项，不移除
+static void test_entries() {
+    timer_wheel w( 4, 10 );
+    long base = timer_now_ms();
+    int items[ 10 ];
+    for( int i = 0; i < 10; ++i ) {
+        w.add( &items[i], i, base + 10 * ( i + 1 ) );
+    }
+    std::vector< timer_entry > all;
+    w.entries( all );
+    CHECK( all.size() == 10 );
+    for( int i = 0; i < 10; ++i ) {
+        CHECK( contains( all, &items[i] ) );
+    }
+    CHECK( w.size() == 10 );
+}
+
+int main() {
+    test_expire();
+    test_rounds();
+    test_past();
+    test_long_gap();
+    test_wait_time();
+    test_entries();
+    return 0;
+}
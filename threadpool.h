@@ -1,24 +1,78 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
-#include <list>
 #include <cstdio>
 #include <exception>
 #include <pthread.h>
+#include <atomic>
+#include <vector>
 #include "locker.h"
+#include "mpmc_queue.h"
+#include "log.h"
+#include "affinity.h"
 
 
+// 工作线程取不到任务时先自旋的次数，之后才在futex上睡眠
+#define THREADPOOL_SPIN_COUNT 256
+
+
+// 线程池有两种调度方式：
+// 共享队列：所有工作线程从同一个无锁队列取任务
+// 工作窃取：每个工作线程有自己的队列，提交者按key（如连接的fd）选择工作线程，
+//           同一个连接的任务总是落在同一个线程上；自己的队列空了再去其他线程的队列里偷任务
+// 指定了CPU列表时第i个工作线程绑定到第i个CPU（不够时循环使用），线程先绑定再分配自己的队列，
+// 队列落在线程所在的NUMA节点上
+template< typename T >
 class threadpool {
 public:
 
-    threadpool(int thread_number = 8, int max_requests = 10000);
+    threadpool(int thread_number = 8, int max_requests = 10000, bool work_stealing = false,
+               const std::vector< int >& cpus = std::vector< int >());
     ~threadpool();
     bool append(T* request);
+    bool append(T* request, unsigned key);
+
+    // 统计信息（并发读取，只是近似值）
+    int get_thread_number() const { return m_thread_number; }
+    bool is_work_stealing() const { return m_work_stealing; }
+    // 队列：工作窃取模式下第i个属于第i个工作线程，共享队列模式下只有一个
+    int queue_number() const { return m_work_stealing ? m_thread_number : 1; }
+    size_t queue_depth(int i) const { return m_workers[i].queue->size(); }
+    size_t max_queue_depth(int i) const { return m_workers[i].max_depth.load( std::memory_order_relaxed ); }
+    unsigned long tasks(int i) const { return m_workers[i].tasks.load( std::memory_order_relaxed ); }
+    unsigned long steals(int i) const { return m_workers[i].steals.load( std::memory_order_relaxed ); }
+    unsigned long parks(int i) const { return m_workers[i].parks.load( std::memory_order_relaxed ); }
 
 private:
 
+    // 每个工作线程一个，按缓存行对齐，计数器只由所属线程写
+    struct alignas( 64 ) worker_slot {
+        threadpool* pool;
+        int index;
+        int cpu;                            // 绑定的CPU，-1表示不绑定
+        mpmc_queue< T* >* queue;            // 工作窃取模式下自己的队列；共享队列模式下只有0号有
+        futex idle;                         // 空闲时在这里睡眠
+        std::atomic< bool > sleeping;
+        std::atomic< unsigned long > tasks;
+        std::atomic< unsigned long > steals;
+        std::atomic< unsigned long > parks;
+        std::atomic< size_t > max_depth;    // 队列深度的最大值（入队时更新）
+        unsigned seed;                      // 选择窃取对象的随机数种子
+    };
+
     static void* worker(void* arg);
-    void run();
+    void prepare(worker_slot* self);
+    void wait_ready();
+    void stop(int started);
+    void run(worker_slot* self);
+    T* take(worker_slot* self);
+    bool try_take(worker_slot* self, T*& request);
+    bool push(int i, T* request);
+    void wake(int preferred);
+
+    static void bump(std::atomic< unsigned long >& counter) {
+        counter.store( counter.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+    }
 
 private:
 
@@ -27,108 +81,284 @@ private:
     pthread_t * m_threads;
 
 
-    int m_max_requests; 
+    int m_max_requests;
+
+    bool m_work_stealing;
 
-    std::list< T* > m_workqueue;
+    worker_slot* m_workers;
 
+    std::atomic< unsigned > m_next;     // 没有key时轮流选择工作线程
 
-    locker m_queuelocker;   
 
-    sem m_queuestat;
+    // 正在（或准备）睡眠的线程数，只有大于0时append()才需要futex唤醒（系统调用）
+    std::atomic< int > m_sleepers;
 
 
-    bool m_stop;                    
+    std::atomic< bool > m_stop;
+
+
+    // 所有工作线程分配好自己的队列之后才开始取任务（窃取时会访问其他线程的队列）：
+    // 每个线程准备好后加1，等它达到线程数；创建线程失败时线程池停止，已经在等的线程直接退出
+    futex m_ready;
 };
 
 
 
-threadpool< T >::threadpool(int thread_number, int max_requests) : 
-        m_thread_number(thread_number), m_max_requests(max_requests), 
-        m_stop(false), m_threads(NULL) {
+template< typename T >
+threadpool< T >::threadpool(int thread_number, int max_requests, bool work_stealing, const std::vector< int >& cpus) :
+        m_thread_number(thread_number), m_threads(NULL), m_max_requests(max_requests),
+        m_work_stealing(work_stealing), m_workers(NULL), m_next(0), m_sleepers(0), m_stop(false) {
 
     if((thread_number <= 0) || (max_requests <= 0) ) {
         throw std::exception();
     }
 
 
+    // 无锁有界请求队列：共享队列在这里分配；工作窃取模式下总容量平均分给每个线程，由线程自己分配（见prepare()）
+    m_workers = new worker_slot[m_thread_number];
+    for ( int i = 0; i < thread_number; ++i ) {
+        worker_slot& w = m_workers[i];
+        w.pool = this;
+        w.index = i;
+        w.cpu = cpus.empty() ? -1 : cpus[ i % cpus.size() ];
+        w.queue = NULL;
+        if ( !m_work_stealing && i == 0 ) {
+            w.queue = new mpmc_queue< T* >( max_requests );
+        }
+        w.sleeping = false;
+        w.tasks = 0;
+        w.steals = 0;
+        w.parks = 0;
+        w.max_depth = 0;
+        w.seed = i * 2654435761u + 1;
+    }
+
+
     m_threads = new pthread_t[m_thread_number];
     if(!m_threads) {
         throw std::exception();
     }
 
-
     for ( int i = 0; i < thread_number; ++i ) {
-        printf( "create the %dth thread\n", i);
-
-        if(pthread_create(m_threads + i, NULL, worker, this ) != 0) {
-            delete [] m_threads;
-            throw std::exception();
-        }
+        LOG_INFO( "create the %dth thread", i );
 
-        if( pthread_detach( m_threads[i] ) ) {
-            delete [] m_threads;
+        if(pthread_create(m_threads + i, NULL, worker, m_workers + i ) != 0) {
+            stop( i );
             throw std::exception();
         }
     }
+
+    wait_ready();
 }
 
 
 
+template< typename T >
 threadpool< T >::~threadpool() {
-    delete [] m_threads;
+    stop( m_thread_number );
+}
+
+
+
+// 唤醒前started个工作线程并等待它们退出，然后释放队列。调用前不能再有新任务（事件循环都已经结束），
+// 队列中剩下的任务不再处理
+template< typename T >
+void threadpool< T >::stop( int started ) {
     m_stop = true;
+    m_ready.notify_all();
+    for ( int i = 0; i < started; ++i ) {
+        m_workers[i].idle.notify_all();
+    }
+    for ( int i = 0; i < started; ++i ) {
+        pthread_join( m_threads[i], NULL );
+    }
+    for ( int i = 0; i < m_thread_number; ++i ) {
+        delete m_workers[i].queue;
+    }
+    delete [] m_workers;
+    delete [] m_threads;
 }
 
 
 
+// 队列满时返回false
+template< typename T >
 bool threadpool< T >::append( T* request )
 {
+    return append( request, m_next.fetch_add( 1, std::memory_order_relaxed ) );
+}
 
-    m_queuelocker.lock();
-    if ( m_workqueue.size() > m_max_requests ) {
 
-        m_queuelocker.unlock();
+// 工作窃取模式下任务进入key对应工作线程的队列，那个队列满了就依次尝试其他线程的队列
+template< typename T >
+bool threadpool< T >::append( T* request, unsigned key )
+{
+    int target = 0;
+    if ( m_work_stealing ) {
+        target = key % m_thread_number;
+        int i = target;
+        while ( !push( i, request ) ) {
+            i = ( i + 1 ) % m_thread_number;
+            if ( i == target ) {
+                return false;
+            }
+        }
+    } else if ( !push( 0, request ) ) {
         return false;
     }
-    
-    m_workqueue.push_back(request);
-    m_queuelocker.unlock();
-    m_queuestat.post();
+
+    // 入队和检查睡眠者之间需要全屏障，与take()中登记睡眠配对，保证不会丢失唤醒
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    if ( m_sleepers.load( std::memory_order_relaxed ) > 0 ) {
+        wake( target );
+    }
+    return true;
+}
+
+
+template< typename T >
+bool threadpool< T >::push( int i, T* request )
+{
+    worker_slot& w = m_workers[i];
+    if ( !w.queue->push( request ) ) {
+        return false;
+    }
+    size_t depth = w.queue->size();
+    if ( depth > w.max_depth.load( std::memory_order_relaxed ) ) {
+        w.max_depth.store( depth, std::memory_order_relaxed );
+    }
     return true;
 }
 
 
+// 优先唤醒任务所属的工作线程（保持局部性），它不在睡眠时唤醒任意一个睡眠的线程来窃取
+// 用exchange认领睡眠者，同时提交的多个任务不会重复唤醒同一个线程
+template< typename T >
+void threadpool< T >::wake( int preferred )
+{
+    for ( int n = 0; n < m_thread_number; ++n ) {
+        worker_slot& w = m_workers[ ( preferred + n ) % m_thread_number ];
+        if ( w.sleeping.load( std::memory_order_relaxed ) && w.sleeping.exchange( false, std::memory_order_seq_cst ) ) {
+            w.idle.notify( 1 );
+            return;
+        }
+    }
+}
+
+
+template< typename T >
 void* threadpool< T >::worker( void* arg )
 {
-    threadpool* pool = ( threadpool* )arg;
-    pool->run();
-    return pool;
+    worker_slot* self = ( worker_slot* )arg;
+    self->pool->prepare( self );
+    self->pool->run( self );
+    return self->pool;
 }
 
 
-void threadpool< T >::run() {
+// 在工作线程中：绑定CPU，分配自己的队列，等所有线程都准备好
+template< typename T >
+void threadpool< T >::prepare( worker_slot* self )
+{
+    if ( self->cpu >= 0 ) {
+        if ( bind_thread( self->cpu ) ) {
+            LOG_INFO( "worker %d bound to cpu %d (node %d)", self->index, self->cpu, cpu_node( self->cpu ) );
+        } else {
+            LOG_WARN( "worker %d: bind to cpu %d failed", self->index, self->cpu );
+        }
+    }
+    if ( m_work_stealing ) {
+        self->queue = new mpmc_queue< T* >( ( m_max_requests + m_thread_number - 1 ) / m_thread_number );
+    }
+    m_ready.notify_all();
+    wait_ready();
+}
 
-    while (!m_stop) {
-        m_queuestat.wait();
-        m_queuelocker.lock();
 
-        if ( m_workqueue.empty() ) {
-            m_queuelocker.unlock();
-            continue;
+// 等所有工作线程都准备好，线程池停止时直接返回
+template< typename T >
+void threadpool< T >::wait_ready()
+{
+    unsigned ready;
+    while ( ( ready = m_ready.value() ) < ( unsigned )m_thread_number && !m_stop ) {
+        m_ready.wait( ready );
+    }
+}
+
+
+// 先取自己的队列，再从一个随机位置开始依次窃取其他线程的队列
+template< typename T >
+bool threadpool< T >::try_take( worker_slot* self, T*& request ) {
+
+    if ( !m_work_stealing ) {
+        return m_workers[0].queue->pop( request );
+    }
+
+    if ( self->queue->pop( request ) ) {
+        return true;
+    }
+
+    self->seed = self->seed * 1103515245u + 12345u;
+    int start = ( self->seed >> 16 ) % m_thread_number;
+    for ( int n = 0; n < m_thread_number; ++n ) {
+        int victim = ( start + n ) % m_thread_number;
+        if ( victim != self->index && m_workers[victim].queue->pop( request ) ) {
+            bump( self->steals );
+            return true;
         }
-        
-        T* request = m_workqueue.front();
-        m_workqueue.pop_front();
+    }
+    return false;
+}
+
+
+// 取一个任务：先自旋，仍然没有任务再睡眠；线程池停止时返回NULL
+template< typename T >
+T* threadpool< T >::take( worker_slot* self ) {
 
-        m_queuelocker.unlock();
+    T* request = NULL;
+    while ( !m_stop ) {
+
+        for ( int i = 0; i < THREADPOOL_SPIN_COUNT; ++i ) {
+            if ( try_take( self, request ) ) {
+                return request;
+            }
+            cpu_relax();
+        }
+
+        // 先登记为睡眠者、记下futex的值，再检查一次所有队列：
+        // 之后入队的append()要么看到这个线程在睡眠而唤醒它，要么入队发生在这次检查之前
+        self->sleeping.store( true, std::memory_order_seq_cst );
+        m_sleepers.fetch_add( 1, std::memory_order_seq_cst );
+        unsigned seq = self->idle.value();
+        bool got = try_take( self, request );
+        if ( !got && !m_stop ) {
+            bump( self->parks );
+            self->idle.wait( seq );
+        }
+        m_sleepers.fetch_sub( 1, std::memory_order_relaxed );
+        self->sleeping.store( false, std::memory_order_relaxed );
+        if ( got ) {
+            return request;
+        }
+    }
+    return NULL;
+}
+
+
+template< typename T >
+void threadpool< T >::run( worker_slot* self ) {
+
+    while (!m_stop) {
 
+        T* request = take( self );
         if ( !request ) {
             continue;
         }
+        bump( self->tasks );
         request->process();
     }
 
 
 }
 
-#endif
+#endif
\ No newline at end of file
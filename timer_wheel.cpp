@@ -0,0 +1,67 @@
+#include <time.h>
+#include "timer_wheel.h"
+
+long timer_now_ms() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC_COARSE, &ts );
+    return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+long timer_now_ns() {
+    struct timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+timer_wheel::timer_wheel( int slots, int tick_ms ) :
+        m_slots( slots ), m_tick( tick_ms ), m_current( timer_now_ms() / tick_ms ), m_count( 0 ) {
+}
+
+void timer_wheel::add( void* data, unsigned gen, long expire ) {
+    long tick = expire / m_tick;
+    if( tick <= m_current ) {
+        tick = m_current + 1;  // 已经过期的放到下一个tick处理
+    }
+    timer_entry entry;
+    entry.data = data;
+    entry.gen = gen;
+    entry.expire = expire;
+    m_slots[ tick % m_slots.size() ].push_back( entry );
+    m_count++;
+}
+
+void timer_wheel::advance( long now, std::vector< timer_entry >& expired ) {
+    long target = now / m_tick;
+    if( target - m_current > (long)m_slots.size() ) {
+        // 很久没有推进（比如事件循环被长时间阻塞），每个槽最多检查一遍
+        m_current = target - m_slots.size();
+    }
+    while( m_current < target ) {
+        m_current++;
+        std::vector< timer_entry >& slot = m_slots[ m_current % m_slots.size() ];
+        size_t keep = 0;
+        for( size_t i = 0; i < slot.size(); ++i ) {
+            if( slot[i].expire / m_tick <= m_current ) {
+                expired.push_back( slot[i] );
+                m_count--;
+            } else {
+                slot[ keep++ ] = slot[i];  // 还要再转几圈
+            }
+        }
+        slot.resize( keep );
+    }
+}
+
+void timer_wheel::entries( std::vector< timer_entry >& out ) const {
+    for( size_t i = 0; i < m_slots.size(); ++i ) {
+        out.insert( out.end(), m_slots[i].begin(), m_slots[i].end() );
+    }
+}
+
+int timer_wheel::wait_time( long now ) const {
+    if( m_count == 0 ) {
+        return -1;
+    }
+    long next = ( m_current + 1 ) * m_tick;
+    return next > now ? next - now : 0;
+}
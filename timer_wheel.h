@@ -0,0 +1,48 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <vector>
+
+// 当前的单调时间，单位毫秒（粗粒度时钟，走vDSO）
+long timer_now_ms();
+
+// 精确的单调时间，单位纳秒（统计请求各阶段的耗时用）
+long timer_now_ns();
+
+// 时间轮中的一项：data是定时对象，gen是加入时对象的代数，对象被复用后代数改变，旧的项随之作废
+struct timer_entry {
+    void* data;
+    unsigned gen;
+    long expire;
+};
+
+// 哈希时间轮：按到期时间落到 (expire / tick) % slots 的槽里，插入O(1)；
+// 每个tick只检查当前槽，还没到期的项（转了不止一圈）留在槽里等下一圈。
+// 只在一个线程（事件循环）中使用，不加锁
+class timer_wheel {
+public:
+    timer_wheel( int slots, int tick_ms );
+    ~timer_wheel(){}
+
+    void add( void* data, unsigned gen, long expire );
+
+    // 推进到now，把到期的项放入expired
+    void advance( long now, std::vector< timer_entry >& expired );
+
+    // 把所有还在时间轮中的项追加到out（不移除），其中可能有已经作废的项
+    void entries( std::vector< timer_entry >& out ) const;
+
+    // epoll_wait应等待的毫秒数：到下一个tick的时间，时间轮为空时返回-1
+    int wait_time( long now ) const;
+
+    size_t size() const { return m_count; }
+    int get_tick() const { return m_tick; }
+
+private:
+    std::vector< std::vector< timer_entry > > m_slots;
+    int m_tick;
+    long m_current;     // 已经处理到的tick序号
+    size_t m_count;
+};
+
+#endif
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <limits.h>
+#include <string>
+#include "trace.h"
+#include "timer_wheel.h"
+#include "log.h"
+
+// 后台线程写文件的间隔；一个间隔内最多保存的请求数，多出的丢弃并计数
+static const int TRACE_DUMP_INTERVAL_MS = 10000;
+static const int TRACE_POLL_MS = 100;
+static const size_t TRACE_MAX_RECORDS = 10000;
+
+// 从每个阶段开始到下一个有记录的阶段开始的区间名
+static const char* stage_names[ TRACE_STAGE_NUMBER ] = { "receive", "queue wait", "worker", "parse", "do_request",
+                                                         "build response", "send wait", "write", "done" };
+
+bool tracer::m_enabled = false;
+
+static thread_local unsigned long t_count = 0;
+
+tracer::tracer() : m_every( 0 ), m_slow_ns( 0 ), m_prefix( NULL ), m_base( 0 ), m_dropped( 0 ),
+        m_running( false ), m_stop( false ) {
+}
+
+tracer::~tracer() {
+    stop();
+}
+
+void tracer::stop() {
+    if( m_running ) {
+        m_stop = true;
+        pthread_join( m_thread, NULL );
+        m_running = false;
+    }
+}
+
+bool tracer::init( int every, int slow_ms, const char* prefix ) {
+    m_every = every;
+    m_slow_ns = ( long )slow_ms * 1000000;
+    m_prefix = prefix;
+    m_base = timer_now_ns() / 1000;
+    if( pthread_create( &m_thread, NULL, worker, this ) != 0 ) {
+        return false;
+    }
+    m_running = true;
+    m_enabled = true;
+    return true;
+}
+
+void tracer::finish( const request_trace& t, int fd, int status, size_t bytes, const char* url ) {
+    long first = t.stamp[ TRACE_DONE ];
+    for( int i = 0; i < TRACE_STAGE_NUMBER; ++i ) {
+        if( t.stamp[i] != 0 && t.stamp[i] < first ) {
+            first = t.stamp[i];
+        }
+    }
+    bool sampled = m_every > 0 && ++t_count % m_every == 0;
+    bool slow = m_slow_ns > 0 && t.stamp[ TRACE_DONE ] - first >= m_slow_ns;
+    if( !sampled && !slow ) {
+        return;
+    }
+
+    record r;
+    r.trace = t;
+    r.fd = fd;
+    r.status = status;
+    r.bytes = bytes;
+    snprintf( r.url, sizeof( r.url ), "%s", url ? url : "-" );
+    m_records_lock.lock();
+    if( m_records.size() < TRACE_MAX_RECORDS ) {
+        m_records.push_back( r );
+    } else {
+        m_dropped.fetch_add( 1, std::memory_order_relaxed );
+    }
+    m_records_lock.unlock();
+}
+
+void* tracer::worker( void* arg ) {
+    tracer* t = ( tracer* )arg;
+    t->run();
+    return t;
+}
+
+// 每隔TRACE_DUMP_INTERVAL_MS把收集到的请求写成一个文件，停止时把剩下的也写出去
+void tracer::run() {
+    std::vector< record > records;
+    long last = timer_now_ms();
+    while( true ) {
+        bool stop = m_stop;
+        if( !stop && timer_now_ms() - last < TRACE_DUMP_INTERVAL_MS ) {
+            usleep( TRACE_POLL_MS * 1000 );
+            continue;
+        }
+        last = timer_now_ms();
+        m_records_lock.lock();
+        records.swap( m_records );
+        m_records_lock.unlock();
+        if( !records.empty() ) {
+            dump( records );
+            records.clear();
+        }
+        if( stop ) {
+            break;
+        }
+    }
+}
+
+static void append( std::string& out, const char* format, ... ) __attribute__(( format( printf, 2, 3 ) ));
+
+static void append( std::string& out, const char* format, ... ) {
+    char buf[ 512 ];
+    va_list arg_list;
+    va_start( arg_list, format );
+    int n = vsnprintf( buf, sizeof( buf ), format, arg_list );
+    va_end( arg_list );
+    if( n > 0 ) {
+        out.append( buf, n < ( int )sizeof( buf ) ? n : sizeof( buf ) - 1 );
+    }
+}
+
+// JSON字符串中的引号、反斜杠和控制字符需要转义
+static void append_json_string( std::string& out, const char* s ) {
+    for( ; *s; ++s ) {
+        unsigned char c = *s;
+        if( c == '"' || c == '\\' ) {
+            out.push_back( '\\' );
+            out.push_back( c );
+        } else if( c < 0x20 ) {
+            append( out, "\\u%04x", c );
+        } else {
+            out.push_back( c );
+        }
+    }
+}
+
+// 一个完整区间事件（ph为X），时间单位微秒
+static void append_span( std::string& out, const char* name, const char* cat, int tid, double ts, double dur ) {
+    out.append( "{\"name\":\"" );
+    append_json_string( out, name );
+    append( out, "\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f", cat, tid, ts, dur );
+}
+
+void tracer::dump( const std::vector< record >& records ) {
+    std::string out;
+    out.reserve( records.size() * 1024 );
+    out.append( "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+                "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"webserver\"}}" );
+    for( size_t i = 0; i < records.size(); ++i ) {
+        const record& r = records[i];
+        const long* stamp = r.trace.stamp;
+        long first = stamp[ TRACE_DONE ];
+        for( int k = 0; k < TRACE_STAGE_NUMBER; ++k ) {
+            if( stamp[k] != 0 && stamp[k] < first ) {
+                first = stamp[k];
+            }
+        }
+
+        // 整个请求，各阶段的区间嵌套在它下面（同一个tid，时间上包含）
+        char name[ 80 ];
+        snprintf( name, sizeof( name ), "GET %s", r.url );
+        out.append( ",\n" );
+        append_span( out, name, "request", r.fd, first / 1000.0 - m_base, ( stamp[ TRACE_DONE ] - first ) / 1000.0 );
+        append( out, ",\"args\":{\"status\":%d,\"bytes\":%zu}}", r.status, r.bytes );
+
+        for( int k = 0; k < TRACE_DONE; ++k ) {
+            if( stamp[k] == 0 ) {
+                continue;
+            }
+            int next = k + 1;
+            while( stamp[ next ] == 0 ) {
+                ++next;
+            }
+            if( stamp[ next ] < stamp[k] ) {
+                continue;  // 流水线中后面的请求：交给线程池的时间早于这个请求开始
+            }
+            out.append( ",\n" );
+            append_span( out, stage_names[k], "stage", r.fd, stamp[k] / 1000.0 - m_base, ( stamp[ next ] - stamp[k] ) / 1000.0 );
+            out.append( "}" );
+        }
+    }
+    out.append( "\n]}\n" );
+
+    static int seq = 0;
+    char path[ PATH_MAX ];
+    char date[ 32 ];
+    time_t now = time( NULL );
+    struct tm tm;
+    localtime_r( &now, &tm );
+    strftime( date, sizeof( date ), "%Y-%m-%d-%H%M%S", &tm );
+    snprintf( path, sizeof( path ), "%s-%s-%d.json", m_prefix, date, seq++ );
+    int fd = open( path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 );
+    if( fd < 0 ) {
+        LOG_WARN( "open trace file %s failed, errno is: %d", path, errno );
+        return;
+    }
+    size_t off = 0;
+    while( off < out.size() ) {
+        ssize_t n = ::write( fd, out.data() + off, out.size() - off );
+        if( n <= 0 ) {
+            break;
+        }
+        off += n;
+    }
+    close( fd );
+    LOG_INFO( "wrote %zu traced requests to %s", records.size(), path );
+}
@@ -0,0 +1,77 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stddef.h>
+#include <pthread.h>
+#include <atomic>
+#include <vector>
+#include "locker.h"
+
+// 一个请求经过的各个阶段，记录的是进入这个阶段的时间：
+// 收到第一个字节、事件循环交给线程池、工作线程取出、开始解析、头部解析完（do_request()开始）、
+// do_request()返回（开始生成响应）、响应进入发送队列、第一次发送、发送完
+enum TRACE_STAGE { TRACE_RECV = 0, TRACE_QUEUE, TRACE_WORKER, TRACE_PARSE, TRACE_REQUEST, TRACE_RESPONSE,
+                   TRACE_SEND, TRACE_WRITE, TRACE_DONE, TRACE_STAGE_NUMBER };
+
+// 一个请求各阶段的时间（timer_now_ns()），0表示没有经过这个阶段
+struct request_trace {
+    long stamp[ TRACE_STAGE_NUMBER ];
+};
+
+// 请求的阶段耗时采样：开启后每个请求都打时间戳（几次vDSO的clock_gettime），请求结束时按比例抽样、
+// 加上所有超过耗时阈值的慢请求，交给后台线程定期写成Chrome trace event格式的JSON文件
+// （chrome://tracing或Perfetto可以直接打开），每个请求一行，各阶段是嵌套在请求下面的区间
+class tracer {
+public:
+    static tracer* get_instance() {
+        static tracer instance;
+        return &instance;
+    }
+
+    // every：每个线程每every个请求记录一个，0表示不按比例抽样；slow_ms：耗时不少于它的请求都记录，0表示不按耗时；
+    // prefix：文件路径前缀，实际文件名为 前缀-YYYY-MM-DD-HHMMSS-序号.json
+    bool init( int every, int slow_ms, const char* prefix );
+
+    // 请求结束时调用，决定是否记录
+    void finish( const request_trace& t, int fd, int status, size_t bytes, const char* url );
+
+    unsigned long dropped() const { return m_dropped.load( std::memory_order_relaxed ); }
+
+    // 写出还没写的请求，停止后台线程
+    void stop();
+
+public:
+    static bool m_enabled;
+
+private:
+    tracer();
+    ~tracer();
+
+    struct record {
+        request_trace trace;
+        int fd;
+        int status;
+        size_t bytes;
+        char url[ 64 ];
+    };
+
+    static void* worker( void* arg );
+    void run();
+    void dump( const std::vector< record >& records );
+
+private:
+    int m_every;
+    long m_slow_ns;
+    const char* m_prefix;
+    long m_base;                        // 文件中的时间从这里开始算（微秒）
+
+    std::vector< record > m_records;    // 等待写到文件的请求，只有被选中的请求才加锁
+    locker m_records_lock;
+    std::atomic< unsigned long > m_dropped;
+
+    pthread_t m_thread;
+    std::atomic< bool > m_running;
+    std::atomic< bool > m_stop;
+};
+
+#endif
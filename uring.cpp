@@ -0,0 +1,197 @@
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <signal.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "uring.h"
+
+static int io_uring_setup( unsigned entries, io_uring_params* p ) {
+    return ( int )syscall( __NR_io_uring_setup, entries, p );
+}
+
+static int io_uring_enter( int fd, unsigned to_submit, unsigned min_complete, unsigned flags, const void* arg, size_t argsz ) {
+    return ( int )syscall( __NR_io_uring_enter, fd, to_submit, min_complete, flags, arg, argsz );
+}
+
+static int io_uring_register( int fd, unsigned opcode, const void* arg, unsigned nr_args ) {
+    return ( int )syscall( __NR_io_uring_register, fd, opcode, arg, nr_args );
+}
+
+uring::uring() : m_fd( -1 ), m_ring( MAP_FAILED ), m_ring_size( 0 ), m_sqes( ( io_uring_sqe* )MAP_FAILED ), m_sqes_size( 0 ),
+        m_sq_head( NULL ), m_sq_tail( NULL ), m_sq_mask( 0 ), m_sq_entries( 0 ), m_sqe_tail( 0 ),
+        m_cq_head( NULL ), m_cq_tail( NULL ), m_cq_mask( 0 ), m_cqes( NULL ),
+        m_buf_ring( ( io_uring_buf_ring* )MAP_FAILED ), m_buf_base( ( char* )MAP_FAILED ), m_buf_count( 0 ), m_buf_size( 0 ),
+        m_buf_tail( 0 ), m_file_count( 0 ) {
+}
+
+uring::~uring() {
+    if( m_fd >= 0 ) {
+        close( m_fd );
+    }
+    if( m_ring != MAP_FAILED ) {
+        munmap( m_ring, m_ring_size );
+    }
+    if( m_sqes != MAP_FAILED ) {
+        munmap( m_sqes, m_sqes_size );
+    }
+    if( m_buf_ring != MAP_FAILED ) {
+        munmap( m_buf_ring, m_buf_count * sizeof( io_uring_buf ) );
+    }
+    if( m_buf_base != MAP_FAILED ) {
+        munmap( m_buf_base, ( size_t )m_buf_count * m_buf_size );
+    }
+}
+
+bool uring::init( unsigned entries ) {
+    io_uring_params p;
+    memset( &p, 0, sizeof( p ) );
+    // 只有事件循环线程提交，完成项的后续工作（task work）推迟到它调用io_uring_enter时再做，不打断它处理请求；
+    // 一个提交项出错时继续提交后面的项
+    p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN | IORING_SETUP_SUBMIT_ALL;
+    m_fd = io_uring_setup( entries, &p );
+    if( m_fd < 0 && errno == EINVAL ) {
+        memset( &p, 0, sizeof( p ) );  // 6.1之前的内核没有这些标志
+        m_fd = io_uring_setup( entries, &p );
+    }
+    if( m_fd < 0 ) {
+        return false;
+    }
+    // 需要的特性：SQ和CQ共用一次mmap、等待完成时带超时参数、CQ满时内核不丢弃完成项
+    unsigned features = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_EXT_ARG | IORING_FEAT_NODROP;
+    if( ( p.features & features ) != features ) {
+        errno = ENOSYS;
+        return false;
+    }
+
+    size_t sq_size = p.sq_off.array + p.sq_entries * sizeof( unsigned );
+    size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof( io_uring_cqe );
+    m_ring_size = sq_size > cq_size ? sq_size : cq_size;
+    m_ring = mmap( NULL, m_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING );
+    if( m_ring == MAP_FAILED ) {
+        return false;
+    }
+    m_sqes_size = p.sq_entries * sizeof( io_uring_sqe );
+    m_sqes = ( io_uring_sqe* )mmap( NULL, m_sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES );
+    if( m_sqes == MAP_FAILED ) {
+        return false;
+    }
+
+    char* ring = ( char* )m_ring;
+    m_sq_head = ( unsigned* )( ring + p.sq_off.head );
+    m_sq_tail = ( unsigned* )( ring + p.sq_off.tail );
+    m_sq_mask = *( unsigned* )( ring + p.sq_off.ring_mask );
+    m_sq_entries = p.sq_entries;
+    m_sqe_tail = *m_sq_tail;
+    // SQ的下标数组固定为0~n-1，提交项按顺序使用
+    unsigned* array = ( unsigned* )( ring + p.sq_off.array );
+    for( unsigned i = 0; i < m_sq_entries; ++i ) {
+        array[i] = i;
+    }
+
+    m_cq_head = ( unsigned* )( ring + p.cq_off.head );
+    m_cq_tail = ( unsigned* )( ring + p.cq_off.tail );
+    m_cq_mask = *( unsigned* )( ring + p.cq_off.ring_mask );
+    m_cqes = ( io_uring_cqe* )( ring + p.cq_off.cqes );
+    return true;
+}
+
+io_uring_sqe* uring::get_sqe() {
+    unsigned head = __atomic_load_n( m_sq_head, __ATOMIC_ACQUIRE );
+    if( m_sqe_tail - head >= m_sq_entries ) {
+        return NULL;
+    }
+    io_uring_sqe* sqe = &m_sqes[ m_sqe_tail & m_sq_mask ];
+    ++m_sqe_tail;
+    memset( sqe, 0, sizeof( *sqe ) );
+    return sqe;
+}
+
+int uring::submit( unsigned wait_nr, int timeout_ms ) {
+    __atomic_store_n( m_sq_tail, m_sqe_tail, __ATOMIC_RELEASE );
+    // 上一次没有被内核取走的项（被信号打断等）也在这里一起提交
+    unsigned to_submit = m_sqe_tail - __atomic_load_n( m_sq_head, __ATOMIC_ACQUIRE );
+
+    unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+    struct __kernel_timespec ts;
+    io_uring_getevents_arg arg;
+    const void* argp = NULL;
+    size_t argsz = 0;
+    if( wait_nr > 0 && timeout_ms >= 0 ) {
+        ts.tv_sec = timeout_ms / 1000;
+        ts.tv_nsec = ( long long )( timeout_ms % 1000 ) * 1000000;
+        memset( &arg, 0, sizeof( arg ) );
+        arg.sigmask_sz = _NSIG / 8;
+        arg.ts = ( __u64 )( unsigned long )&ts;
+        flags |= IORING_ENTER_EXT_ARG;
+        argp = &arg;
+        argsz = sizeof( arg );
+    }
+    int ret = io_uring_enter( m_fd, to_submit, wait_nr, flags, argp, argsz );
+    return ret < 0 ? -errno : ret;
+}
+
+io_uring_cqe* uring::peek() {
+    unsigned head = *m_cq_head;
+    if( head == __atomic_load_n( m_cq_tail, __ATOMIC_ACQUIRE ) ) {
+        return NULL;
+    }
+    return &m_cqes[ head & m_cq_mask ];
+}
+
+void uring::seen() {
+    __atomic_store_n( m_cq_head, *m_cq_head + 1, __ATOMIC_RELEASE );
+}
+
+bool uring::setup_buffers( unsigned short group, unsigned count, unsigned size ) {
+    m_buf_ring = ( io_uring_buf_ring* )mmap( NULL, count * sizeof( io_uring_buf ), PROT_READ | PROT_WRITE,
+                                             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( m_buf_ring == MAP_FAILED ) {
+        return false;
+    }
+    m_buf_base = ( char* )mmap( NULL, ( size_t )count * size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if( m_buf_base == MAP_FAILED ) {
+        munmap( m_buf_ring, count * sizeof( io_uring_buf ) );
+        m_buf_ring = ( io_uring_buf_ring* )MAP_FAILED;
+        return false;
+    }
+    m_buf_count = count;
+    m_buf_size = size;
+
+    io_uring_buf_reg reg;
+    memset( &reg, 0, sizeof( reg ) );
+    reg.ring_addr = ( __u64 )( unsigned long )m_buf_ring;
+    reg.ring_entries = count;
+    reg.bgid = group;
+    if( io_uring_register( m_fd, IORING_REGISTER_PBUF_RING, &reg, 1 ) < 0 ) {
+        return false;
+    }
+    for( unsigned i = 0; i < count; ++i ) {
+        recycle( i );
+    }
+    return true;
+}
+
+void uring::recycle( unsigned bid ) {
+    // 不用m_buf_ring->bufs：C++中__DECLARE_FLEX_ARRAY展开出的空结构体占了位置，数组的偏移和内核不一致；
+    // 环的第一项和tail重叠，这是内核规定的布局
+    io_uring_buf* buf = ( io_uring_buf* )m_buf_ring + ( m_buf_tail & ( m_buf_count - 1 ) );
+    buf->addr = ( __u64 )( unsigned long )buffer( bid );
+    buf->len = m_buf_size;
+    buf->bid = bid;
+    ++m_buf_tail;
+    __atomic_store_n( &m_buf_ring->tail, m_buf_tail, __ATOMIC_RELEASE );
+}
+
+bool uring::register_files( unsigned count ) {
+    io_uring_rsrc_register reg;
+    memset( &reg, 0, sizeof( reg ) );
+    reg.nr = count;
+    reg.flags = IORING_RSRC_REGISTER_SPARSE;
+    if( io_uring_register( m_fd, IORING_REGISTER_FILES2, &reg, sizeof( reg ) ) < 0 ) {
+        return false;
+    }
+    m_file_count = count;
+    return true;
+}
@@ -0,0 +1,65 @@
+#ifndef URING_H
+#define URING_H
+
+#include <linux/io_uring.h>
+#include <stddef.h>
+
+// io_uring的简单封装：直接用系统调用建立提交队列（SQ）和完成队列（CQ），不依赖liburing。
+// 只能由一个线程使用（事件循环的线程，创建时指定了IORING_SETUP_SINGLE_ISSUER）
+class uring {
+public:
+    uring();
+    ~uring();
+
+    // 创建SQ有entries项的实例；内核不支持io_uring（或被禁用）时返回false，errno为原因
+    bool init( unsigned entries );
+
+    // 取一个空的提交项，队列满时返回NULL（调用者先submit()）
+    io_uring_sqe* get_sqe();
+    // 提交所有准备好的项，wait_nr大于0时等待至少wait_nr个完成项，最多等timeout_ms毫秒（-1一直等）；
+    // 返回提交的项数，失败返回-errno（超时为-ETIME，被信号打断为-EINTR）
+    int submit( unsigned wait_nr, int timeout_ms );
+
+    // 下一个完成项，没有时返回NULL；处理完调用seen()
+    io_uring_cqe* peek();
+    void seen();
+
+    // 注册提供给recv的缓冲区环（provided buffers）：count个size字节的缓冲区，编号0~count-1，count必须是2的幂。
+    // recv完成时内核选出一个缓冲区并在完成项中给出编号，用完后recycle()还回环中
+    bool setup_buffers( unsigned short group, unsigned count, unsigned size );
+    char* buffer( unsigned bid ) { return m_buf_base + ( size_t )bid * m_buf_size; }
+    void recycle( unsigned bid );
+
+    // 注册count个空位的固定文件表（registered files），之后用IORING_OP_FILES_UPDATE填入
+    bool register_files( unsigned count );
+    unsigned get_file_count() const { return m_file_count; }
+
+private:
+    int m_fd;
+
+    void* m_ring;           // SQ和CQ共用一次mmap（IORING_FEAT_SINGLE_MMAP）
+    size_t m_ring_size;
+    io_uring_sqe* m_sqes;
+    size_t m_sqes_size;
+
+    unsigned* m_sq_head;
+    unsigned* m_sq_tail;
+    unsigned m_sq_mask;
+    unsigned m_sq_entries;
+    unsigned m_sqe_tail;    // 已经填好、还没有对内核可见的提交项的末尾
+
+    unsigned* m_cq_head;
+    unsigned* m_cq_tail;
+    unsigned m_cq_mask;
+    io_uring_cqe* m_cqes;
+
+    io_uring_buf_ring* m_buf_ring;
+    char* m_buf_base;
+    unsigned m_buf_count;
+    unsigned m_buf_size;
+    unsigned short m_buf_tail;
+
+    unsigned m_file_count;
+};
+
+#endif